@@ -0,0 +1,313 @@
+#include "async_loader.h"
+#include <map>
+#include <mutex>
+#include <deque>
+#include <chrono>
+#include <future>
+#include <algorithm>
+#include <iostream>
+#include <assimp/scene.h>
+#include "capabilities.h"
+#include "image_load_store.h"
+#include "thread_pool.h"
+#include "buffer.h"
+#include "state.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// AsyncLoad
+
+AsyncLoadImpl::AsyncLoadImpl(const std::string& name, const fs::path& path)
+    : name(name), path(path), parsed(false), num_items(0), num_done(0) {}
+
+AsyncLoadImpl::~AsyncLoadImpl() {}
+
+// ------------------------------------------
+// loader state
+
+// produced on workers
+struct ParsedScene {
+    AsyncLoad load;
+    ImportedScene imported;
+    std::string error;
+};
+struct DecodedImage {
+    AsyncLoad load; // empty for AsyncLoader::load_texture
+    Texture2D texture;
+    bool mipmap;
+    std::function<void(const Texture2DImpl&)> on_done;
+    ImageData image;
+    std::string error;
+};
+static std::mutex mutex; // guards the two queues below
+static std::deque<ParsedScene> parsed_scenes;
+static std::deque<DecodedImage> decoded_images;
+
+// GL thread only
+struct Upload {
+    AsyncLoad load;
+    // mesh
+    Mesh mesh;
+    Geometry geometry;
+    // texture
+    DecodedImage decoded;
+    std::unique_ptr<Texture2DImpl> staging; // filled row-wise, then swapped into the placeholder
+    uint32_t next_row = 0;
+    size_t bytes = 0;
+
+    inline bool finished() const { return mesh ? bool(mesh->geometry) : staging && next_row == uint32_t(staging->h); }
+};
+static std::deque<Upload> uploads;
+static std::vector<std::future<void>> tasks; // in flight on the workers, drained by AsyncLoader::clear
+static uint32_t num_decoding = 0;
+static StreamPUBO pbo;
+
+size_t AsyncLoader::budget_bytes = 8 * 1024 * 1024;
+double AsyncLoader::budget_ms = 2.0;
+
+// ------------------------------------------
+// helper funcs
+
+static size_t geometry_bytes(const GeometryImpl& geometry) {
+    size_t bytes = geometry.positions.size() * sizeof(glm::vec3) + geometry.normals.size() * sizeof(glm::vec3) +
+        geometry.texcoords.size() * sizeof(glm::vec2) + geometry.indices.size() * sizeof(uint32_t);
+    for (const auto& lod : geometry.lods)
+        bytes += lod.indices.size() * sizeof(uint32_t);
+    return bytes;
+}
+
+static void item_done(const AsyncLoad& load) {
+    if (!load) return;
+    AsyncLoad handle = load;
+    handle->num_done++;
+    if (handle->done() && handle->on_done)
+        handle->on_done(*handle);
+}
+
+// handles are moved out of the tasks, so the last reference is never dropped on a worker
+static void decode(const AsyncLoad& load, const Texture2D& texture, bool mipmap, const std::function<void(const Texture2DImpl&)>& on_done) {
+    num_decoding++;
+    tasks.push_back(ThreadPool::global().enqueue([load, texture, mipmap, on_done]() mutable {
+        DecodedImage decoded = { std::move(load), std::move(texture), mipmap, std::move(on_done), ImageData(), "" };
+        try {
+            decoded.image = image_load(decoded.texture->loaded_from_path);
+        } catch (const std::exception& e) {
+            decoded.error = e.what();
+        }
+        const std::lock_guard<std::mutex> lock(mutex);
+        decoded_images.push_back(std::move(decoded));
+    }));
+}
+
+// create materials with placeholder textures and queue meshes and image decoding
+static void finish_parse(ParsedScene& parsed) {
+    AsyncLoad load = parsed.load;
+    load->parsed = true;
+    if (!parsed.error.empty()) {
+        std::cerr << "WARN: AsyncLoader: " << parsed.error << std::endl;
+        load->error = parsed.error;
+        if (load->on_done) load->on_done(*load);
+        return;
+    }
+    std::promise<ImageData> empty;
+    empty.set_value(ImageData());
+    const std::shared_future<ImageData> placeholder = empty.get_future().share();
+    ImageFutures images;
+    const aiScene* scene_ai = parsed.imported.scene;
+    for (uint32_t i = 0; i < scene_ai->mNumMaterials; ++i)
+        for (const auto& texture_path : MaterialImpl::texture_paths(load->path.parent_path(), scene_ai->mMaterials[i]))
+            images[texture_path] = placeholder;
+    const auto meshes = link_materials(load->path, parsed.imported, images);
+    parsed.imported = ImportedScene(); // release the assimp scene
+    // decode each image once, materials referencing the same file share the texture
+    std::map<fs::path, Texture2D> textures;
+    for (auto [geometry, material] : meshes) {
+        for (auto& [uniform_name, texture] : material->texture_map) {
+            if (texture->id != 0 || texture->loaded_from_path.empty()) continue;
+            const auto it = textures.find(texture->loaded_from_path);
+            if (it != textures.end()) {
+                texture = it->second;
+                continue;
+            }
+            textures[texture->loaded_from_path] = texture;
+            load->textures.push_back(texture);
+            decode(load, texture, true, {});
+        }
+        Mesh mesh(geometry->name + "/" + material->name);
+        mesh->material = material;
+        load->meshes.push_back(mesh);
+        Upload upload;
+        upload.load = load;
+        upload.mesh = mesh;
+        upload.geometry = geometry;
+        upload.bytes = geometry_bytes(*geometry);
+        uploads.push_back(std::move(upload));
+    }
+    load->num_items = uint32_t(load->meshes.size() + load->textures.size());
+    if (load->done() && load->on_done)
+        load->on_done(*load);
+}
+
+static size_t upload_mesh(Upload& upload) {
+    upload.mesh->geometry = upload.geometry;
+    upload.mesh->upload_gpu();
+    return upload.bytes;
+}
+
+// upload as many rows as budget and PBO allow, returns bytes uploaded
+static size_t upload_texture(Upload& upload, size_t budget_left, bool first) {
+    const auto& [data, w, h, channels, is_hdr] = upload.decoded.image;
+    const bool mipmap = upload.decoded.mipmap;
+    const size_t row_bytes = size_t(w) * channels * (is_hdr ? sizeof(float) : 1);
+    // rows are converted to the GPU-native layout while copying into the PBO
+    const size_t upload_row_bytes = size_t(w) * Texture2DImpl::upload_pixel_bytes(channels, is_hdr, mipmap);
+    if (!upload.staging) // allocate storage only
+        upload.staging = std::make_unique<Texture2DImpl>(upload.decoded.texture->name + "_staging", upload.decoded.texture->loaded_from_path,
+                ImageData(ImageBuffer(), w, h, channels, is_hdr), mipmap);
+    uint32_t rows = uint32_t(std::min<size_t>(std::max<size_t>(budget_left / upload_row_bytes, 1), h - upload.next_row));
+    const uint8_t* src = data.data() + upload.next_row * row_bytes;
+    if (pbo) {
+        const size_t available = pbo->available() > pbo->alignment ? pbo->available() - pbo->alignment : 0;
+        rows = uint32_t(std::min<size_t>(rows, available / upload_row_bytes));
+        if (rows == 0 && !first) return 0; // region exhausted, continue next frame
+    }
+    if (rows > 0 && pbo) {
+        const auto alloc = pbo->allocate(rows * upload_row_bytes);
+        Texture2DImpl::convert_for_upload(src, (uint8_t*)alloc.ptr, size_t(rows) * w, channels, is_hdr, mipmap);
+        GLState::bind_buffer(GL_PIXEL_UNPACK_BUFFER, pbo->id);
+        upload.staging->upload_subimage(0, upload.next_row, w, rows, (const void*)alloc.offset_bytes);
+        GLState::unbind_buffer(GL_PIXEL_UNPACK_BUFFER);
+    } else { // no persistent mapping available or a single row exceeds the PBO region: upload from client memory
+        rows = std::max(rows, 1u);
+        std::vector<uint8_t> converted(rows * upload_row_bytes);
+        Texture2DImpl::convert_for_upload(src, converted.data(), size_t(rows) * w, channels, is_hdr, mipmap);
+        upload.staging->upload_subimage(0, upload.next_row, w, rows, converted.data());
+    }
+    upload.next_row += rows;
+    return rows * upload_row_bytes;
+}
+
+// move the GL texture from staging into the placeholder, so the handle becomes valid
+static void finish_texture(Upload& upload) {
+    Texture2DImpl& staging = *upload.staging, &texture = *upload.decoded.texture;
+    if (upload.decoded.mipmap) staging.generate_mipmaps();
+    texture.swap(staging);
+    upload.staging.reset();
+    upload.decoded.image = ImageData();
+}
+
+// ------------------------------------------
+// AsyncLoader
+
+AsyncLoad AsyncLoader::load_meshes(const fs::path& path, const MeshLoadOptions& options, const std::function<void(const AsyncLoadImpl&)>& on_done) {
+    AsyncLoad load(path.string(), path);
+    load->on_done = on_done;
+    num_decoding++;
+    tasks.push_back(ThreadPool::global().enqueue([load, path, options]() mutable {
+        ParsedScene parsed = { std::move(load), ImportedScene(), "" };
+        try {
+            parsed.imported = import_scene(path, options);
+        } catch (const std::exception& e) {
+            parsed.error = e.what();
+        }
+        const std::lock_guard<std::mutex> lock(mutex);
+        parsed_scenes.push_back(std::move(parsed));
+    }));
+    return load;
+}
+
+Texture2D AsyncLoader::load_texture(const std::string& name, const fs::path& path, bool mipmap, const std::function<void(const Texture2DImpl&)>& on_done) {
+    Texture2D texture(name, path, ImageData(), mipmap);
+    decode(AsyncLoad(), texture, mipmap, on_done);
+    return texture;
+}
+
+void AsyncLoader::load_into(const Texture2D& placeholder, bool mipmap, const std::function<void(const Texture2DImpl&)>& on_done) {
+    decode(AsyncLoad(), placeholder, mipmap, on_done);
+}
+
+void AsyncLoader::update() {
+    const auto start = std::chrono::steady_clock::now();
+    tasks.erase(std::remove_if(tasks.begin(), tasks.end(), [](const std::future<void>& task) {
+        return task.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), tasks.end());
+    // take over work finished by the workers
+    std::deque<ParsedScene> scenes;
+    std::deque<DecodedImage> images;
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        std::swap(scenes, parsed_scenes);
+        std::swap(images, decoded_images);
+    }
+    num_decoding -= uint32_t(scenes.size() + images.size());
+    for (auto& scene : scenes)
+        finish_parse(scene);
+    for (auto& decoded : images) {
+        const auto& [data, w, h, channels, is_hdr] = decoded.image;
+        if (!decoded.error.empty() || data.empty() || w <= 0 || h <= 0) {
+            std::cerr << "WARN: AsyncLoader: " << (decoded.error.empty() ? "empty image: " + decoded.texture->loaded_from_path.string() : decoded.error) << std::endl;
+            item_done(decoded.load);
+            continue;
+        }
+        Upload upload;
+        upload.load = decoded.load;
+        upload.bytes = data.size();
+        upload.decoded = std::move(decoded);
+        uploads.push_back(std::move(upload));
+    }
+    if (uploads.empty()) return;
+    // (re-)create the staging PBO to match the budget
+    if (has_buffer_storage() && (!pbo || pbo->frame_size_bytes != budget_bytes))
+        pbo = StreamPUBO("AsyncLoader_pbo", budget_bytes);
+    // upload within budget
+    size_t bytes = 0;
+    while (!uploads.empty()) {
+        const double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (bytes > 0 && (bytes >= budget_bytes || elapsed_ms >= budget_ms)) break;
+        Upload& upload = uploads.front();
+        const size_t uploaded = upload.mesh ? upload_mesh(upload) : upload_texture(upload, budget_bytes > bytes ? budget_bytes - bytes : 0, bytes == 0);
+        bytes += uploaded;
+        if (!upload.finished()) {
+            if (uploaded == 0) break;
+            continue;
+        }
+        if (!upload.mesh) {
+            finish_texture(upload);
+            if (upload.decoded.on_done) upload.decoded.on_done(*upload.decoded.texture);
+        }
+        const AsyncLoad load = upload.load;
+        uploads.pop_front();
+        item_done(load);
+    }
+    if (pbo) pbo->next_frame();
+}
+
+void AsyncLoader::clear() {
+    // let running tasks finish, so none publishes into the queues (or holds GL handles) after this
+    for (auto& task : tasks)
+        task.wait();
+    tasks.clear();
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        parsed_scenes.clear();
+        decoded_images.clear();
+    }
+    uploads.clear();
+    num_decoding = 0;
+    if (pbo) StreamPUBO::erase(pbo->name);
+    pbo = StreamPUBO();
+}
+
+uint32_t AsyncLoader::pending() {
+    return num_decoding + uint32_t(uploads.size());
+}
+
+size_t AsyncLoader::pending_bytes() {
+    size_t bytes = 0;
+    for (const auto& upload : uploads)
+        bytes += upload.bytes - (upload.mesh ? 0 : upload.next_row * (upload.bytes / std::get<2>(upload.decoded.image)));
+    return bytes;
+}
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <filesystem>
+namespace fs = std::filesystem;
+#include "named_handle.h"
+#include "texture.h"
+#include "mesh.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// AsyncLoad (state of one AsyncLoader::load_meshes request, only touched on the GL thread)
+
+class AsyncLoadImpl {
+public:
+    AsyncLoadImpl(const std::string& name, const fs::path& path);
+    virtual ~AsyncLoadImpl();
+
+    // prevent copies and moves, handles are shared with the loader
+    AsyncLoadImpl(const AsyncLoadImpl&) = delete;
+    AsyncLoadImpl& operator=(const AsyncLoadImpl&) = delete;
+    AsyncLoadImpl& operator=(const AsyncLoadImpl&&) = delete;
+
+    // fraction of meshes and textures uploaded (0 until the file is parsed)
+    inline float progress() const { return done() ? 1.f : num_items == 0 ? 0.f : float(num_done) / float(num_items); }
+    inline bool done() const { return parsed && num_done == num_items; }
+    inline bool failed() const { return !error.empty(); }
+
+    // data
+    const std::string name;
+    const fs::path path;
+    std::vector<Mesh> meshes;           // added once the file is parsed, geometry is set when uploaded
+    std::vector<Texture2D> textures;    // placeholders (operator bool is false) until uploaded
+    std::function<void(const AsyncLoadImpl&)> on_done; // called from Context::swap_buffers after the last upload (or on failure)
+    std::string error;                  // set if parsing failed
+    bool parsed;
+    uint32_t num_items, num_done;
+};
+
+using AsyncLoad = NamedHandle<AsyncLoadImpl>;
+template class _API NamedHandle<AsyncLoadImpl>; //needed for Windows DLL export
+
+// ------------------------------------------
+// AsyncLoader (decode on the worker pool, upload in Context::swap_buffers within a per-frame budget)
+
+class AsyncLoader {
+public:
+    // start loading a mesh file in the background (bypasses the MeshCache), see load_meshes_gpu
+    static AsyncLoad load_meshes(const fs::path& path, const MeshLoadOptions& options = MeshLoadOptions(),
+            const std::function<void(const AsyncLoadImpl&)>& on_done = {});
+    // start loading an image in the background, returns a placeholder that becomes valid once uploaded
+    static Texture2D load_texture(const std::string& name, const fs::path& path, bool mipmap = true,
+            const std::function<void(const Texture2DImpl&)>& on_done = {});
+    // start loading placeholder->loaded_from_path in the background into the given placeholder (e.g. a lazy material texture)
+    static void load_into(const Texture2D& placeholder, bool mipmap = true, const std::function<void(const Texture2DImpl&)>& on_done = {});
+
+    // take over decoded data and upload within the budget (called by Context::swap_buffers)
+    static void update();
+    // drop all queued work and GL resources (called on context destruction)
+    static void clear();
+
+    // number of files and images still parsed/decoded or waiting for upload
+    static uint32_t pending();
+    // bytes waiting for upload (decoded only)
+    static size_t pending_bytes();
+
+    // per-frame upload budget, textures are streamed row-wise via a persistently mapped PBO (a mesh is uploaded at once)
+    // the first upload of a frame always proceeds, so progress is guaranteed
+    static size_t budget_bytes;
+    static double budget_ms;
+};
+
+CPPGL_NAMESPACE_END
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
 #include <GL/glew.h>
 #include <GL/gl.h>
 #include "named_handle.h"
+#include "capabilities.h"
+#include "state.h"
 
 CPPGL_NAMESPACE_BEGIN
 
@@ -12,10 +18,14 @@ CPPGL_NAMESPACE_BEGIN
 template <GLenum GL_TEMPLATE_BUFFER> class GLBufferImpl {
 public:
     GLBufferImpl(const std::string& name, size_t size_bytes = 0) : name(name) {
-        glGenBuffers(1, &id);
+        if (has_direct_state_access())
+            glCreateBuffers(1, &id);
+        else
+            glGenBuffers(1, &id);
         resize(size_bytes);
     }
     virtual ~GLBufferImpl() {
+        GLState::forget_buffer(id);
         glDeleteBuffers(1, &id);
     }
 
@@ -29,52 +39,74 @@ public:
 
     // bind/unbind to/from OpenGL
     void bind() const {
-        glBindBuffer(GL_TEMPLATE_BUFFER, id);
+        GLState::bind_buffer(GL_TEMPLATE_BUFFER, id);
     }
     void unbind() const {
-        glBindBuffer(GL_TEMPLATE_BUFFER, 0);
+        // bound pixel buffers change the meaning of pointers in texture up-/downloads, so always unbind those
+        if (GL_TEMPLATE_BUFFER == GL_PIXEL_UNPACK_BUFFER || GL_TEMPLATE_BUFFER == GL_PIXEL_PACK_BUFFER)
+            GLState::bind_buffer(GL_TEMPLATE_BUFFER, 0);
+        else
+            GLState::unbind_buffer(GL_TEMPLATE_BUFFER);
     }
     void bind_base(uint32_t unit) const {
-        glBindBufferBase(GL_TEMPLATE_BUFFER, unit, id);
+        GLState::bind_buffer_base(GL_TEMPLATE_BUFFER, unit, id);
     }
     void unbind_base(uint32_t unit) const {
-        glBindBufferBase(GL_TEMPLATE_BUFFER, unit, 0);
+        GLState::unbind_buffer_base(GL_TEMPLATE_BUFFER, unit);
     }
 
     // directly upload data (discards and reallocates memory, slow!)
-    void upload_data(const void* data, size_t size_bytes, GLenum hint = GL_DYNAMIC_DRAW) {
-        bind();
+    virtual void upload_data(const void* data, size_t size_bytes, GLenum hint = GL_DYNAMIC_DRAW) {
         this->size_bytes = size_bytes;
-        glBufferData(GL_TEMPLATE_BUFFER, size_bytes, data, hint);
-        unbind();
+        if (has_direct_state_access())
+            glNamedBufferData(id, size_bytes, data, hint);
+        else {
+            bind_for_edit();
+            glBufferData(GL_TEMPLATE_BUFFER, size_bytes, data, hint);
+            unbind();
+        }
     }
     // directly upload data (overwrites memory with no bounds checking, slow-ish)
     void upload_subdata(const void* data, size_t offset_bytes, size_t size_bytes) {
-        bind();
-        glBufferSubData(GL_TEMPLATE_BUFFER, offset_bytes, size_bytes, data);
-        unbind();
+        if (has_direct_state_access())
+            glNamedBufferSubData(id, offset_bytes, size_bytes, data);
+        else {
+            bind_for_edit();
+            glBufferSubData(GL_TEMPLATE_BUFFER, offset_bytes, size_bytes, data);
+            unbind();
+        }
     }
     // resize (discards all data!)
-    void resize(size_t size_bytes, GLenum hint = GL_DYNAMIC_DRAW) {
+    virtual void resize(size_t size_bytes, GLenum hint = GL_DYNAMIC_DRAW) {
         upload_data(0, size_bytes, hint);
     }
     // clear to 0x0
     void clear() {
-        bind();
         const GLuint zero = 0;
-        glClearBufferData(GL_TEMPLATE_BUFFER, GL_R32UI, GL_RED, GL_UNSIGNED_INT, &zero);
-        unbind();
+        if (has_direct_state_access())
+            glClearNamedBufferData(id, GL_R32UI, GL_RED, GL_UNSIGNED_INT, &zero);
+        else {
+            bind_for_edit();
+            glClearBufferData(GL_TEMPLATE_BUFFER, GL_R32UI, GL_RED, GL_UNSIGNED_INT, &zero);
+            unbind();
+        }
     }
 
     // map/unmap from GPU mem for faster memory transfer
     // https://www.seas.upenn.edu/~pcozzi/OpenGLInsights/OpenGLInsights-AsynchronousBufferTransfers.pdf
-    void* map(GLenum access = GL_READ_WRITE) const {
-        bind();
+    virtual void* map(GLenum access = GL_READ_WRITE) const {
+        if (has_direct_state_access())
+            return glMapNamedBuffer(id, access);
+        bind_for_edit();
         return glMapBuffer(GL_TEMPLATE_BUFFER, access);
     }
-    void unmap() const {
-        glUnmapBuffer(GL_TEMPLATE_BUFFER);
-        unbind();
+    virtual void unmap() const {
+        if (has_direct_state_access())
+            glUnmapNamedBuffer(id);
+        else {
+            glUnmapBuffer(GL_TEMPLATE_BUFFER);
+            unbind();
+        }
     }
 
 
@@ -82,6 +114,15 @@ public:
     const std::string name;
     GLuint id;
     size_t size_bytes;
+
+protected:
+    // bind for (non-DSA) bind-to-edit operations
+    void bind_for_edit() const {
+        // the element array binding is part of the VAO state, so make sure no VAO is modified by accident
+        if (GL_TEMPLATE_BUFFER == GL_ELEMENT_ARRAY_BUFFER)
+            GLState::bind_vertex_array(0);
+        bind();
+    }
 };
 
 // ----------------------------------------------------
@@ -134,4 +175,148 @@ template class _API NamedHandle<GLBufferImpl<GL_PIXEL_PACK_BUFFER>>;
 template class _API NamedHandle<GLBufferImpl<GL_COPY_READ_BUFFER>>;
 template class _API NamedHandle<GLBufferImpl<GL_COPY_WRITE_BUFFER>>;
 
+// ----------------------------------------------------
+// Persistently mapped streaming (ring) buffer
+
+// Immutable storage, split into N regions (one per frame in flight), each guarded by a fence.
+// Usage per frame: allocate() sub-ranges, write to the returned pointer, bind via the returned offset, then call next_frame().
+// https://www.seas.upenn.edu/~pcozzi/OpenGLInsights/OpenGLInsights-AsynchronousBufferTransfers.pdf
+template <GLenum GL_TEMPLATE_BUFFER> class GLStreamBufferImpl : public GLBufferImpl<GL_TEMPLATE_BUFFER> {
+public:
+    struct Allocation {
+        void* ptr;              // persistently mapped, write-only
+        size_t offset_bytes;    // offset into the whole buffer (for bind_range, glVertexAttribPointer, glDrawElements, ...)
+        size_t size_bytes;
+    };
+
+    GLStreamBufferImpl(const std::string& name, size_t frame_size_bytes, uint32_t frames_in_flight = 3)
+        : GLBufferImpl<GL_TEMPLATE_BUFFER>(name), frame_size_bytes(frame_size_bytes), frames_in_flight(frames_in_flight),
+        curr_frame(0), head(0), fences(frames_in_flight, nullptr) {
+        if (frames_in_flight == 0)
+            throw std::runtime_error("GLStreamBuffer: frames_in_flight must be at least 1: " + name);
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        this->size_bytes = frame_size_bytes * frames_in_flight;
+        if (has_direct_state_access()) {
+            glNamedBufferStorage(this->id, this->size_bytes, 0, flags);
+            mapped = (uint8_t*)glMapNamedBufferRange(this->id, 0, this->size_bytes, flags);
+        } else {
+            this->bind_for_edit();
+            glBufferStorage(GL_TEMPLATE_BUFFER, this->size_bytes, 0, flags);
+            mapped = (uint8_t*)glMapBufferRange(GL_TEMPLATE_BUFFER, 0, this->size_bytes, flags);
+            this->unbind();
+        }
+        if (!mapped)
+            throw std::runtime_error("GLStreamBuffer: failed to persistently map buffer: " + name);
+        // alignment required for binding sub-ranges
+        GLint align = 4;
+        if (GL_TEMPLATE_BUFFER == GL_UNIFORM_BUFFER)
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+        else if (GL_TEMPLATE_BUFFER == GL_SHADER_STORAGE_BUFFER)
+            glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &align);
+        alignment = std::max<size_t>(size_t(align), 4);
+    }
+    virtual ~GLStreamBufferImpl() {
+        for (auto& fence : fences)
+            if (fence) glDeleteSync(fence);
+        if (has_direct_state_access())
+            glUnmapNamedBuffer(this->id);
+        else {
+            this->bind_for_edit();
+            glUnmapBuffer(GL_TEMPLATE_BUFFER);
+            this->unbind();
+        }
+    }
+
+    // sub-allocate from the current frame's region (throws if the region is exhausted)
+    Allocation allocate(size_t size_bytes) {
+        const size_t offset = (head + alignment - 1) / alignment * alignment;
+        if (offset + size_bytes > frame_size_bytes)
+            throw std::runtime_error("GLStreamBuffer: frame region exhausted: " + this->name);
+        head = offset + size_bytes;
+        const size_t global_offset = curr_frame * frame_size_bytes + offset;
+        return Allocation{ mapped + global_offset, global_offset, size_bytes };
+    }
+    // copy data into a fresh sub-allocation
+    Allocation push(const void* data, size_t size_bytes) {
+        Allocation alloc = allocate(size_bytes);
+        std::memcpy(alloc.ptr, data, size_bytes);
+        return alloc;
+    }
+
+    // bind sub-allocation to indexed binding point (UBO, SSBO, ACBO, TFBO)
+    void bind_range(uint32_t unit, const Allocation& alloc) const {
+        GLState::bind_buffer_range(GL_TEMPLATE_BUFFER, unit, this->id, alloc.offset_bytes, alloc.size_bytes);
+    }
+
+    // fence the current region after all commands reading from it have been issued and advance to the next one
+    // (only blocks if the GPU is still consuming the region from frames_in_flight frames ago)
+    void next_frame() {
+        if (fences[curr_frame]) glDeleteSync(fences[curr_frame]);
+        fences[curr_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        curr_frame = (curr_frame + 1) % frames_in_flight;
+        head = 0;
+        wait(curr_frame);
+    }
+
+    // bytes left in the current frame's region
+    inline size_t available() const { return frame_size_bytes - head; }
+
+    // storage is immutable and persistently mapped, reallocating or (un)mapping would break it (also via GLBufferImpl&)
+    void upload_data(const void*, size_t, GLenum = GL_DYNAMIC_DRAW) override {
+        throw std::runtime_error("GLStreamBuffer: can not reallocate immutable storage: " + this->name);
+    }
+    void resize(size_t, GLenum = GL_DYNAMIC_DRAW) override {
+        throw std::runtime_error("GLStreamBuffer: can not reallocate immutable storage: " + this->name);
+    }
+    void* map(GLenum = GL_READ_WRITE) const override {
+        throw std::runtime_error("GLStreamBuffer: already persistently mapped, use allocate(): " + this->name);
+    }
+    void unmap() const override {
+        throw std::runtime_error("GLStreamBuffer: can not unmap a persistently mapped buffer: " + this->name);
+    }
+
+    // data
+    const size_t frame_size_bytes;
+    const uint32_t frames_in_flight;
+    size_t alignment;
+    uint32_t curr_frame;
+    size_t head;
+    uint8_t* mapped;
+    std::vector<GLsync> fences;
+
+private:
+    void wait(uint32_t frame) {
+        if (!fences[frame]) return;
+        GLenum result = glClientWaitSync(fences[frame], 0, 0);
+        while (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED && result != GL_WAIT_FAILED)
+            result = glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1ms
+        glDeleteSync(fences[frame]);
+        fences[frame] = nullptr;
+    }
+
+};
+
+using StreamVBO = NamedHandle<GLStreamBufferImpl<GL_ARRAY_BUFFER>>;
+using StreamIBO = NamedHandle<GLStreamBufferImpl<GL_ELEMENT_ARRAY_BUFFER>>;
+using StreamUBO = NamedHandle<GLStreamBufferImpl<GL_UNIFORM_BUFFER>>;
+using StreamSSBO = NamedHandle<GLStreamBufferImpl<GL_SHADER_STORAGE_BUFFER>>;
+using StreamDIBO = NamedHandle<GLStreamBufferImpl<GL_DRAW_INDIRECT_BUFFER>>;
+using StreamPUBO = NamedHandle<GLStreamBufferImpl<GL_PIXEL_UNPACK_BUFFER>>;
+
+// explicit instanciation needed for Windows DLL export
+template class GLStreamBufferImpl<GL_ARRAY_BUFFER>;
+template class GLStreamBufferImpl<GL_ELEMENT_ARRAY_BUFFER>;
+template class GLStreamBufferImpl<GL_UNIFORM_BUFFER>;
+template class GLStreamBufferImpl<GL_SHADER_STORAGE_BUFFER>;
+template class GLStreamBufferImpl<GL_DRAW_INDIRECT_BUFFER>;
+template class GLStreamBufferImpl<GL_PIXEL_UNPACK_BUFFER>;
+
+//needed for Windows DLL export
+template class _API NamedHandle<GLStreamBufferImpl<GL_ARRAY_BUFFER>>;
+template class _API NamedHandle<GLStreamBufferImpl<GL_ELEMENT_ARRAY_BUFFER>>;
+template class _API NamedHandle<GLStreamBufferImpl<GL_UNIFORM_BUFFER>>;
+template class _API NamedHandle<GLStreamBufferImpl<GL_SHADER_STORAGE_BUFFER>>;
+template class _API NamedHandle<GLStreamBufferImpl<GL_DRAW_INDIRECT_BUFFER>>;
+template class _API NamedHandle<GLStreamBufferImpl<GL_PIXEL_UNPACK_BUFFER>>;
+
 CPPGL_NAMESPACE_END
@@ -12,16 +12,32 @@
 CPPGL_NAMESPACE_BEGIN
 
 static Camera current_cam;
+static const CameraImpl* default_cam_ptr = nullptr;
 
 Camera current_camera() {
     static Camera default_cam("default");
+    default_cam_ptr = default_cam.ptr.get();
     return current_cam ? current_cam : default_cam;
 }
 
 void make_camera_current(const Camera& cam) {
     current_cam = cam;
+    current_camera()->bind_ubo();
 }
 
+static bool is_current_camera(const CameraImpl* cam) {
+    return current_cam ? current_cam.ptr.get() == cam : default_cam_ptr == cam;
+}
+
+// std140 layout of the Camera uniform block in <cppgl/camera.glsl>
+struct CameraBlock {
+    glm::mat4 view;
+    glm::mat4 view_normal;
+    glm::mat4 proj;
+    glm::vec4 pos;
+    glm::vec4 dir;
+};
+
 static glm::mat4 get_projection_matrix(float left, float right, float top, float bottom, float n, float f) {
     glm::mat4 proj = glm::mat4(0);
     proj[0][0] = (2.f*n) / (right - left);
@@ -56,6 +72,19 @@ void CameraImpl::update() {
     proj = perspective ? (skewed ? get_projection_matrix(left, right, top, bottom, near, far)
                                  : glm::perspective(glm::radians(fov_degree), aspect_ratio(), near, far))
                         : glm::ortho(left, right, bottom, top, near, far);
+    // upload once per update instead of per draw
+    const CameraBlock block = { view, view_normal, proj, glm::vec4(pos, 1), glm::vec4(dir, 0) };
+    if (!ubo && glfwGetCurrentContext())
+        ubo = UBO(name + "_ubo", sizeof(CameraBlock));
+    if (ubo) {
+        ubo->upload_subdata(&block, 0, sizeof(CameraBlock));
+        if (is_current_camera(this))
+            bind_ubo();
+    }
+}
+
+void CameraImpl::bind_ubo() const {
+    if (ubo) ubo->bind_base(ubo_binding);
 }
 
 void CameraImpl::forward(float by) { pos += by * dir; }
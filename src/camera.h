@@ -4,6 +4,7 @@
 #include <memory>
 #include <glm/glm.hpp>
 #include "named_handle.h"
+#include "buffer.h"
 
 #undef far
 #undef near
@@ -45,6 +46,11 @@ public:
     static float default_camera_movement_speed;
     static bool default_input_handler(double dt_ms);
 
+    // uniform buffer binding point of the per-frame camera block (see <cppgl/camera.glsl>)
+    static constexpr uint32_t ubo_binding = 0;
+    // bind this camera's uniform buffer to ubo_binding
+    void bind_ubo() const;
+
     // data
     const std::string name;
     glm::vec3 pos, dir, up;             // camera coordinate system
@@ -54,6 +60,7 @@ public:
     bool skewed;                        // switcg between normal perspective and skewed frustum (default: normal)
     bool fix_up_vector;                 // keep up vector fixed to avoid camera drift
     glm::mat4 view, view_normal, proj;  // camera matrices (computed via a call update())
+    UBO ubo;                            // std140 copy of the camera matrices (uploaded via a call to update())
 };
 
 using Camera = NamedHandle<CameraImpl>;
@@ -0,0 +1,31 @@
+#include "capabilities.h"
+#include <GL/glew.h>
+#include <iostream>
+
+CPPGL_NAMESPACE_BEGIN
+
+static bool dsa_available = false;
+static bool mdi_available = false;
+static bool mdi_count_available = false;
+static bool buffer_storage_available = false;
+
+void query_gl_capabilities(bool allow_dsa) {
+    dsa_available = allow_dsa && (GLEW_VERSION_4_5 || GLEW_ARB_direct_state_access);
+    std::cout << "Direct state access: " << (dsa_available ? "enabled" : "disabled") << std::endl;
+    mdi_available = GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect;
+    std::cout << "Multi draw indirect: " << (mdi_available ? "available" : "unavailable") << std::endl;
+    mdi_count_available = GLEW_VERSION_4_6 || GLEW_ARB_indirect_parameters;
+    std::cout << "Indirect draw count: " << (mdi_count_available ? "available" : "unavailable") << std::endl;
+    buffer_storage_available = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+    std::cout << "Buffer storage: " << (buffer_storage_available ? "available" : "unavailable") << std::endl;
+}
+
+bool has_direct_state_access() { return dsa_available; }
+
+bool has_multi_draw_indirect() { return mdi_available; }
+
+bool has_indirect_draw_count() { return mdi_count_available; }
+
+bool has_buffer_storage() { return buffer_storage_available; }
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "platform.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// query available GL features once after context creation (allow_dsa = false forces the bind-to-edit fallback paths)
+void query_gl_capabilities(bool allow_dsa = true);
+
+// direct state access (GL 4.5 or ARB_direct_state_access) is available and enabled
+bool has_direct_state_access();
+
+// glMultiDrawElementsIndirect (GL 4.3 or ARB_multi_draw_indirect) is available
+bool has_multi_draw_indirect();
+
+// glMultiDrawElementsIndirectCount (GL 4.6 or ARB_indirect_parameters) is available
+bool has_indirect_draw_count();
+
+// glBufferStorage (GL 4.4 or ARB_buffer_storage) is available, required for persistently mapped (stream) buffers
+bool has_buffer_storage();
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,312 @@
+#include "compressed_image.h"
+#include "mapped_file.h"
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// format table
+
+struct BlockFormat {
+    GLenum internal_format;
+    GLenum base_format;
+    uint32_t block_bytes;
+    uint32_t dxgi_format;   // DXGI_FORMAT_* (DDS DX10 header)
+    uint32_t vk_format;     // VK_FORMAT_* (KTX2)
+    char fourcc[4];         // legacy DDS header (may be empty)
+};
+
+// sRGB S3TC is part of EXT_texture_sRGB, not core
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT 0x8C4E
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// lookups take the first match, so DXGI BC1 maps to the RGBA variant
+static const BlockFormat block_formats[] = {
+    { GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,         GL_RGBA, 8,  71, 133, { 'D', 'X', 'T', '1' } },
+    { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT,   GL_RGBA, 8,  72, 134, {} },
+    { GL_COMPRESSED_RGB_S3TC_DXT1_EXT,          GL_RGB,  8,  71, 131, {} },
+    { GL_COMPRESSED_SRGB_S3TC_DXT1_EXT,         GL_RGB,  8,  72, 132, {} },
+    { GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,         GL_RGBA, 16, 74, 135, { 'D', 'X', 'T', '3' } },
+    { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT,   GL_RGBA, 16, 75, 136, {} },
+    { GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,         GL_RGBA, 16, 77, 137, { 'D', 'X', 'T', '5' } },
+    { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT,   GL_RGBA, 16, 78, 138, {} },
+    { GL_COMPRESSED_RED_RGTC1,                  GL_RED,  8,  80, 139, { 'A', 'T', 'I', '1' } },
+    { GL_COMPRESSED_RED_RGTC1,                  GL_RED,  8,  80, 139, { 'B', 'C', '4', 'U' } },
+    { GL_COMPRESSED_SIGNED_RED_RGTC1,           GL_RED,  8,  81, 140, { 'B', 'C', '4', 'S' } },
+    { GL_COMPRESSED_RG_RGTC2,                   GL_RG,   16, 83, 141, { 'A', 'T', 'I', '2' } },
+    { GL_COMPRESSED_RG_RGTC2,                   GL_RG,   16, 83, 141, { 'B', 'C', '5', 'U' } },
+    { GL_COMPRESSED_SIGNED_RG_RGTC2,            GL_RG,   16, 84, 142, { 'B', 'C', '5', 'S' } },
+    { GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT,    GL_RGB,  16, 95, 143, {} },
+    { GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT,      GL_RGB,  16, 96, 144, {} },
+    { GL_COMPRESSED_RGBA_BPTC_UNORM,            GL_RGBA, 16, 98, 145, {} },
+    { GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM,      GL_RGBA, 16, 99, 146, {} },
+};
+
+template <typename Pred> static const BlockFormat* find_format(Pred pred) {
+    for (const auto& format : block_formats)
+        if (pred(format)) return &format;
+    return nullptr;
+}
+
+static size_t level_size(const BlockFormat& format, uint32_t w, uint32_t h) {
+    return size_t((w + 3) / 4) * ((h + 3) / 4) * format.block_bytes;
+}
+
+// ------------------------------------------
+// DDS (https://learn.microsoft.com/en-us/windows/win32/direct3ddds/dx-graphics-dds-pguide)
+
+static const uint32_t DDS_MAGIC = 0x20534444; // "DDS "
+static const uint32_t DDSD_CAPS = 0x1, DDSD_HEIGHT = 0x2, DDSD_WIDTH = 0x4, DDSD_PIXELFORMAT = 0x1000, DDSD_MIPMAPCOUNT = 0x20000, DDSD_LINEARSIZE = 0x80000;
+static const uint32_t DDPF_FOURCC = 0x4;
+static const uint32_t DDSCAPS_COMPLEX = 0x8, DDSCAPS_TEXTURE = 0x1000, DDSCAPS_MIPMAP = 0x400000;
+static const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+struct DDSPixelFormat {
+    uint32_t size, flags, fourcc, rgb_bit_count, r_mask, g_mask, b_mask, a_mask;
+};
+struct DDSHeader {
+    uint32_t size, flags, height, width, pitch_or_linear_size, depth, mip_map_count, reserved1[11];
+    DDSPixelFormat pixel_format;
+    uint32_t caps, caps2, caps3, caps4, reserved2;
+};
+struct DDSHeaderDX10 {
+    uint32_t dxgi_format, resource_dimension, misc_flag, array_size, misc_flags2;
+};
+// files written by store_compressed_image mark bottom-up row order in reserved1 (DDS itself is top-down)
+static const uint32_t DDS_CPPGL_MARKER = 0x4C475043; // "CPGL"
+static const uint32_t DDS_MARKER_INDEX = 7, DDS_BOTTOM_UP_INDEX = 8;
+
+// ------------------------------------------
+// KTX2 (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html)
+
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+struct KTX2Header {
+    uint8_t identifier[12];
+    uint32_t vk_format, type_size, pixel_width, pixel_height, pixel_depth, layer_count, face_count, level_count, supercompression_scheme;
+    uint32_t dfd_byte_offset, dfd_byte_length, kvd_byte_offset, kvd_byte_length;
+    uint64_t sgd_byte_offset, sgd_byte_length;
+};
+struct KTX2Level {
+    uint64_t byte_offset, byte_length, uncompressed_byte_length;
+};
+
+// ------------------------------------------
+// helper funcs
+
+template <typename T> static T read_at(const MappedFile& file, size_t offset, const fs::path& path) {
+    if (offset + sizeof(T) > file.size())
+        throw std::runtime_error("load_compressed_image: unexpected end of file: " + path.string());
+    T value;
+    std::memcpy(&value, file.data() + offset, sizeof(T));
+    return value;
+}
+
+// rows of a 4x4 block (or of a block row shorter than 4) in reverse order, dst row y = src row map[y]
+static void flip_rows_2bit(uint8_t* block, const uint32_t* map) { // BC1 indices: one byte per row
+    const uint8_t rows[4] = { block[0], block[1], block[2], block[3] };
+    for (uint32_t y = 0; y < 4; ++y) block[y] = rows[map[y]];
+}
+static void flip_rows_4bit(uint8_t* block, const uint32_t* map) { // BC2 alpha: two bytes per row
+    uint8_t rows[8];
+    std::memcpy(rows, block, 8);
+    for (uint32_t y = 0; y < 4; ++y) {
+        block[2 * y + 0] = rows[2 * map[y] + 0];
+        block[2 * y + 1] = rows[2 * map[y] + 1];
+    }
+}
+static void flip_rows_3bit(uint8_t* block, const uint32_t* map) { // BC4: 48 bit little endian, 12 bits per row
+    uint64_t bits = 0, flipped = 0;
+    for (uint32_t i = 0; i < 6; ++i) bits |= uint64_t(block[i]) << (8 * i);
+    for (uint32_t y = 0; y < 4; ++y) flipped |= ((bits >> (12 * map[y])) & 0xFFF) << (12 * y);
+    for (uint32_t i = 0; i < 6; ++i) block[i] = uint8_t(flipped >> (8 * i));
+}
+
+static std::vector<uint8_t> copy_range(const MappedFile& file, size_t offset, size_t size, const fs::path& path) {
+    if (offset + size > file.size())
+        throw std::runtime_error("load_compressed_image: unexpected end of file: " + path.string());
+    return std::vector<uint8_t>(file.data() + offset, file.data() + offset + size);
+}
+
+static CompressedImage load_dds(const MappedFile& file, const fs::path& path) {
+    if (read_at<uint32_t>(file, 0, path) != DDS_MAGIC)
+        throw std::runtime_error("load_compressed_image: not a DDS file: " + path.string());
+    const DDSHeader header = read_at<DDSHeader>(file, 4, path);
+    if (header.size != sizeof(DDSHeader) || !(header.pixel_format.flags & DDPF_FOURCC))
+        throw std::runtime_error("load_compressed_image: unsupported DDS header (uncompressed?): " + path.string());
+    size_t offset = 4 + sizeof(DDSHeader);
+    const BlockFormat* format = nullptr;
+    if (std::memcmp(&header.pixel_format.fourcc, "DX10", 4) == 0) {
+        const DDSHeaderDX10 dx10 = read_at<DDSHeaderDX10>(file, offset, path);
+        offset += sizeof(DDSHeaderDX10);
+        if (dx10.resource_dimension != DDS_DIMENSION_TEXTURE2D)
+            throw std::runtime_error("load_compressed_image: DDS is not a 2D texture: " + path.string());
+        format = find_format([&](const BlockFormat& f) { return f.dxgi_format == dx10.dxgi_format; });
+    } else
+        format = find_format([&](const BlockFormat& f) { return std::memcmp(f.fourcc, &header.pixel_format.fourcc, 4) == 0; });
+    if (!format)
+        throw std::runtime_error("load_compressed_image: unsupported DDS format (BC1-BC7 only): " + path.string());
+    CompressedImage image;
+    image.internal_format = format->internal_format;
+    image.w = header.width;
+    image.h = header.height;
+    const uint32_t num_levels = (header.flags & DDSD_MIPMAPCOUNT) ? std::max(header.mip_map_count, 1u) : 1;
+    for (uint32_t level = 0; level < num_levels; ++level) {
+        const size_t size = level_size(*format, image.level_width(level), image.level_height(level));
+        image.levels.push_back(copy_range(file, offset, size, path));
+        offset += size;
+    }
+    image.bottom_up = header.reserved1[DDS_MARKER_INDEX] == DDS_CPPGL_MARKER && header.reserved1[DDS_BOTTOM_UP_INDEX];
+    if (!image.bottom_up) flip_compressed_image(image);
+    return image;
+}
+
+static CompressedImage load_ktx2(const MappedFile& file, const fs::path& path) {
+    const KTX2Header header = read_at<KTX2Header>(file, 0, path);
+    if (std::memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+        throw std::runtime_error("load_compressed_image: not a KTX2 file: " + path.string());
+    if (header.supercompression_scheme != 0)
+        throw std::runtime_error("load_compressed_image: supercompressed KTX2 (BasisLZ/zstd) is not supported: " + path.string());
+    if (header.pixel_depth > 1)
+        throw std::runtime_error("load_compressed_image: KTX2 is not a 2D texture: " + path.string());
+    const BlockFormat* format = find_format([&](const BlockFormat& f) { return f.vk_format == header.vk_format; });
+    if (!format)
+        throw std::runtime_error("load_compressed_image: unsupported KTX2 format (BC1-BC7 only): " + path.string());
+    CompressedImage image;
+    image.internal_format = format->internal_format;
+    image.w = header.pixel_width;
+    image.h = std::max(header.pixel_height, 1u);
+    const uint32_t num_levels = std::max(header.level_count, 1u);
+    for (uint32_t level = 0; level < num_levels; ++level) {
+        // level data holds all layers and faces, the first image comes first
+        const KTX2Level entry = read_at<KTX2Level>(file, sizeof(KTX2Header) + level * sizeof(KTX2Level), path);
+        const size_t size = level_size(*format, image.level_width(level), image.level_height(level));
+        if (entry.byte_length < size)
+            throw std::runtime_error("load_compressed_image: KTX2 level too small: " + path.string());
+        image.levels.push_back(copy_range(file, size_t(entry.byte_offset), size, path));
+    }
+    // KTXorientation "rd" (default) is top-down, "ru" bottom-up
+    image.bottom_up = false;
+    for (size_t offset = header.kvd_byte_offset, end = offset + header.kvd_byte_length; offset + 4 <= end;) {
+        const uint32_t length = read_at<uint32_t>(file, offset, path);
+        const std::vector<uint8_t> entry = copy_range(file, offset + 4, length, path);
+        const std::string key = "KTXorientation";
+        if (entry.size() > key.size() + 2 && std::memcmp(entry.data(), key.c_str(), key.size() + 1) == 0)
+            image.bottom_up = entry[key.size() + 2] == 'u';
+        offset += 4 + ((length + 3) & ~3u);
+    }
+    if (!image.bottom_up) flip_compressed_image(image);
+    return image;
+}
+
+static std::string lower_extension(const fs::path& path) {
+    std::string ext = path.extension().string();
+    for (auto& c : ext) c = char(std::tolower(c));
+    return ext;
+}
+
+// ------------------------------------------
+// CompressedImage
+
+uint32_t compressed_block_bytes(GLenum internal_format) {
+    const BlockFormat* format = find_format([&](const BlockFormat& f) { return f.internal_format == internal_format; });
+    return format ? format->block_bytes : 0;
+}
+
+GLenum compressed_base_format(GLenum internal_format) {
+    const BlockFormat* format = find_format([&](const BlockFormat& f) { return f.internal_format == internal_format; });
+    return format ? format->base_format : GL_RGBA;
+}
+
+bool is_compressed_image_file(const fs::path& path) {
+    const std::string ext = lower_extension(path);
+    return ext == ".dds" || ext == ".ktx2";
+}
+
+CompressedImage load_compressed_image(const fs::path& path) {
+    const MappedFile file(path);
+    return lower_extension(path) == ".ktx2" ? load_ktx2(file, path) : load_dds(file, path);
+}
+
+bool flip_compressed_image(CompressedImage& image) {
+    enum { BC1, BC2, BC3, BC4, BC5 } kind;
+    switch (image.internal_format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+        kind = BC1; break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+        kind = BC2; break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+        kind = BC3; break;
+    case GL_COMPRESSED_RED_RGTC1: case GL_COMPRESSED_SIGNED_RED_RGTC1:
+        kind = BC4; break;
+    case GL_COMPRESSED_RG_RGTC2: case GL_COMPRESSED_SIGNED_RG_RGTC2:
+        kind = BC5; break;
+    default: // BC6H/BC7 endpoints and partitions depend on the pixel positions, flipping requires re-encoding
+        return false;
+    }
+    // rows can only be mirrored within whole blocks (a 6 row level would move rows across block boundaries)
+    for (uint32_t level = 0; level < image.levels.size(); ++level)
+        if (image.level_height(level) > 4 && image.level_height(level) % 4 != 0) return false;
+    const uint32_t block_bytes = compressed_block_bytes(image.internal_format);
+    for (uint32_t level = 0; level < image.levels.size(); ++level) {
+        const uint32_t h = image.level_height(level), bw = (image.level_width(level) + 3) / 4, bh = (h + 3) / 4;
+        // dst row y within a block = src row map[y], only the first h rows are valid in levels below 4 rows
+        static const uint32_t maps[5][4] = { { 0, 1, 2, 3 }, { 0, 1, 2, 3 }, { 1, 0, 2, 3 }, { 2, 1, 0, 3 }, { 3, 2, 1, 0 } };
+        const uint32_t* map = maps[std::min(h, 4u)];
+        std::vector<uint8_t>& data = image.levels[level];
+        const size_t row_bytes = size_t(bw) * block_bytes;
+        for (uint32_t y = 0; y < bh / 2; ++y)
+            std::swap_ranges(data.begin() + y * row_bytes, data.begin() + (y + 1) * row_bytes, data.begin() + (bh - 1 - y) * row_bytes);
+        for (size_t offset = 0; offset + block_bytes <= data.size(); offset += block_bytes) {
+            uint8_t* block = data.data() + offset;
+            switch (kind) {
+            case BC1: flip_rows_2bit(block + 4, map); break;
+            case BC2: flip_rows_4bit(block, map); flip_rows_2bit(block + 12, map); break;
+            case BC3: flip_rows_3bit(block + 2, map); flip_rows_2bit(block + 12, map); break;
+            case BC4: flip_rows_3bit(block + 2, map); break;
+            case BC5: flip_rows_3bit(block + 2, map); flip_rows_3bit(block + 10, map); break;
+            }
+        }
+    }
+    image.bottom_up = !image.bottom_up;
+    return true;
+}
+
+void store_compressed_image(const fs::path& path, const CompressedImage& image) {
+    const BlockFormat* format = find_format([&](const BlockFormat& f) { return f.internal_format == image.internal_format; });
+    if (!format || image.levels.empty())
+        throw std::runtime_error("store_compressed_image: unsupported format or no data: " + path.string());
+    DDSHeader header = {};
+    header.size = sizeof(DDSHeader);
+    header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+    header.height = image.h;
+    header.width = image.w;
+    header.pitch_or_linear_size = uint32_t(image.levels[0].size());
+    header.depth = 1;
+    header.mip_map_count = uint32_t(image.levels.size());
+    header.pixel_format.size = sizeof(DDSPixelFormat);
+    header.pixel_format.flags = DDPF_FOURCC;
+    std::memcpy(&header.pixel_format.fourcc, "DX10", 4);
+    header.reserved1[DDS_MARKER_INDEX] = DDS_CPPGL_MARKER;
+    header.reserved1[DDS_BOTTOM_UP_INDEX] = image.bottom_up ? 1 : 0;
+    header.caps = DDSCAPS_TEXTURE | (image.levels.size() > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+    const DDSHeaderDX10 dx10 = { format->dxgi_format, DDS_DIMENSION_TEXTURE2D, 0, 1, 0 };
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write((const char*)&DDS_MAGIC, sizeof(DDS_MAGIC));
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)&dx10, sizeof(dx10));
+    for (const auto& level : image.levels)
+        file.write((const char*)level.data(), level.size());
+    if (!file)
+        throw std::runtime_error("store_compressed_image: failed to write: " + path.string());
+}
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <filesystem>
+namespace fs = std::filesystem;
+#include <GL/glew.h>
+#include <GL/gl.h>
+#include "platform.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// CompressedImage (block compressed BC1-BC7 data incl. mip chain, as uploaded via glCompressedTextureSubImage2D)
+
+struct CompressedImage {
+    GLenum internal_format = 0;             // GL_COMPRESSED_*
+    uint32_t w = 0, h = 0;
+    std::vector<std::vector<uint8_t>> levels; // level 0 (full resolution) first
+    bool bottom_up = true;                  // GL row order like image_load, false if rows are still in file order (top-down)
+
+    inline uint32_t level_width(uint32_t level) const { return std::max(w >> level, 1u); }
+    inline uint32_t level_height(uint32_t level) const { return std::max(h >> level, 1u); }
+};
+
+// bytes per 4x4 block (0 if not a supported block compressed format)
+uint32_t compressed_block_bytes(GLenum internal_format);
+// uncompressed format matching the channels of internal_format, e.g. for glGetTextureImage
+GLenum compressed_base_format(GLenum internal_format);
+
+// .dds (legacy FourCC or DX10 header) or .ktx2 (without supercompression) file?
+bool is_compressed_image_file(const fs::path& path);
+// load BC1-BC7 2D textures (first face/layer only), throws std::runtime_error on failure
+// BC1-BC5 blocks are flipped to bottom-up, BC6H/BC7 stay top-down (bottom_up = false) unless the file is stored bottom-up
+// Thread-safe, does not touch GL
+CompressedImage load_compressed_image(const fs::path& path);
+// write as .dds (DX10 header), bottom-up images are marked as such, throws std::runtime_error on failure
+void store_compressed_image(const fs::path& path, const CompressedImage& image);
+// reverse the row order of all levels and toggle bottom_up
+// false (and unchanged) for BC6H/BC7 and levels with heights not divisible by 4 (except < 4)
+bool flip_compressed_image(CompressedImage& image);
+
+// ------------------------------------------
+// CPU block compression (compressed_image_encode.cpp)
+
+enum BCFormat : uint32_t {
+    BC_FORMAT_BC1,  // RGB, 4 bpp
+    BC_FORMAT_BC3,  // RGBA (BC1 color + BC4 alpha), 8 bpp
+    BC_FORMAT_BC4,  // R, 4 bpp
+    BC_FORMAT_BC5,  // RG (two BC4 blocks), 8 bpp
+    BC_FORMAT_BC7,  // RGB(A), 8 bpp, mode 6 only (single subset, best for smooth content)
+};
+
+// encode 8 bit image with 1-4 channels, incl. box filtered mip chain if requested
+// Thread-safe (blocks are encoded on the worker pool), does not touch GL
+CompressedImage compress_image(const uint8_t* data, uint32_t w, uint32_t h, uint32_t channels, BCFormat format, bool mipmap = true);
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,367 @@
+#include "compressed_image.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <stdexcept>
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// helper funcs
+
+// 4x4 RGBA block, edge pixels are repeated for partial blocks
+struct Block {
+    float px[16][4];
+};
+
+static void fetch_block(const uint8_t* rgba, uint32_t w, uint32_t h, uint32_t bx, uint32_t by, Block& block) {
+    for (uint32_t y = 0; y < 4; ++y) {
+        for (uint32_t x = 0; x < 4; ++x) {
+            const uint8_t* p = rgba + (size_t(std::min(by * 4 + y, h - 1)) * w + std::min(bx * 4 + x, w - 1)) * 4;
+            for (uint32_t c = 0; c < 4; ++c)
+                block.px[y * 4 + x][c] = float(p[c]);
+        }
+    }
+}
+
+static inline float clamp255(float v) { return std::min(std::max(v, 0.f), 255.f); }
+
+// principal axis of the block colors (first num_channels channels) via power iteration
+static void principal_axis(const Block& block, uint32_t num_channels, float mean[4], float axis[4]) {
+    for (uint32_t c = 0; c < 4; ++c) {
+        mean[c] = 0.f;
+        for (uint32_t i = 0; i < 16; ++i) mean[c] += block.px[i][c];
+        mean[c] /= 16.f;
+    }
+    float cov[4][4] = {};
+    for (uint32_t i = 0; i < 16; ++i)
+        for (uint32_t a = 0; a < num_channels; ++a)
+            for (uint32_t b = 0; b < num_channels; ++b)
+                cov[a][b] += (block.px[i][a] - mean[a]) * (block.px[i][b] - mean[b]);
+    for (uint32_t c = 0; c < 4; ++c) axis[c] = c < num_channels ? 1.f : 0.f;
+    for (uint32_t iter = 0; iter < 8; ++iter) {
+        float next[4] = {}, len = 0.f;
+        for (uint32_t a = 0; a < num_channels; ++a) {
+            for (uint32_t b = 0; b < num_channels; ++b)
+                next[a] += cov[a][b] * axis[b];
+            len = std::max(len, std::fabs(next[a]));
+        }
+        if (len <= 0.f) break; // uniform block
+        for (uint32_t a = 0; a < num_channels; ++a) axis[a] = next[a] / len;
+    }
+}
+
+// endpoints at the extreme projections onto the principal axis
+static void range_fit(const Block& block, uint32_t num_channels, float e0[4], float e1[4]) {
+    float mean[4], axis[4];
+    principal_axis(block, num_channels, mean, axis);
+    float t_min = FLT_MAX, t_max = -FLT_MAX;
+    for (uint32_t i = 0; i < 16; ++i) {
+        float t = 0.f;
+        for (uint32_t c = 0; c < num_channels; ++c) t += (block.px[i][c] - mean[c]) * axis[c];
+        t_min = std::min(t_min, t);
+        t_max = std::max(t_max, t);
+    }
+    float len2 = 0.f;
+    for (uint32_t c = 0; c < num_channels; ++c) len2 += axis[c] * axis[c];
+    if (len2 > 0.f) { t_min /= len2; t_max /= len2; }
+    for (uint32_t c = 0; c < 4; ++c) {
+        e0[c] = clamp255(mean[c] + axis[c] * t_max);
+        e1[c] = clamp255(mean[c] + axis[c] * t_min);
+    }
+}
+
+// least squares endpoints for fixed interpolation weights (w = weight of e1 per pixel)
+static bool least_squares(const Block& block, uint32_t num_channels, const float weights[16], float e0[4], float e1[4]) {
+    float aa = 0.f, bb = 0.f, ab = 0.f, ap[4] = {}, bp[4] = {};
+    for (uint32_t i = 0; i < 16; ++i) {
+        const float b = weights[i], a = 1.f - b;
+        aa += a * a; bb += b * b; ab += a * b;
+        for (uint32_t c = 0; c < num_channels; ++c) {
+            ap[c] += a * block.px[i][c];
+            bp[c] += b * block.px[i][c];
+        }
+    }
+    const float det = aa * bb - ab * ab;
+    if (std::fabs(det) < 1e-6f) return false;
+    for (uint32_t c = 0; c < num_channels; ++c) {
+        e0[c] = clamp255((ap[c] * bb - bp[c] * ab) / det);
+        e1[c] = clamp255((bp[c] * aa - ap[c] * ab) / det);
+    }
+    return true;
+}
+
+static inline float distance2(const float* a, const float* b, uint32_t num_channels) {
+    float d = 0.f;
+    for (uint32_t c = 0; c < num_channels; ++c) d += (a[c] - b[c]) * (a[c] - b[c]);
+    return d;
+}
+
+// ------------------------------------------
+// BC1 (color only, always 4 color mode)
+
+static inline uint16_t pack_565(const float c[4]) {
+    const uint32_t r = uint32_t(c[0] * 31.f / 255.f + 0.5f), g = uint32_t(c[1] * 63.f / 255.f + 0.5f), b = uint32_t(c[2] * 31.f / 255.f + 0.5f);
+    return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static inline void unpack_565(uint16_t v, float c[4]) {
+    const uint32_t r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    c[0] = float((r << 3) | (r >> 2));
+    c[1] = float((g << 2) | (g >> 4));
+    c[2] = float((b << 3) | (b >> 2));
+    c[3] = 255.f;
+}
+
+// returns squared error, indices as packed into the block
+static float bc1_indices(const Block& block, uint16_t c0, uint16_t c1, uint32_t& indices, float weights[16]) {
+    float palette[4][4];
+    unpack_565(c0, palette[0]);
+    unpack_565(c1, palette[1]);
+    for (uint32_t c = 0; c < 3; ++c) {
+        palette[2][c] = (2.f * palette[0][c] + palette[1][c]) / 3.f;
+        palette[3][c] = (palette[0][c] + 2.f * palette[1][c]) / 3.f;
+    }
+    static const float index_weights[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+    const uint32_t num_entries = c0 == c1 ? 1 : 4;
+    float error = 0.f;
+    indices = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+        uint32_t best = 0;
+        float best_dist = FLT_MAX;
+        for (uint32_t k = 0; k < num_entries; ++k) {
+            const float dist = distance2(block.px[i], palette[k], 3);
+            if (dist < best_dist) { best = k; best_dist = dist; }
+        }
+        indices |= best << (2 * i);
+        weights[i] = index_weights[best];
+        error += best_dist;
+    }
+    return error;
+}
+
+static void encode_bc1(const Block& block, uint8_t* out) {
+    float e0[4], e1[4], weights[16];
+    range_fit(block, 3, e0, e1);
+    uint16_t best_c0 = 0, best_c1 = 0;
+    uint32_t best_indices = 0;
+    float best_error = FLT_MAX;
+    for (uint32_t iter = 0; iter < 3; ++iter) {
+        uint16_t c0 = pack_565(e0), c1 = pack_565(e1);
+        if (c0 < c1) std::swap(c0, c1); // c0 > c1 selects 4 color mode
+        uint32_t indices;
+        const float error = bc1_indices(block, c0, c1, indices, weights);
+        if (error < best_error) {
+            best_error = error;
+            best_c0 = c0; best_c1 = c1; best_indices = indices;
+        }
+        if (error <= 0.f || c0 == c1) break;
+        // refine endpoints for the chosen indices (weights relative to the ordered endpoints)
+        unpack_565(c0, e0);
+        unpack_565(c1, e1);
+        if (!least_squares(block, 3, weights, e0, e1)) break;
+    }
+    std::memcpy(out, &best_c0, 2);
+    std::memcpy(out + 2, &best_c1, 2);
+    std::memcpy(out + 4, &best_indices, 4);
+}
+
+// ------------------------------------------
+// BC4 (single channel, 8 value mode)
+
+static void encode_bc4(const Block& block, uint32_t channel, uint8_t* out) {
+    float v_min = 255.f, v_max = 0.f;
+    for (uint32_t i = 0; i < 16; ++i) {
+        v_min = std::min(v_min, block.px[i][channel]);
+        v_max = std::max(v_max, block.px[i][channel]);
+    }
+    const uint8_t a0 = uint8_t(v_max + 0.5f), a1 = uint8_t(v_min + 0.5f);
+    float palette[8] = { float(a0), float(a1) };
+    for (uint32_t k = 1; k < 7; ++k)
+        palette[k + 1] = float((7 - k) * a0 + k * a1) / 7.f;
+    uint64_t indices = 0;
+    if (a0 != a1) {
+        for (uint32_t i = 0; i < 16; ++i) {
+            uint64_t best = 0;
+            float best_dist = FLT_MAX;
+            for (uint32_t k = 0; k < 8; ++k) {
+                const float dist = std::fabs(block.px[i][channel] - palette[k]);
+                if (dist < best_dist) { best = k; best_dist = dist; }
+            }
+            indices |= best << (3 * i);
+        }
+    }
+    out[0] = a0;
+    out[1] = a1;
+    for (uint32_t b = 0; b < 6; ++b)
+        out[2 + b] = uint8_t(indices >> (8 * b));
+}
+
+// ------------------------------------------
+// BC7 mode 6 (RGBA 7.7.7.7 endpoints with unique p-bits, 4 bit indices)
+
+static const uint32_t BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BitWriter {
+    uint8_t* out;
+    uint32_t pos = 0;
+    void put(uint32_t value, uint32_t bits) {
+        for (uint32_t b = 0; b < bits; ++b, ++pos)
+            out[pos / 8] |= uint8_t(((value >> b) & 1) << (pos % 8));
+    }
+};
+
+// quantize endpoint to 7 bits per channel + shared p-bit, returns reconstructed 8 bit values
+static void bc7_quantize(const float e[4], uint32_t q[4], uint32_t& pbit, uint32_t rec[4]) {
+    float best_error = FLT_MAX;
+    for (uint32_t p = 0; p < 2; ++p) {
+        uint32_t q_p[4], rec_p[4];
+        float error = 0.f;
+        for (uint32_t c = 0; c < 4; ++c) {
+            const int v = int(std::lround((e[c] - float(p)) / 2.f));
+            q_p[c] = uint32_t(std::min(std::max(v, 0), 127));
+            rec_p[c] = (q_p[c] << 1) | p;
+            error += (float(rec_p[c]) - e[c]) * (float(rec_p[c]) - e[c]);
+        }
+        if (error < best_error) {
+            best_error = error;
+            pbit = p;
+            std::memcpy(q, q_p, sizeof(q_p));
+            std::memcpy(rec, rec_p, sizeof(rec_p));
+        }
+    }
+}
+
+static float bc7_indices(const Block& block, const uint32_t rec0[4], const uint32_t rec1[4], uint32_t indices[16], float weights[16]) {
+    float palette[16][4];
+    for (uint32_t k = 0; k < 16; ++k)
+        for (uint32_t c = 0; c < 4; ++c)
+            palette[k][c] = float(((64 - BC7_WEIGHTS[k]) * rec0[c] + BC7_WEIGHTS[k] * rec1[c] + 32) >> 6);
+    float error = 0.f;
+    for (uint32_t i = 0; i < 16; ++i) {
+        uint32_t best = 0;
+        float best_dist = FLT_MAX;
+        for (uint32_t k = 0; k < 16; ++k) {
+            const float dist = distance2(block.px[i], palette[k], 4);
+            if (dist < best_dist) { best = k; best_dist = dist; }
+        }
+        indices[i] = best;
+        weights[i] = float(BC7_WEIGHTS[best]) / 64.f;
+        error += best_dist;
+    }
+    return error;
+}
+
+static void encode_bc7(const Block& block, uint8_t* out) {
+    float e0[4], e1[4], weights[16];
+    range_fit(block, 4, e0, e1);
+    uint32_t best_q0[4], best_q1[4], best_p0 = 0, best_p1 = 0, best_indices[16];
+    float best_error = FLT_MAX;
+    for (uint32_t iter = 0; iter < 3; ++iter) {
+        uint32_t q0[4], q1[4], rec0[4], rec1[4], p0, p1, indices[16];
+        bc7_quantize(e0, q0, p0, rec0);
+        bc7_quantize(e1, q1, p1, rec1);
+        const float error = bc7_indices(block, rec0, rec1, indices, weights);
+        if (error < best_error) {
+            best_error = error;
+            std::memcpy(best_q0, q0, sizeof(q0));
+            std::memcpy(best_q1, q1, sizeof(q1));
+            std::memcpy(best_indices, indices, sizeof(indices));
+            best_p0 = p0; best_p1 = p1;
+        }
+        if (error <= 0.f || !least_squares(block, 4, weights, e0, e1)) break;
+    }
+    // the anchor index is stored without its MSB, so it must be < 8
+    if (best_indices[0] & 8) {
+        std::swap(best_q0, best_q1);
+        std::swap(best_p0, best_p1);
+        for (uint32_t i = 0; i < 16; ++i) best_indices[i] = 15 - best_indices[i];
+    }
+    std::memset(out, 0, 16);
+    BitWriter writer = { out };
+    writer.put(1 << 6, 7); // mode 6
+    for (uint32_t c = 0; c < 4; ++c) {
+        writer.put(best_q0[c], 7);
+        writer.put(best_q1[c], 7);
+    }
+    writer.put(best_p0, 1);
+    writer.put(best_p1, 1);
+    writer.put(best_indices[0], 3);
+    for (uint32_t i = 1; i < 16; ++i)
+        writer.put(best_indices[i], 4);
+}
+
+// ------------------------------------------
+// image compression
+
+static void compress_level(const uint8_t* rgba, uint32_t w, uint32_t h, BCFormat format, std::vector<uint8_t>& out) {
+    const uint32_t blocks_x = (w + 3) / 4, blocks_y = (h + 3) / 4;
+    const uint32_t block_bytes = (format == BC_FORMAT_BC1 || format == BC_FORMAT_BC4) ? 8 : 16;
+    out.assign(size_t(blocks_x) * blocks_y * block_bytes, 0);
+    parallel_for(blocks_y, 16, [&](uint32_t begin, uint32_t end) {
+        Block block;
+        for (uint32_t by = begin; by < end; ++by) {
+            for (uint32_t bx = 0; bx < blocks_x; ++bx) {
+                fetch_block(rgba, w, h, bx, by, block);
+                uint8_t* dst = out.data() + (size_t(by) * blocks_x + bx) * block_bytes;
+                switch (format) {
+                case BC_FORMAT_BC1: encode_bc1(block, dst); break;
+                case BC_FORMAT_BC3: encode_bc4(block, 3, dst); encode_bc1(block, dst + 8); break;
+                case BC_FORMAT_BC4: encode_bc4(block, 0, dst); break;
+                case BC_FORMAT_BC5: encode_bc4(block, 0, dst); encode_bc4(block, 1, dst + 8); break;
+                case BC_FORMAT_BC7: encode_bc7(block, dst); break;
+                }
+            }
+        }
+    });
+}
+
+// 2x2 box filter (odd sizes repeat the last row/column)
+static std::vector<uint8_t> downsample(const std::vector<uint8_t>& rgba, uint32_t w, uint32_t h) {
+    const uint32_t dw = std::max(w / 2, 1u), dh = std::max(h / 2, 1u);
+    std::vector<uint8_t> result(size_t(dw) * dh * 4);
+    for (uint32_t y = 0; y < dh; ++y) {
+        const uint32_t y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+        for (uint32_t x = 0; x < dw; ++x) {
+            const uint32_t x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+            for (uint32_t c = 0; c < 4; ++c) {
+                const uint32_t sum = rgba[(size_t(y0) * w + x0) * 4 + c] + rgba[(size_t(y0) * w + x1) * 4 + c] +
+                    rgba[(size_t(y1) * w + x0) * 4 + c] + rgba[(size_t(y1) * w + x1) * 4 + c];
+                result[(size_t(y) * dw + x) * 4 + c] = uint8_t((sum + 2) / 4);
+            }
+        }
+    }
+    return result;
+}
+
+CompressedImage compress_image(const uint8_t* data, uint32_t w, uint32_t h, uint32_t channels, BCFormat format, bool mipmap) {
+    if (w == 0 || h == 0 || channels == 0 || channels > 4)
+        throw std::runtime_error("compress_image: invalid image dimensions or channels");
+    // expand to RGBA, channels missing in the source read as 0 (alpha as 255) like in GL
+    std::vector<uint8_t> rgba(size_t(w) * h * 4);
+    for (size_t i = 0; i < size_t(w) * h; ++i)
+        for (uint32_t c = 0; c < 4; ++c)
+            rgba[i * 4 + c] = c < channels ? data[i * channels + c] : (c == 3 ? 255 : 0);
+    CompressedImage image;
+    switch (format) {
+    case BC_FORMAT_BC1: image.internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; break;
+    case BC_FORMAT_BC3: image.internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+    case BC_FORMAT_BC4: image.internal_format = GL_COMPRESSED_RED_RGTC1; break;
+    case BC_FORMAT_BC5: image.internal_format = GL_COMPRESSED_RG_RGTC2; break;
+    case BC_FORMAT_BC7: image.internal_format = GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+    }
+    image.w = w;
+    image.h = h;
+    while (true) {
+        image.levels.emplace_back();
+        compress_level(rgba.data(), w, h, format, image.levels.back());
+        if (!mipmap || (w == 1 && h == 1)) break;
+        rgba = downsample(rgba, w, h);
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
+    }
+    return image;
+}
+
+CPPGL_NAMESPACE_END
@@ -1,5 +1,7 @@
 #include "context.h"
 #include "debug.h"
+#include "capabilities.h"
+#include "state.h"
 #include "camera.h"
 #include "shader.h"
 #include "texture.h"
@@ -14,8 +16,16 @@
 #include "imgui/imgui_impl_glfw.h"
 #include "imgui/imgui_impl_opengl3.h"
 #include "image_load_store.h"
+#include "async_loader.h"
+#include "readback.h"
+#include "thread_pool.h"
+#include "pixel_convert.h"
 #include <glm/glm.hpp>
 #include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <deque>
 
 CPPGL_NAMESPACE_BEGIN
 
@@ -72,7 +82,7 @@ static void glfw_mouse_scroll_callback(GLFWwindow* window, double xoffset, doubl
 }
 
 static void glfw_resize_callback(GLFWwindow* window, int w, int h) {
-    glViewport(0, 0, w, h);
+    GLState::viewport(0, 0, w, h);
     if (user_resize_callback)
         user_resize_callback(w, h);
 }
@@ -86,6 +96,9 @@ static void glfw_char_callback(GLFWwindow* window, unsigned int c) {
 
 static ContextParameters parameters;
 
+// capture mode, see below
+static void capture_frame(bool with_gui);
+
 Context::Context() {
     if (!glfwInit())
         throw std::runtime_error("glfwInit failed!");
@@ -124,6 +137,8 @@ Context::Context() {
     std::cout << "GLFW: " << glfwGetVersionString() << std::endl;
     std::cout << "OpenGL: " << glGetString(GL_VERSION) << ", " << glGetString(GL_RENDERER) << std::endl;
     std::cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << std::endl;
+    query_gl_capabilities(parameters.direct_state_access);
+    GLState::set_lazy_unbind(parameters.lazy_unbind);
 
     // enable debugging output
     enable_strack_trace_on_crash();
@@ -186,6 +201,12 @@ Context::Context() {
 }
 
 Context::~Context() {
+    stop_capture();
+    AsyncLoader::clear();
+    Readback::clear();
+    Texture2DImpl::release_upload_buffer();
+    // don't lose screenshots queued right before exit
+    ImageWriter::wait_idle();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -211,7 +232,16 @@ bool Context::running() { return !glfwWindowShouldClose(instance().glfw_window);
 void Context::swap_buffers() {
     if (show_gui) gui_draw();
     ImGui::Render();
+    capture_frame(false);
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    capture_frame(true);
+    // imgui modifies GL state behind our back
+    GLState::invalidate();
+    // stream in background loads within the per-frame budget
+    AsyncLoader::update();
+    // hand over finished readbacks
+    Readback::update();
+    GLState::end_frame();
     instance().cpu_timer->end();
     instance().gpu_timer->end();
     instance().prim_count->end();
@@ -235,16 +265,174 @@ double Context::frame_time() { return instance().curr_t - instance().last_t; }
 
 void Context::screenshot(const std::filesystem::path& path) {
     const glm::ivec2 size = resolution();
-    std::vector<uint8_t> pixels(size_t(size.x) * size.y * 3);
-    // glReadPixels can align the first pixel in each row at 1-, 2-, 4- and 8-byte boundaries. We
-    // have allocated the exact size needed for the image so we have to use 1-byte alignment
-    // (otherwise glReadPixels would write out of bounds)
-    glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glReadPixels(0, 0, size.x, size.y, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
-    // write ldr image to disk (async)
-    image_store_ldr(path, pixels.data(), size.x, size.y, 3, true, true);
+    // read into a PBO and write ldr image to disk once it arrived (async)
+    Readback::store(std::make_unique<Readback>(0, GL_BACK, 0, 0, size.x, size.y, GL_RGB, GL_UNSIGNED_BYTE), path, true);
+}
+
+// ------------------------------------------
+// capture mode
+
+struct CaptureState {
+    CaptureParameters params;
+    int w = 0, h = 0;
+    uint32_t max_queued = 0;
+    std::unique_ptr<ThreadPool> encoders;
+    std::deque<std::unique_ptr<Readback>> in_flight;        // PBO ring, oldest first
+    std::deque<std::future<std::vector<uint8_t>>> encoding; // frames are handed back for reuse
+    std::vector<std::vector<uint8_t>> free_frames;
+    std::ofstream stream;         // Y4M/raw, only written by the single encoder
+    std::vector<uint8_t> yuv;     // Y4M scratch, encoder only
+};
+static std::unique_ptr<CaptureState> capture;
+static uint64_t capture_num_frames = 0, capture_num_dropped = 0;
+
+static std::string capture_frame_path(const std::filesystem::path& pattern, uint64_t frame) {
+    std::string fmt = pattern.string();
+    if (fmt.find('%') == std::string::npos)
+        fmt = (pattern.parent_path() / (pattern.stem().string() + "_%05d" + pattern.extension().string())).string();
+    std::vector<char> buf(fmt.size() + 32);
+    snprintf(buf.data(), buf.size(), fmt.c_str(), int(frame));
+    return std::string(buf.data());
 }
 
+static void write_y4m_frame(std::ofstream& out, const uint8_t* rgb, int w, int h, std::vector<uint8_t>& yuv) {
+    // full range BT.601 in 8 bit fixed point, planar Y, Cb, Cr
+    const size_t n = size_t(w) * h;
+    yuv.resize(3 * n);
+    for (size_t i = 0; i < n; ++i) {
+        const int r = rgb[3 * i + 0], g = rgb[3 * i + 1], b = rgb[3 * i + 2];
+        yuv[i] = uint8_t((77 * r + 150 * g + 29 * b + 128) >> 8);
+        yuv[n + i] = uint8_t(std::min((-43 * r - 85 * g + 128 * b + 32896) >> 8, 255));
+        yuv[2 * n + i] = uint8_t(std::min((128 * r - 107 * g - 21 * b + 32896) >> 8, 255));
+    }
+    out << "FRAME\n";
+    out.write((const char*)yuv.data(), yuv.size());
+}
+
+static void recycle_frame(CaptureState& cap) {
+    try {
+        cap.free_frames.push_back(cap.encoding.front().get());
+    } catch (const std::exception& e) {
+        std::cerr << "WARN: capture: " << e.what() << std::endl;
+    }
+    cap.encoding.pop_front();
+}
+
+// copy an arrived frame (flipped to top row first, BGRA -> RGB) and queue it for encoding
+static void encode_frame(CaptureState& cap, Readback& readback, bool block) {
+    while (!cap.encoding.empty() && cap.encoding.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        recycle_frame(cap);
+    if (cap.encoding.size() >= cap.max_queued) {
+        if (!block) {
+            capture_num_dropped++;
+            return;
+        }
+        recycle_frame(cap); // backpressure: wait for the oldest frame
+    }
+    std::vector<uint8_t> frame;
+    if (!cap.free_frames.empty()) {
+        frame = std::move(cap.free_frames.back());
+        cap.free_frames.pop_back();
+    }
+    const size_t row = size_t(cap.w) * 3, src_row = size_t(cap.w) * 4;
+    frame.resize(row * cap.h);
+    const uint8_t* src = (const uint8_t*)readback.wait();
+    for (int y = 0; y < cap.h; ++y)
+        bgra_to_rgb(src + (cap.h - 1 - y) * src_row, frame.data() + y * row, cap.w);
+    const uint64_t index = capture_num_frames++;
+    const int w = cap.w, h = cap.h;
+    CaptureState* state = &cap;
+    switch (cap.params.format) {
+    case CAPTURE_IMAGE_SEQUENCE:
+        cap.encoding.push_back(cap.encoders->enqueue([frame = std::move(frame), path = capture_frame_path(cap.params.path, index), w, h]() mutable {
+            image_store_ldr(path, frame.data(), w, h, 3, false);
+            return std::move(frame);
+        }));
+        break;
+    case CAPTURE_Y4M:
+        cap.encoding.push_back(cap.encoders->enqueue([frame = std::move(frame), state, w, h]() mutable {
+            write_y4m_frame(state->stream, frame.data(), w, h, state->yuv);
+            return std::move(frame);
+        }));
+        break;
+    case CAPTURE_RAW_RGB:
+        cap.encoding.push_back(cap.encoders->enqueue([frame = std::move(frame), state]() mutable {
+            state->stream.write((const char*)frame.data(), frame.size());
+            return std::move(frame);
+        }));
+        break;
+    }
+}
+
+static void capture_frame(bool with_gui) {
+    if (!capture || capture->params.include_gui != with_gui) return;
+    CaptureState& cap = *capture;
+    // hand over arrived frames in order
+    while (!cap.in_flight.empty() && cap.in_flight.front()->ready()) {
+        encode_frame(cap, *cap.in_flight.front(), cap.params.lossless);
+        cap.in_flight.pop_front();
+    }
+    if (cap.in_flight.size() >= cap.params.ring_size) {
+        if (!cap.params.lossless) {
+            capture_num_dropped++;
+            return;
+        }
+        encode_frame(cap, *cap.in_flight.front(), true);
+        cap.in_flight.pop_front();
+    }
+    // start reading this frame (BGRA is the native readback layout, RGB would be repacked by the driver)
+    if (cap.params.framebuffer)
+        cap.in_flight.push_back(std::make_unique<Readback>(cap.params.framebuffer->id, GL_COLOR_ATTACHMENT0 + cap.params.attachment,
+                    0, 0, cap.w, cap.h, GL_BGRA, GL_UNSIGNED_BYTE));
+    else
+        cap.in_flight.push_back(std::make_unique<Readback>(0, GL_BACK, 0, 0, cap.w, cap.h, GL_BGRA, GL_UNSIGNED_BYTE));
+}
+
+void Context::start_capture(const CaptureParameters& params) {
+    stop_capture();
+    auto cap = std::make_unique<CaptureState>();
+    cap->params = params;
+    cap->params.ring_size = std::max(1u, params.ring_size);
+    const glm::ivec2 size = params.framebuffer ? glm::ivec2(params.framebuffer->w, params.framebuffer->h) : resolution();
+    cap->w = size.x;
+    cap->h = size.y;
+    const std::filesystem::path dir = params.path.parent_path();
+    if (!dir.empty()) std::filesystem::create_directories(dir);
+    uint32_t num_encoders = params.num_encoders;
+    if (params.format != CAPTURE_IMAGE_SEQUENCE) {
+        // frames have to arrive in order
+        num_encoders = 1;
+        cap->stream.open(params.path, std::ios::binary);
+        if (!cap->stream)
+            throw std::runtime_error("Context::start_capture: failed to open " + params.path.string());
+        if (params.format == CAPTURE_Y4M)
+            cap->stream << "YUV4MPEG2 W" << cap->w << " H" << cap->h << " F" << params.fps << ":1 Ip A1:1 C444 XCOLORRANGE=FULL\n";
+    } else if (num_encoders == 0)
+        num_encoders = std::max(1u, std::thread::hardware_concurrency() / 2);
+    cap->max_queued = params.max_queued > 0 ? params.max_queued : 2 * num_encoders;
+    cap->encoders = std::make_unique<ThreadPool>(num_encoders);
+    capture_num_frames = capture_num_dropped = 0;
+    capture = std::move(cap);
+}
+
+void Context::stop_capture() {
+    if (!capture) return;
+    CaptureState& cap = *capture;
+    for (auto& readback : cap.in_flight)
+        encode_frame(cap, *readback, true);
+    cap.in_flight.clear();
+    while (!cap.encoding.empty())
+        recycle_frame(cap);
+    cap.encoders.reset();
+    capture.reset();
+}
+
+bool Context::capturing() { return bool(capture); }
+
+uint64_t Context::captured_frames() { return capture_num_frames; }
+
+uint64_t Context::dropped_frames() { return capture_num_dropped; }
+
 void Context::show() { glfwShowWindow(instance().glfw_window); }
 
 void Context::hide() { glfwHideWindow(instance().glfw_window); }
@@ -257,7 +445,7 @@ glm::ivec2 Context::resolution() {
 
 void Context::resize(int w, int h) {
     glfwSetWindowSize(instance().glfw_window, w, h);
-    glViewport(0, 0, w, h);
+    GLState::viewport(0, 0, w, h);
 }
 
 void Context::set_title(const std::string& name) { glfwSetWindowTitle(instance().glfw_window, name.c_str()); }
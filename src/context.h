@@ -6,6 +6,7 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include "query.h"
+#include "framebuffer.h"
 
 CPPGL_NAMESPACE_BEGIN
 
@@ -21,12 +22,34 @@ struct ContextParameters {
     int floating = GLFW_FALSE;
     int maximised = GLFW_FALSE;
     int gl_debug_context = GLFW_TRUE;
+    bool direct_state_access = true; // use DSA code paths if GL 4.5 is available
+    bool lazy_unbind = false; // skip "unbind to 0" calls, bindings are only changed when needed
     uint32_t swap_interval = 1; // 0 = no vsync, 1 = 60fps, 2 = 30fps, etc
     std::filesystem::path font_ttf_filename;
     uint32_t font_size_pixels = 13; // unused if no font is provided. use font scale instead
     float global_font_scale = 1.f;
 };
 
+// Capture mode output
+enum CaptureFormat {
+    CAPTURE_IMAGE_SEQUENCE, // numbered images, file type by extension (e.g. .png for lossless)
+    CAPTURE_Y4M,            // single YUV4MPEG2 stream, 4:4:4 full range BT.601
+    CAPTURE_RAW_RGB,        // single headerless rgb24 stream (ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH -r FPS -i <path>)
+};
+
+struct CaptureParameters {
+    std::filesystem::path path = "capture/frame_%05d.png"; // printf pattern for image sequences (_%05d is appended if missing)
+    CaptureFormat format = CAPTURE_IMAGE_SEQUENCE;
+    Framebuffer framebuffer; // capture this framebuffer's color attachment instead of the back buffer
+    uint32_t attachment = 0; // color attachment index of framebuffer
+    bool include_gui = false; // back buffer only
+    bool lossless = true; // stall on backpressure instead of dropping frames (offline rendering)
+    uint32_t ring_size = 3; // readbacks in flight
+    uint32_t num_encoders = 0; // 0: half the hardware threads (streams always use one)
+    uint32_t max_queued = 0; // frames queued or being encoded, 0: twice the encoders
+    uint32_t fps = 30; // Y4M header
+};
+
 // Initialize and hold a GLFW/GL context + window.
 class Context {
 private:
@@ -50,6 +73,13 @@ public:
     static double frame_time();
     static void screenshot(const std::filesystem::path& path);
 
+    // capture mode: read back every frame via PBOs and encode on a bounded pool (e.g. to render AnimationImpl camera paths)
+    static void start_capture(const CaptureParameters& params = CaptureParameters());
+    static void stop_capture(); // waits for outstanding frames
+    static bool capturing();
+    static uint64_t captured_frames(); // of the current or last capture
+    static uint64_t dropped_frames();
+
     // modify
     static void show();
     static void hide();
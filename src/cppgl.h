@@ -3,22 +3,35 @@
 #include "platform.h"
 
 #include "anim.h"
+#include "async_loader.h"
 #include "buffer.h"
 #include "camera.h"
+#include "capabilities.h"
+#include "compressed_image.h"
 #include "context.h"
+#include "culling.h"
 #include "debug.h"
+#include "draw_bucket.h"
 #include "drawelement.h"
 #include "framebuffer.h"
 #include "geometry.h"
+#include "geometry_arena.h"
 #include "gui.h"
 #include "image_load_store.h"
+#include "mapped_file.h"
 #include "material.h"
 #include "mesh.h"
+#include "mesh_cache.h"
 #include "named_handle.h"
+#include "pixel_convert.h"
 #include "quad.h"
+#include "readback.h"
 #include "query.h"
 #include "shader.h"
+#include "state.h"
 #include "texture.h"
+#include "texture_cache.h"
+#include "thread_pool.h"
 
 #ifndef __CUDACC__
 //glm to string with <<operators
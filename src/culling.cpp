@@ -0,0 +1,366 @@
+#include "culling.h"
+#include "camera.h"
+#include "shader.h"
+#include "state.h"
+#include "capabilities.h"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// embedded compute shaders
+
+static const char* hiz_source = R"(
+#version 430
+layout(local_size_x = 8, local_size_y = 8) in;
+uniform sampler2D src;
+uniform int src_level;
+layout(r32f) uniform writeonly image2D dst;
+
+void main() {
+    ivec2 dst_size = imageSize(dst);
+    ivec2 src_size = textureSize(src, src_level);
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(p, dst_size))) return;
+    // covered source texels (up to 3x3 for odd sizes) to stay conservative
+    ivec2 lo = (p * src_size) / dst_size;
+    ivec2 hi = max(((p + 1) * src_size + dst_size - 1) / dst_size, lo + 1);
+    float depth = 0.0;
+    for (int y = lo.y; y < hi.y; ++y)
+        for (int x = lo.x; x < hi.x; ++x)
+            depth = max(depth, texelFetch(src, ivec2(x, y), src_level).r);
+    imageStore(dst, p, vec4(depth));
+}
+)";
+
+static const char* cull_source = R"(
+#version 430
+layout(local_size_x = 64) in;
+
+struct Command {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+struct DrawData {
+    mat4 model;
+    mat4 model_normal;
+    vec4 data;
+};
+struct Bounds {
+    vec4 bb_min;
+    vec4 bb_max;
+};
+layout(std430, binding = 0) readonly buffer Commands { Command commands[]; };
+layout(std430, binding = 1) readonly buffer Draws { DrawData draws[]; };
+layout(std430, binding = 2) readonly buffer BoundsBuffer { Bounds bounds[]; };
+layout(std430, binding = 3) writeonly buffer Visible { Command visible[]; };
+layout(binding = 0, offset = 0) uniform atomic_uint visible_count;
+
+uniform uint num_draws;
+uniform mat4 view_proj;
+uniform int compact;
+uniform int use_hiz;
+uniform sampler2D hiz;
+
+bool is_visible(uint i) {
+    if (bounds[i].bb_max.w == 0.0) return true;
+    mat4 mvp = view_proj * draws[i].model;
+    vec3 lo = bounds[i].bb_min.xyz, hi = bounds[i].bb_max.xyz;
+    // frustum test: culled if all corners are outside of the same clip plane
+    vec3 out_lo = vec3(0), out_hi = vec3(0);
+    bool all_in_front = true;
+    vec3 ndc_min = vec3(1e30), ndc_max = vec3(-1e30);
+    for (int c = 0; c < 8; ++c) {
+        vec3 corner = vec3((c & 1) != 0 ? hi.x : lo.x, (c & 2) != 0 ? hi.y : lo.y, (c & 4) != 0 ? hi.z : lo.z);
+        vec4 clip = mvp * vec4(corner, 1.0);
+        out_lo += vec3(lessThan(clip.xyz, vec3(-clip.w)));
+        out_hi += vec3(greaterThan(clip.xyz, vec3(clip.w)));
+        all_in_front = all_in_front && clip.w > 0.0;
+        if (clip.w > 0.0) {
+            ndc_min = min(ndc_min, clip.xyz / clip.w);
+            ndc_max = max(ndc_max, clip.xyz / clip.w);
+        }
+    }
+    if (any(equal(out_lo, vec3(8))) || any(equal(out_hi, vec3(8)))) return false;
+    // occlusion test against max depth of the covered Hi-Z texels (skipped for boxes crossing the near plane)
+    if (use_hiz == 0 || !all_in_front) return true;
+    vec2 uv_min = clamp(ndc_min.xy * 0.5 + 0.5, 0.0, 1.0), uv_max = clamp(ndc_max.xy * 0.5 + 0.5, 0.0, 1.0);
+    vec2 extent = (uv_max - uv_min) * vec2(textureSize(hiz, 0));
+    float level = ceil(log2(max(max(extent.x, extent.y), 1.0)));
+    float occluder_depth = max(max(textureLod(hiz, uv_min, level).r, textureLod(hiz, vec2(uv_max.x, uv_min.y), level).r),
+                               max(textureLod(hiz, vec2(uv_min.x, uv_max.y), level).r, textureLod(hiz, uv_max, level).r));
+    return ndc_min.z * 0.5 + 0.5 <= occluder_depth;
+}
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= num_draws) return;
+    Command cmd = commands[i];
+    bool vis = is_visible(i);
+    if (compact != 0) {
+        if (vis) visible[atomicCounterIncrement(visible_count)] = cmd;
+    } else {
+        if (!vis) cmd.instance_count = 0;
+        visible[i] = cmd;
+    }
+}
+)";
+
+static const char* meshlet_cull_source = R"(
+#version 430
+layout(local_size_x = 64) in;
+
+struct Meshlet {
+    vec4 sphere;
+    vec4 cone;
+    uint first_index;
+    uint num_indices;
+    uint num_vertices;
+    uint pad;
+};
+struct Command {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+layout(std430, binding = 0) readonly buffer Meshlets { Meshlet meshlets[]; };
+layout(std430, binding = 1) writeonly buffer Visible { Command visible[]; };
+layout(binding = 0, offset = 0) uniform atomic_uint visible_count;
+
+uniform uint num_meshlets;
+uniform mat4 model;
+uniform float radius_scale;
+uniform vec4 frustum[6];
+uniform vec3 cam_pos_local;
+uniform vec3 view_dir_local; // orthographic cameras: constant view direction instead of cam_pos_local
+uniform int perspective;
+uniform uint index_offset;
+uniform int base_vertex;
+uniform int compact;
+
+bool is_visible(Meshlet m) {
+    // frustum test in world space
+    vec3 center = (model * vec4(m.sphere.xyz, 1.0)).xyz;
+    float radius = m.sphere.w * radius_scale;
+    for (int i = 0; i < 6; ++i)
+        if (dot(frustum[i].xyz, center) + frustum[i].w < -radius) return false;
+    // normal cone test in object space: culled if all triangles face away from the camera
+    if (perspective == 0)
+        return dot(view_dir_local, m.cone.xyz) < m.cone.w;
+    vec3 d = m.sphere.xyz - cam_pos_local;
+    return dot(d, m.cone.xyz) < m.cone.w * length(d) + m.sphere.w;
+}
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= num_meshlets) return;
+    Meshlet m = meshlets[i];
+    Command cmd = Command(m.num_indices, 1u, m.first_index + index_offset, base_vertex, 0u);
+    bool vis = is_visible(m);
+    if (compact != 0) {
+        if (vis) visible[atomicCounterIncrement(visible_count)] = cmd;
+    } else {
+        if (!vis) cmd.instance_count = 0;
+        visible[i] = cmd;
+    }
+}
+)";
+
+static Shader hiz_shader() {
+    static Shader shader;
+    if (!shader) {
+        shader = Shader("cppgl_hiz_downsample");
+        shader->set_source_string(GL_COMPUTE_SHADER, hiz_source);
+        shader->compile();
+    }
+    return shader;
+}
+
+static Shader cull_shader() {
+    static Shader shader;
+    if (!shader) {
+        shader = Shader("cppgl_cull_draws");
+        shader->set_source_string(GL_COMPUTE_SHADER, cull_source);
+        shader->compile();
+    }
+    return shader;
+}
+
+static Shader meshlet_cull_shader() {
+    static Shader shader;
+    if (!shader) {
+        shader = Shader("cppgl_cull_meshlets");
+        shader->set_source_string(GL_COMPUTE_SHADER, meshlet_cull_source);
+        shader->compile();
+    }
+    return shader;
+}
+
+// reset atomic counter in count_buffer to zero and bind it to unit 0
+// indexed buffer bindings used by the culling passes, restored afterwards so callers' bindings survive
+struct SavedBinding {
+    GLenum target;
+    uint32_t index;
+    GLint buffer;
+    GLint64 offset, size;
+};
+
+static std::vector<SavedBinding> save_bindings(uint32_t num_ssbos) {
+    std::vector<SavedBinding> saved;
+    const auto save = [&](GLenum target, GLenum binding, GLenum start, GLenum size, uint32_t index) {
+        SavedBinding b = { target, index, 0, 0, 0 };
+        glGetIntegeri_v(binding, index, &b.buffer);
+        glGetInteger64i_v(start, index, &b.offset);
+        glGetInteger64i_v(size, index, &b.size);
+        saved.push_back(b);
+    };
+    for (uint32_t i = 0; i < num_ssbos; ++i)
+        save(GL_SHADER_STORAGE_BUFFER, GL_SHADER_STORAGE_BUFFER_BINDING, GL_SHADER_STORAGE_BUFFER_START, GL_SHADER_STORAGE_BUFFER_SIZE, i);
+    save(GL_ATOMIC_COUNTER_BUFFER, GL_ATOMIC_COUNTER_BUFFER_BINDING, GL_ATOMIC_COUNTER_BUFFER_START, GL_ATOMIC_COUNTER_BUFFER_SIZE, 0);
+    return saved;
+}
+
+static void restore_bindings(const std::vector<SavedBinding>& saved) {
+    for (const auto& b : saved) {
+        if (b.buffer != 0 && b.size > 0)
+            GLState::bind_buffer_range(b.target, b.index, GLuint(b.buffer), size_t(b.offset), size_t(b.size));
+        else
+            GLState::bind_buffer_base(b.target, b.index, GLuint(b.buffer));
+    }
+}
+
+static void reset_count_buffer(GLuint count_buffer) {
+    const GLuint zero = 0;
+    if (has_direct_state_access())
+        glClearNamedBufferData(count_buffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    else {
+        GLState::bind_buffer(GL_ATOMIC_COUNTER_BUFFER, count_buffer);
+        glClearBufferData(GL_ATOMIC_COUNTER_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
+    GLState::bind_buffer_base(GL_ATOMIC_COUNTER_BUFFER, 0, count_buffer);
+}
+
+// ------------------------------------------
+// HiZPyramidImpl
+
+HiZPyramidImpl::HiZPyramidImpl(const std::string& name, uint32_t w, uint32_t h) : name(name), levels(0) {
+    resize(w, h);
+}
+
+HiZPyramidImpl::~HiZPyramidImpl() {}
+
+void HiZPyramidImpl::resize(uint32_t w, uint32_t h) {
+    if (texture) Texture2D::erase(texture->name);
+    texture = Texture2D(name + "_texture", w, h, GL_R32F, GL_RED, GL_FLOAT, nullptr, true);
+    levels = 1 + uint32_t(std::floor(std::log2(float(std::max(w, h)))));
+    // point sampling of single levels
+    if (has_direct_state_access()) {
+        glTextureParameteri(texture->id, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTextureParameteri(texture->id, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTextureParameteri(texture->id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(texture->id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    } else {
+        GLState::bind_texture(GL_TEXTURE_2D, texture->id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        GLState::unbind_texture(GL_TEXTURE_2D, texture->id);
+    }
+}
+
+void HiZPyramidImpl::build(const Texture2D& depth) const {
+    const Shader shader = hiz_shader();
+    shader->bind();
+    for (uint32_t level = 0; level < levels; ++level) {
+        // level 0 is a copy of the depth texture, every further level reduces the previous one
+        if (level == 0) {
+            shader->uniform("src", depth, 0);
+            shader->uniform("src_level", 0);
+        } else {
+            shader->uniform("src", texture, 0);
+            shader->uniform("src_level", int(level - 1));
+        }
+        glBindImageTexture(0, texture->id, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        shader->dispatch_compute(std::max(texture->w >> level, 1), std::max(texture->h >> level, 1), 1, GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    shader->unbind();
+}
+
+// ------------------------------------------
+// GPU culling
+
+void cull_draw_commands(GLuint commands, GLuint draw_data, GLuint bounds, GLuint visible_commands, GLuint count_buffer,
+        uint32_t num_draws, const HiZPyramid& hiz) {
+    if (num_draws == 0) return;
+    const Shader shader = cull_shader();
+    const Camera cam = current_camera();
+    const std::vector<SavedBinding> saved = save_bindings(4);
+    shader->bind();
+    shader->uniform("num_draws", num_draws);
+    shader->uniform("view_proj", cam->proj * cam->view);
+    shader->uniform("compact", count_buffer != 0 ? 1 : 0);
+    shader->uniform("use_hiz", hiz ? 1 : 0);
+    if (hiz)
+        shader->uniform("hiz", hiz->texture, 0);
+    if (count_buffer != 0)
+        reset_count_buffer(count_buffer);
+    GLState::bind_buffer_base(GL_SHADER_STORAGE_BUFFER, 0, commands);
+    GLState::bind_buffer_base(GL_SHADER_STORAGE_BUFFER, 1, draw_data);
+    GLState::bind_buffer_base(GL_SHADER_STORAGE_BUFFER, 2, bounds);
+    GLState::bind_buffer_base(GL_SHADER_STORAGE_BUFFER, 3, visible_commands);
+    shader->dispatch_compute(num_draws, 1, 1, GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT);
+    shader->unbind();
+    restore_bindings(saved);
+}
+
+void cull_meshlets(const std::vector<MeshletCullJob>& jobs) {
+    if (std::none_of(jobs.begin(), jobs.end(), [](const MeshletCullJob& job) { return job.num_meshlets > 0; })) return;
+    const Shader shader = meshlet_cull_shader();
+    const Camera cam = current_camera();
+    // world space frustum planes (Gribb/Hartmann), normalized for sphere tests
+    const glm::mat4 view_proj = cam->proj * cam->view;
+    const auto row = [&](int i) { return glm::vec4(view_proj[0][i], view_proj[1][i], view_proj[2][i], view_proj[3][i]); };
+    const glm::vec4 planes[6] = { row(3) + row(0), row(3) - row(0), row(3) + row(1), row(3) - row(1), row(3) + row(2), row(3) - row(2) };
+    const std::vector<SavedBinding> saved = save_bindings(2);
+    shader->bind();
+    for (int i = 0; i < 6; ++i)
+        shader->uniform("frustum[" + std::to_string(i) + "]", planes[i] / glm::length(glm::vec3(planes[i])));
+    shader->uniform("perspective", cam->perspective ? 1 : 0);
+    // jobs write disjoint buffers, so a single barrier after all dispatches suffices
+    for (const auto& job : jobs) {
+        if (job.num_meshlets == 0) continue;
+        shader->uniform("num_meshlets", job.num_meshlets);
+        shader->uniform("model", job.model);
+        shader->uniform("radius_scale", std::max(glm::length(glm::vec3(job.model[0])), std::max(glm::length(glm::vec3(job.model[1])), glm::length(glm::vec3(job.model[2])))));
+        const glm::mat4 model_inv = glm::inverse(job.model);
+        shader->uniform("cam_pos_local", glm::vec3(model_inv * glm::vec4(cam->pos, 1)));
+        shader->uniform("view_dir_local", glm::normalize(glm::vec3(model_inv * glm::vec4(cam->dir, 0))));
+        shader->uniform("index_offset", job.first_index);
+        shader->uniform("base_vertex", int(job.base_vertex));
+        shader->uniform("compact", job.count_buffer != 0 ? 1 : 0);
+        if (job.count_buffer != 0)
+            reset_count_buffer(job.count_buffer);
+        GLState::bind_buffer_base(GL_SHADER_STORAGE_BUFFER, 0, job.meshlets);
+        GLState::bind_buffer_base(GL_SHADER_STORAGE_BUFFER, 1, job.commands);
+        shader->dispatch_compute(job.num_meshlets, 1, 1, 0);
+    }
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT);
+    shader->unbind();
+    restore_bindings(saved);
+}
+
+void cull_meshlets(GLuint meshlets, GLuint commands, GLuint count_buffer, uint32_t num_meshlets, const glm::mat4& model,
+        uint32_t first_index, int32_t base_vertex) {
+    cull_meshlets(std::vector<MeshletCullJob>{ MeshletCullJob{ meshlets, commands, count_buffer, num_meshlets, model, first_index, base_vertex } });
+}
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include <GL/gl.h>
+#include <glm/glm.hpp>
+#include "named_handle.h"
+#include "texture.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// HiZPyramid (mip chain of max depth values for occlusion culling)
+
+class HiZPyramidImpl {
+public:
+    HiZPyramidImpl(const std::string& name, uint32_t w, uint32_t h);
+    virtual ~HiZPyramidImpl();
+
+    // rebuild all levels from a depth texture (usually the previous frame's, of the same size)
+    void build(const Texture2D& depth) const;
+    void resize(uint32_t w, uint32_t h);
+
+    // data
+    const std::string name;
+    Texture2D texture;  // GL_R32F, full mip chain
+    uint32_t levels;
+};
+
+using HiZPyramid = NamedHandle<HiZPyramidImpl>;
+template class _API NamedHandle<HiZPyramidImpl>; //needed for Windows DLL export
+
+// ------------------------------------------
+// GPU culling of indirect draw commands
+
+// Tests the bounds of each draw command against the current camera frustum (and the Hi-Z pyramid, if given) in a compute pass.
+// Inputs are buffers of DrawElementsIndirectCommand, DrawBucketImpl::DrawData and per-draw local AABBs (vec4 min, vec4 max; max.w = 0 disables culling).
+// If count_buffer is non-zero, visible commands are compacted into visible_commands and counted in count_buffer (reset here),
+// otherwise visible_commands mirrors commands with instance_count set to 0 for culled draws.
+void cull_draw_commands(GLuint commands, GLuint draw_data, GLuint bounds, GLuint visible_commands, GLuint count_buffer,
+        uint32_t num_draws, const HiZPyramid& hiz = HiZPyramid());
+
+// Tests each GeometryImpl::Meshlet against the current camera frustum (bounding sphere, transformed by model) and its normal cone (backfacing),
+// writing one DrawElementsIndirectCommand per meshlet with first_index/base_vertex offset by the given values (location of the mesh in its buffers).
+// Compaction via count_buffer works as in cull_draw_commands(). The normal cone test assumes a uniformly scaled model matrix.
+void cull_meshlets(GLuint meshlets, GLuint commands, GLuint count_buffer, uint32_t num_meshlets, const glm::mat4& model,
+        uint32_t first_index = 0, int32_t base_vertex = 0);
+// arguments of one cull_meshlets() call
+struct MeshletCullJob {
+    GLuint meshlets, commands, count_buffer;
+    uint32_t num_meshlets;
+    glm::mat4 model;
+    uint32_t first_index;
+    int32_t base_vertex;
+};
+// cull many meshes with one program bind and a single barrier (commands and count buffers of the jobs must be distinct)
+void cull_meshlets(const std::vector<MeshletCullJob>& jobs);
+
+// Both culling passes unbind the current program, indexed buffer bindings they use are restored.
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,159 @@
+#include "draw_bucket.h"
+#include "camera.h"
+#include "capabilities.h"
+#include "state.h"
+#include <GL/glew.h>
+#include <algorithm>
+#include <stdexcept>
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// helper funcs
+
+// grow buffer geometrically to hold at least size_bytes (discards contents)
+template <GLenum T> static void reserve(NamedHandle<GLBufferImpl<T>>& buf, size_t size_bytes) {
+    if (buf->size_bytes < size_bytes)
+        buf->resize(std::max(size_bytes, 2 * buf->size_bytes));
+}
+
+// ------------------------------------------
+// DrawBucketImpl
+
+DrawBucketImpl::DrawBucketImpl(const std::string& name, const Shader& shader, const GeometryArena& arena)
+    : name(name), shader(shader), arena(arena), commands(name + "_commands"), draw_data(name + "_draw_data"), bounds(name + "_bounds"),
+    visible_commands(name + "_visible_commands"), visible_count(name + "_visible_count", sizeof(uint32_t)), dirty(true), arena_generation(0) {}
+
+DrawBucketImpl::~DrawBucketImpl() {}
+
+void DrawBucketImpl::add(const Drawelement& elem) {
+    if (!elem->mesh || elem->mesh->arena.ptr != arena.ptr)
+        throw std::runtime_error("DrawBucket " + name + ": mesh of drawelement " + elem->name + " is not stored in arena " + arena->name);
+    if (!elements.empty() && elem->mesh->primitive_type != elements[0]->mesh->primitive_type)
+        throw std::runtime_error("DrawBucket " + name + ": primitive type of drawelement " + elem->name + " does not match");
+    elements.push_back(elem);
+    arena->reserve_draw_ids(uint32_t(elements.size()));
+    dirty = true;
+}
+
+void DrawBucketImpl::remove(const Drawelement& elem) {
+    auto it = std::find_if(elements.begin(), elements.end(), [&](const Drawelement& e) { return e.ptr == elem.ptr; });
+    if (it == elements.end()) return;
+    *it = elements.back();
+    elements.pop_back();
+    dirty = true;
+}
+
+void DrawBucketImpl::clear() {
+    elements.clear();
+    dirty = true;
+}
+
+void DrawBucketImpl::invalidate() {
+    dirty = true;
+}
+
+void DrawBucketImpl::upload() const {
+    const uint32_t num_draws = uint32_t(elements.size());
+    if (dirty || arena_generation != arena->generation) {
+        // ranges moved (relocation, mesh re-upload) or elements changed: rebuild everything
+        command_cache.resize(num_draws);
+        data_cache.resize(num_draws);
+        bounds_cache.resize(2 * num_draws);
+        for (uint32_t i = 0; i < num_draws; ++i) {
+            const DrawelementImpl& elem = *elements[i];
+            const GeometryRange& r = arena->range(elem.mesh->arena_alloc);
+            command_cache[i] = DrawElementsIndirectCommand{ r.num_indices, 1, r.first_index, int32_t(r.base_vertex), i };
+            data_cache[i] = DrawData{ elem.model, elem.model_normal(), glm::vec4(0) };
+            const Geometry& geometry = elem.mesh->geometry;
+            bounds_cache[2 * i + 0] = geometry ? glm::vec4(geometry->bb_min, 1) : glm::vec4(0);
+            bounds_cache[2 * i + 1] = geometry ? glm::vec4(geometry->bb_max, 1) : glm::vec4(0); // w = 0: never culled
+        }
+        reserve(commands, num_draws * sizeof(DrawElementsIndirectCommand));
+        reserve(visible_commands, num_draws * sizeof(DrawElementsIndirectCommand));
+        reserve(draw_data, num_draws * sizeof(DrawData));
+        reserve(bounds, bounds_cache.size() * sizeof(glm::vec4));
+        commands->upload_subdata(command_cache.data(), 0, num_draws * sizeof(DrawElementsIndirectCommand));
+        draw_data->upload_subdata(data_cache.data(), 0, num_draws * sizeof(DrawData));
+        bounds->upload_subdata(bounds_cache.data(), 0, bounds_cache.size() * sizeof(glm::vec4));
+        arena_generation = arena->generation;
+        dirty = false;
+        return;
+    }
+    // transforms may change every frame: compare against the cache and upload the changed span only
+    uint32_t first = num_draws, last = 0;
+    for (uint32_t i = 0; i < num_draws; ++i) {
+        const DrawelementImpl& elem = *elements[i];
+        if (elem.model == data_cache[i].model) continue;
+        data_cache[i].model = elem.model;
+        data_cache[i].model_normal = elem.model_normal();
+        first = std::min(first, i);
+        last = i;
+    }
+    if (first < num_draws)
+        draw_data->upload_subdata(&data_cache[first], first * sizeof(DrawData), (last - first + 1) * sizeof(DrawData));
+}
+
+void DrawBucketImpl::bind_for_draw() const {
+    shader->bind();
+    if (!shader->uses_camera_block) {
+        // legacy path for shaders without the Camera uniform block
+        const Camera cam = current_camera();
+        shader->uniform("view", cam->view);
+        shader->uniform("view_normal", cam->view_normal);
+        shader->uniform("proj", cam->proj);
+    }
+    arena->bind();
+    draw_data->bind_base(ssbo_binding);
+}
+
+void DrawBucketImpl::unbind_for_draw() const {
+    arena->unbind();
+    shader->unbind();
+}
+
+void DrawBucketImpl::draw() const {
+    if (elements.empty() || !shader) return;
+    upload();
+    const uint32_t num_draws = uint32_t(elements.size());
+    const GLenum primitive_type = elements[0]->mesh->primitive_type, index_type = arena->index_type;
+    bind_for_draw();
+    if (has_multi_draw_indirect()) {
+        commands->bind();
+        glMultiDrawElementsIndirect(primitive_type, index_type, 0, num_draws, 0);
+        commands->unbind();
+    } else {
+        // fallback for GL < 4.3: same commands, one call each
+        for (const auto& cmd : command_cache)
+            glDrawElementsInstancedBaseVertexBaseInstance(primitive_type, cmd.count, index_type,
+                    (void*)(size_t(cmd.first_index) * index_type_size(index_type)), cmd.instance_count, cmd.base_vertex, cmd.base_instance);
+    }
+    unbind_for_draw();
+}
+
+void DrawBucketImpl::draw_culled(const HiZPyramid& hiz) const {
+    // compute shaders and indirect draws both require GL 4.3
+    if (!has_multi_draw_indirect()) return draw();
+    if (elements.empty() || !shader) return;
+    upload();
+    const uint32_t num_draws = uint32_t(elements.size());
+    const GLenum primitive_type = elements[0]->mesh->primitive_type, index_type = arena->index_type;
+    // without indirect count, culled commands are kept with zero instances instead of being compacted
+    const bool compact = has_indirect_draw_count();
+    cull_draw_commands(commands->id, draw_data->id, bounds->id, visible_commands->id, compact ? visible_count->id : 0, num_draws, hiz);
+    bind_for_draw();
+    visible_commands->bind();
+    if (compact) {
+        GLState::bind_buffer(GL_PARAMETER_BUFFER, visible_count->id);
+        if (GLEW_VERSION_4_6)
+            glMultiDrawElementsIndirectCount(primitive_type, index_type, 0, 0, num_draws, 0);
+        else
+            glMultiDrawElementsIndirectCountARB(primitive_type, index_type, 0, 0, num_draws, 0);
+        GLState::unbind_buffer(GL_PARAMETER_BUFFER);
+    } else
+        glMultiDrawElementsIndirect(primitive_type, index_type, 0, num_draws, 0);
+    visible_commands->unbind();
+    unbind_for_draw();
+}
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "named_handle.h"
+#include "buffer.h"
+#include "shader.h"
+#include "drawelement.h"
+#include "geometry_arena.h"
+#include "culling.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// DrawBucket (all drawelements of one shader and arena, submitted with a single multi draw indirect call)
+
+// layout of glMultiDrawElementsIndirect commands
+struct DrawElementsIndirectCommand {
+    uint32_t count;
+    uint32_t instance_count;
+    uint32_t first_index;
+    int32_t base_vertex;
+    uint32_t base_instance; // used as draw id
+};
+
+class DrawBucketImpl {
+public:
+    // per-draw data, std430 layout of the Draws buffer in <cppgl/multidraw.glsl>
+    struct DrawData {
+        glm::mat4 model;
+        glm::mat4 model_normal;
+        glm::vec4 data;
+    };
+
+    DrawBucketImpl(const std::string& name, const Shader& shader, const GeometryArena& arena);
+    virtual ~DrawBucketImpl();
+
+    // drawelement meshes must be stored in this bucket's arena, drawelement shaders and materials are ignored
+    void add(const Drawelement& elem);
+    void remove(const Drawelement& elem);
+    void clear();
+    // force a rebuild of draw commands and bounds (changes of the arena and of drawelement transforms are picked up automatically)
+    void invalidate();
+
+    // draw all at once
+    void draw() const;
+    // cull against the current camera frustum (and hiz, if given) on the GPU, then draw the survivors all at once
+    void draw_culled(const HiZPyramid& hiz = HiZPyramid()) const;
+
+    // shader storage binding point of the Draws buffer
+    static constexpr uint32_t ssbo_binding = 2;
+
+    // data
+    const std::string name;
+    Shader shader;
+    GeometryArena arena;
+    std::vector<Drawelement> elements;
+    mutable DIBO commands;
+    mutable SSBO draw_data;
+    mutable SSBO bounds;                // per-draw local AABB (vec4 min, vec4 max)
+    mutable DIBO visible_commands;      // output of culling
+    mutable ACBO visible_count;         // number of visible commands (if compacted)
+
+private:
+    // upload commands and bounds if invalid or the arena changed, per-draw data of changed transforms
+    void upload() const;
+    void bind_for_draw() const;
+    void unbind_for_draw() const;
+
+    mutable bool dirty;
+    mutable uint32_t arena_generation;  // GeometryArenaImpl::generation of command_cache
+    mutable std::vector<DrawElementsIndirectCommand> command_cache;
+    mutable std::vector<DrawData> data_cache;
+    mutable std::vector<glm::vec4> bounds_cache;
+};
+
+using DrawBucket = NamedHandle<DrawBucketImpl>;
+template class _API NamedHandle<DrawBucketImpl>; //needed for Windows DLL export
+
+CPPGL_NAMESPACE_END
@@ -1,11 +1,18 @@
 #include "drawelement.h"
 #include "camera.h"
+#include "context.h"
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
 
 CPPGL_NAMESPACE_BEGIN
 
+float DrawelementImpl::default_lod_pixel_error = 1.f;
+float DrawelementImpl::lod_hysteresis = 0.25f;
+
 DrawelementImpl::DrawelementImpl(const std::string& name, const Shader& shader, const Mesh& mesh)
-    : name(name), model(glm::mat4(1)), shader(shader), mesh(mesh) {}
+    : name(name), model(glm::mat4(1)), shader(shader), mesh(mesh), lod_pixel_error(default_lod_pixel_error),
+    cached_model(glm::mat4(1)), cached_model_normal(glm::mat4(1)) {}
 
 DrawelementImpl::~DrawelementImpl() {}
 
@@ -14,11 +21,43 @@ void DrawelementImpl::bind() const {
         shader->bind();
         if (mesh) mesh->bind(shader);
         shader->uniform("model", model);
-        shader->uniform("model_normal", glm::transpose(glm::inverse(model)));
-        shader->uniform("view", current_camera()->view);
-        shader->uniform("view_normal", current_camera()->view_normal);
-        shader->uniform("proj", current_camera()->proj);
+        shader->uniform("model_normal", model_normal());
+        if (!shader->uses_camera_block) {
+            // legacy path for shaders without the Camera uniform block
+            const Camera cam = current_camera();
+            shader->uniform("view", cam->view);
+            shader->uniform("view_normal", cam->view_normal);
+            shader->uniform("proj", cam->proj);
+        }
+    }
+}
+
+const glm::mat4& DrawelementImpl::model_normal() const {
+    if (model != cached_model) {
+        cached_model = model;
+        cached_model_normal = glm::transpose(glm::inverse(model));
+    }
+    return cached_model_normal;
+}
+
+uint32_t DrawelementImpl::select_lod() const {
+    if (!mesh || mesh->num_lods() <= 1 || !mesh->geometry) return 0;
+    const Camera cam = current_camera();
+    // pixels per object space unit at the bounding sphere (proj[1][1] = 2 / frustum height at distance 1)
+    const glm::vec3 center = glm::vec3(model * glm::vec4((mesh->geometry->bb_min + mesh->geometry->bb_max) * 0.5f, 1));
+    const float radius = glm::length(mesh->geometry->bb_max - mesh->geometry->bb_min) * 0.5f;
+    const float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    float pixels_per_unit = scale * cam->proj[1][1] * 0.5f * float(Context::resolution().y);
+    if (cam->perspective)
+        pixels_per_unit /= std::max(glm::length(center - cam->pos) - radius * scale, cam->near);
+    // coarsest level within the (hysteresis adjusted) threshold
+    uint32_t& lod = lods[cam->name];
+    for (uint32_t i = mesh->num_lods() - 1; i > 0; --i) {
+        const float threshold = lod_pixel_error * (i > lod ? 1.f - lod_hysteresis : 1.f + lod_hysteresis);
+        if (mesh->lods[i].error * pixels_per_unit <= threshold)
+            return lod = i;
     }
+    return lod = 0;
 }
 
 void DrawelementImpl::unbind() const {
@@ -27,8 +66,153 @@ void DrawelementImpl::unbind() const {
 }
 
 void DrawelementImpl::draw() const {
-    if (mesh)
-        mesh->draw();
+    if (!mesh) return;
+    if (mesh->has_meshlets() && MeshImpl::meshlet_culling)
+        mesh->draw_meshlets();
+    else
+        mesh->draw(select_lod());
+}
+
+void DrawelementImpl::cull_meshlets(const std::vector<Drawelement>& elements) {
+    if (!MeshImpl::meshlet_culling) return;
+    std::vector<MeshletCullJob> jobs;
+    for (const auto& elem : elements)
+        if (elem->mesh && elem->mesh->has_meshlets())
+            jobs.push_back(elem->mesh->meshlet_cull_job(elem->model));
+    cppgl::cull_meshlets(jobs);
+}
+
+// -----------------------------------------------
+// InstancedDrawelementImpl
+
+static const uint32_t INVALID_INDEX = uint32_t(-1);
+// dirty runs separated by fewer clean instances than this are merged into one upload
+static const uint32_t MERGE_GAP = 16;
+
+static InstancedDrawelementImpl::Instance make_instance(const glm::mat4& model, const glm::vec4& data) {
+    return InstancedDrawelementImpl::Instance{ model, glm::transpose(glm::inverse(model)), data };
+}
+
+InstancedDrawelementImpl::InstancedDrawelementImpl(const std::string& name, const Shader& shader, const Mesh& mesh, uint32_t capacity)
+    : name(name), shader(shader), mesh(mesh), ssbo(name + "_instances", std::max(capacity, 1u) * sizeof(Instance)), capacity(std::max(capacity, 1u)) {}
+
+InstancedDrawelementImpl::~InstancedDrawelementImpl() {}
+
+InstancedDrawelementImpl::InstanceID InstancedDrawelementImpl::add(const glm::mat4& model, const glm::vec4& data) {
+    InstanceID id;
+    if (!free_ids.empty()) {
+        id = free_ids.back();
+        free_ids.pop_back();
+    } else {
+        id = InstanceID(id_to_index.size());
+        id_to_index.push_back(INVALID_INDEX);
+    }
+    const uint32_t index = size();
+    instances.push_back(make_instance(model, data));
+    index_to_id.push_back(id);
+    id_to_index[id] = index;
+    mark_dirty(index);
+    return id;
+}
+
+void InstancedDrawelementImpl::update(InstanceID id, const glm::mat4& model) {
+    update(id, model, get(id).data);
+}
+
+void InstancedDrawelementImpl::update(InstanceID id, const glm::mat4& model, const glm::vec4& data) {
+    get(id); // check id
+    const uint32_t index = id_to_index[id];
+    instances[index] = make_instance(model, data);
+    mark_dirty(index);
+}
+
+void InstancedDrawelementImpl::remove(InstanceID id) {
+    get(id); // check id
+    // move last instance into the gap to keep the array dense
+    const uint32_t index = id_to_index[id], last = size() - 1;
+    if (index != last) {
+        instances[index] = instances[last];
+        index_to_id[index] = index_to_id[last];
+        id_to_index[index_to_id[index]] = index;
+        mark_dirty(index);
+    }
+    instances.pop_back();
+    index_to_id.pop_back();
+    id_to_index[id] = INVALID_INDEX;
+    free_ids.push_back(id);
+}
+
+void InstancedDrawelementImpl::clear() {
+    instances.clear();
+    index_to_id.clear();
+    id_to_index.clear();
+    free_ids.clear();
+    dirty.clear();
+    is_dirty.clear();
+}
+
+const InstancedDrawelementImpl::Instance& InstancedDrawelementImpl::get(InstanceID id) const {
+    if (id >= id_to_index.size() || id_to_index[id] == INVALID_INDEX)
+        throw std::runtime_error("InstancedDrawelement " + name + ": invalid instance id " + std::to_string(id));
+    return instances[id_to_index[id]];
+}
+
+void InstancedDrawelementImpl::mark_dirty(uint32_t index) {
+    if (index >= is_dirty.size())
+        is_dirty.resize(std::max<size_t>(index + 1, 2 * is_dirty.size()), 0);
+    if (!is_dirty[index]) {
+        is_dirty[index] = 1;
+        dirty.push_back(index);
+    }
+}
+
+void InstancedDrawelementImpl::flush() const {
+    if (size() > capacity) {
+        // grow geometrically and upload everything once
+        while (capacity < size()) capacity *= 2;
+        ssbo->resize(capacity * sizeof(Instance));
+        ssbo->upload_subdata(instances.data(), 0, instances.size() * sizeof(Instance));
+    } else if (!dirty.empty()) {
+        // upload coalesced runs of changed instances
+        std::sort(dirty.begin(), dirty.end());
+        size_t run_begin = 0;
+        for (size_t i = 1; i <= dirty.size(); ++i) {
+            if (i < dirty.size() && dirty[i] - dirty[i - 1] <= MERGE_GAP) continue;
+            const uint32_t from = dirty[run_begin], to = std::min(dirty[i - 1] + 1, size());
+            if (from < to)
+                ssbo->upload_subdata(&instances[from], from * sizeof(Instance), (to - from) * sizeof(Instance));
+            run_begin = i;
+        }
+    }
+    for (uint32_t index : dirty)
+        is_dirty[index] = 0;
+    dirty.clear();
+}
+
+void InstancedDrawelementImpl::bind() const {
+    flush();
+    if (shader) {
+        shader->bind();
+        if (mesh) mesh->bind(shader);
+        ssbo->bind_base(ssbo_binding);
+        if (!shader->uses_camera_block) {
+            // legacy path for shaders without the Camera uniform block
+            const Camera cam = current_camera();
+            shader->uniform("view", cam->view);
+            shader->uniform("view_normal", cam->view_normal);
+            shader->uniform("proj", cam->proj);
+        }
+    }
+}
+
+void InstancedDrawelementImpl::unbind() const {
+    if (mesh) mesh->unbind();
+    if (shader) shader->unbind();
+}
+
+void InstancedDrawelementImpl::draw() const {
+    if (mesh && size() > 0)
+        mesh->draw_instanced(size());
 }
 
 CPPGL_NAMESPACE_END
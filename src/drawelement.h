@@ -18,14 +18,91 @@ public:
     void draw() const;
     void unbind() const;
 
+    // pre-pass for MeshImpl::meshlet_culling: cull the meshlets of all given drawelements against the current camera
+    // in one batch (unbinds the current program, so call before binding shaders)
+    static void cull_meshlets(const std::vector<NamedHandle<DrawelementImpl>>& elements);
+
+    // transpose(inverse(model)), recomputed only if model changed since the last call
+    const glm::mat4& model_normal() const;
+
+    // select the coarsest mesh LOD whose error projected by the current camera stays below lod_pixel_error.
+    // switching to a coarser level requires (1 - lod_hysteresis) times that, leaving the current one (1 + lod_hysteresis) times.
+    // the level drawn last is tracked per camera, so passes with different views do not disturb each other's hysteresis
+    uint32_t select_lod() const;
+
     // data
     const std::string name;
     glm::mat4 model;
     Shader shader;
     Mesh mesh;
+    float lod_pixel_error;      // screen space error threshold in pixels
+
+    // initial lod_pixel_error of new drawelements
+    static float default_lod_pixel_error;
+    static float lod_hysteresis;
+
+private:
+    mutable glm::mat4 cached_model, cached_model_normal;
+    mutable std::map<std::string, uint32_t> lods; // camera name -> level drawn last
 };
 
 using Drawelement = NamedHandle<DrawelementImpl>;
 template class _API NamedHandle<DrawelementImpl>; //needed for Windows DLL export
 
+// -----------------------------------------------
+// InstancedDrawelement (many instances of one mesh, drawn with a single instanced draw call)
+
+class InstancedDrawelementImpl {
+public:
+    // per-instance data, std430 layout of the Instances buffer in <cppgl/instancing.glsl>
+    struct Instance {
+        glm::mat4 model;
+        glm::mat4 model_normal;
+        glm::vec4 data;         // free for custom per-instance attributes
+    };
+    // stable handle to an instance (stays valid when other instances are removed)
+    using InstanceID = uint32_t;
+
+    InstancedDrawelementImpl(const std::string& name, const Shader& shader = Shader(), const Mesh& mesh = Mesh(), uint32_t capacity = 64);
+    virtual ~InstancedDrawelementImpl();
+
+    // instance handling (only changed instances are uploaded on the next bind())
+    InstanceID add(const glm::mat4& model, const glm::vec4& data = glm::vec4(0));
+    void update(InstanceID id, const glm::mat4& model);
+    void update(InstanceID id, const glm::mat4& model, const glm::vec4& data);
+    void remove(InstanceID id);
+    void clear();
+    const Instance& get(InstanceID id) const;
+    inline uint32_t size() const { return uint32_t(instances.size()); }
+
+    // bind flushes pending instance updates and binds the instance buffer to ssbo_binding
+    void bind() const;
+    void draw() const;
+    void unbind() const;
+
+    // shader storage binding point of the Instances buffer
+    static constexpr uint32_t ssbo_binding = 1;
+
+    // data
+    const std::string name;
+    Shader shader;
+    Mesh mesh;
+    mutable SSBO ssbo; // instance data, refreshed lazily in bind()
+
+private:
+    void mark_dirty(uint32_t index);
+    void flush() const;
+
+    std::vector<Instance> instances;        // densely packed, mirrors the SSBO contents
+    std::vector<InstanceID> index_to_id;    // dense index -> instance id
+    std::vector<uint32_t> id_to_index;      // instance id -> dense index (or UINT32_MAX if free)
+    std::vector<InstanceID> free_ids;
+    mutable std::vector<uint32_t> dirty;    // dense indices changed since the last flush
+    mutable std::vector<uint8_t> is_dirty;
+    mutable uint32_t capacity;              // SSBO capacity in instances
+};
+
+using InstancedDrawelement = NamedHandle<InstancedDrawelementImpl>;
+template class _API NamedHandle<InstancedDrawelementImpl>; //needed for Windows DLL export
+
 CPPGL_NAMESPACE_END
@@ -1,33 +1,54 @@
 #include "framebuffer.h"
 #include <atomic>
+#include "capabilities.h"
+#include "state.h"
 
 CPPGL_NAMESPACE_BEGIN
 
+// ------------------------------------------
+// helper funcs
+
+static GLenum check_bound(GLuint id) {
+    GLState::bind_framebuffer(GL_FRAMEBUFFER, id);
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    GLState::bind_framebuffer(GL_FRAMEBUFFER, 0);
+    return status;
+}
+
+// ------------------------------------------
+// Framebuffer
+
 FramebufferImpl::FramebufferImpl(const std::string& name, uint32_t w, uint32_t h) : name(name), id(0), w(w), h(h), prev_vp{0,0,0,0} {
-    glGenFramebuffers(1, &id);
+    if (has_direct_state_access())
+        glCreateFramebuffers(1, &id);
+    else
+        glGenFramebuffers(1, &id);
 }
 
 FramebufferImpl::~FramebufferImpl() {
+    GLState::forget_framebuffer(id);
     glDeleteFramebuffers(1, &id);
 }
 
 void FramebufferImpl::bind() {
-    glGetIntegerv(GL_VIEWPORT, prev_vp);
-    glViewport(0, 0, w, h);
-    glBindFramebuffer(GL_FRAMEBUFFER, id);
-    glDrawBuffers(GLsizei(color_targets.size()), color_targets.data());
+    const glm::ivec4 vp = GLState::get_viewport();
+    prev_vp[0] = vp.x; prev_vp[1] = vp.y; prev_vp[2] = vp.z; prev_vp[3] = vp.w;
+    GLState::viewport(0, 0, w, h);
+    GLState::bind_framebuffer(GL_FRAMEBUFFER, id);
+    // with DSA, the draw buffers are stored in the framebuffer object on attachment
+    if (!has_direct_state_access())
+        glDrawBuffers(GLsizei(color_targets.size()), color_targets.data());
 }
 
 void FramebufferImpl::unbind() {
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(prev_vp[0], prev_vp[1], prev_vp[2], prev_vp[3]);
+    GLState::bind_framebuffer(GL_FRAMEBUFFER, 0);
+    GLState::viewport(prev_vp[0], prev_vp[1], prev_vp[2], prev_vp[3]);
 }
 
 void FramebufferImpl::check() const {
     if (!(depth_texture && *depth_texture))
         throw std::runtime_error("ERROR: Framebuffer: depth buffer not present or invalid!");
-    glBindFramebuffer(GL_FRAMEBUFFER, id);
-    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    const GLenum status = has_direct_state_access() ? glCheckNamedFramebufferStatus(id, GL_FRAMEBUFFER) : check_bound(id);
     if (status != GL_FRAMEBUFFER_COMPLETE) {
         std::string s;
         if (status == GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT)
@@ -40,7 +61,6 @@ void FramebufferImpl::check() const {
             s = "GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER";
         throw std::runtime_error("ERROR: Framebuffer incomplete! Status: " + s);
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void FramebufferImpl::resize(uint32_t w, uint32_t h) {
@@ -61,19 +81,28 @@ void FramebufferImpl::attach_depthbuffer(Texture2D tex, bool with_stencil) {
                                 with_stencil ? GL_DEPTH_STENCIL                  : GL_DEPTH_COMPONENT,
                                 with_stencil ? GL_FLOAT_32_UNSIGNED_INT_24_8_REV : GL_FLOAT);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, id);
     depth_texture = tex;
-    glFramebufferTexture2D(GL_FRAMEBUFFER, with_stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, tex->id, 0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (has_direct_state_access())
+        glNamedFramebufferTexture(id, with_stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, tex->id, 0);
+    else {
+        GLState::bind_framebuffer(GL_FRAMEBUFFER, id);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, with_stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, tex->id, 0);
+        GLState::bind_framebuffer(GL_FRAMEBUFFER, 0);
+    }
 }
 
 void FramebufferImpl::attach_colorbuffer(const Texture2D& tex) {
     const GLenum target = GL_COLOR_ATTACHMENT0 + GLenum(color_targets.size());
-    glBindFramebuffer(GL_FRAMEBUFFER, id);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, target, GL_TEXTURE_2D, tex->id, 0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
     color_textures.push_back(tex);
     color_targets.push_back(target);
+    if (has_direct_state_access()) {
+        glNamedFramebufferTexture(id, target, tex->id, 0);
+        glNamedFramebufferDrawBuffers(id, GLsizei(color_targets.size()), color_targets.data());
+    } else {
+        GLState::bind_framebuffer(GL_FRAMEBUFFER, id);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, target, GL_TEXTURE_2D, tex->id, 0);
+        GLState::bind_framebuffer(GL_FRAMEBUFFER, 0);
+    }
 }
 
 CPPGL_NAMESPACE_END
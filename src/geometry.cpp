@@ -79,6 +79,8 @@ void GeometryImpl::clear() {
     indices.clear();
     normals.clear();
     texcoords.clear();
+    lods.clear();
+    meshlets.clear();
 }
 
 void GeometryImpl::recompute_aabb() {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <cfloat>
 #include <glm/glm.hpp>
 #include "platform.h"
 #include <assimp/mesh.h>
@@ -37,6 +38,52 @@ public:
     void scale(const glm::vec3& by);
     void rotate(float angle_degrees, const glm::vec3& axis);
 
+    // merge vertices whose attributes match after snapping to a grid of the given cell size (0: bitwise equal),
+    // remaps indices and shrinks the vertex arrays, runs in parallel for large meshes. returns number of removed vertices
+    uint32_t weld(float position_eps = 1e-6f, float normal_eps = 1e-3f, float texcoord_eps = 1e-5f);
+    // vertex count from which weld() distributes work over all hardware threads
+    static uint32_t weld_parallel_threshold;
+
+    // triangle/vertex order optimization (triangle lists only, see geometry_optimize.cpp)
+    struct CacheStats {
+        float acmr; // average cache miss ratio: transformed vertices per triangle (optimum 0.5)
+        float atvr; // average transformed vertex ratio: transformed vertices per vertex (optimum 1.0)
+    };
+    // simulate a FIFO post-transform vertex cache over the current index order
+    CacheStats vertex_cache_stats(uint32_t cache_size = 16) const;
+    // reorder triangles for post-transform vertex cache locality (Forsyth)
+    void optimize_vertex_cache(uint32_t cache_size = 32);
+    // sort cache-coherent triangle clusters so that outward facing ones come first, reducing overdraw (call after optimize_vertex_cache)
+    void optimize_overdraw();
+    // reorder vertex arrays by first use in the index buffer and drop unreferenced vertices
+    void optimize_vertex_fetch();
+    // all of the above, optionally printing ACMR/ATVR before and after
+    void optimize(bool verbose = true);
+
+    // level of detail: index list over the same vertices, error is the object space distance to the full mesh
+    struct Lod {
+        std::vector<uint32_t> indices;
+        float error;
+    };
+    // quadric error metric edge collapse on source (triangle list over this geometry's vertices, vertices are kept in place).
+    // stops at target_index_count or before exceeding target_error, returns the simplified indices (see geometry_simplify.cpp)
+    std::vector<uint32_t> simplify(const std::vector<uint32_t>& source, uint32_t target_index_count, float target_error = FLT_MAX, float* result_error = nullptr) const;
+    // build up to max_lods levels, each with about reduction times the triangles of the previous one
+    void build_lods(uint32_t max_lods = 4, float reduction = 0.5f, float max_error = FLT_MAX);
+
+    // cluster of triangles with culling bounds, std430 layout of the meshlet buffer used by cull_meshlets()
+    struct Meshlet {
+        glm::vec4 sphere;       // xyz: center, w: radius
+        glm::vec4 cone;         // xyz: normal cone axis, w: cutoff (1: never backface culled)
+        uint32_t first_index;
+        uint32_t num_indices;
+        uint32_t num_vertices;
+        uint32_t pad;
+    };
+    // split into meshlets of at most max_vertices/max_triangles (reorders indices, each meshlet is a contiguous index range).
+    // call last, any later change of indices or positions invalidates the meshlets
+    void build_meshlets(uint32_t max_vertices = 64, uint32_t max_triangles = 124);
+
     // data
     const std::string name;
     glm::vec3 bb_min, bb_max;
@@ -44,6 +91,8 @@ public:
     std::vector<uint32_t> indices;
     std::vector<glm::vec3> normals;
     std::vector<glm::vec2> texcoords;
+    std::vector<Lod> lods;          // coarser levels, empty unless build_lods() was called
+    std::vector<Meshlet> meshlets;  // empty unless build_meshlets() was called
 };
 
 using Geometry = NamedHandle<GeometryImpl>;
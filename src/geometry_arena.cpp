@@ -0,0 +1,312 @@
+#include "geometry_arena.h"
+#include "capabilities.h"
+#include "state.h"
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// helper funcs
+
+static void copy_buffer(GLuint src, GLuint dst, size_t src_offset, size_t dst_offset, size_t size_bytes) {
+    if (has_direct_state_access())
+        glCopyNamedBufferSubData(src, dst, src_offset, dst_offset, size_bytes);
+    else {
+        GLState::bind_buffer(GL_COPY_READ_BUFFER, src);
+        GLState::bind_buffer(GL_COPY_WRITE_BUFFER, dst);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src_offset, dst_offset, size_bytes);
+        GLState::unbind_buffer(GL_COPY_READ_BUFFER);
+        GLState::unbind_buffer(GL_COPY_WRITE_BUFFER);
+    }
+}
+
+// copy ranges of elements [offset, offset + count) from src to dst, tightly packed in the given order (merges adjacent ranges)
+static void copy_packed(GLuint src, GLuint dst, size_t element_size, const std::vector<std::pair<uint32_t, uint32_t>>& ranges) {
+    size_t run_src = 0, run_dst = 0, run_len = 0, dst_offset = 0;
+    for (const auto& range : ranges) {
+        if (run_len > 0 && range.first == run_src + run_len)
+            run_len += range.second;
+        else {
+            if (run_len > 0) copy_buffer(src, dst, run_src * element_size, run_dst * element_size, run_len * element_size);
+            run_src = range.first;
+            run_dst = dst_offset;
+            run_len = range.second;
+        }
+        dst_offset += range.second;
+    }
+    if (run_len > 0) copy_buffer(src, dst, run_src * element_size, run_dst * element_size, run_len * element_size);
+}
+
+// ------------------------------------------
+// index type helpers
+
+uint32_t index_type_size(GLenum index_type) {
+    switch (index_type) {
+    case GL_UNSIGNED_BYTE:
+        return 1;
+    case GL_UNSIGNED_SHORT:
+        return 2;
+    case GL_UNSIGNED_INT:
+        return 4;
+    default:
+        throw std::runtime_error("Unknown GL index type!");
+    }
+}
+
+GLenum smallest_index_type(uint32_t max_index, bool allow_byte) {
+    if (allow_byte && max_index <= 0xFF) return GL_UNSIGNED_BYTE;
+    if (max_index <= 0xFFFF) return GL_UNSIGNED_SHORT;
+    return GL_UNSIGNED_INT;
+}
+
+std::vector<uint8_t> convert_indices(const uint32_t* indices, uint32_t count, GLenum index_type) {
+    std::vector<uint8_t> bytes(size_t(count) * index_type_size(index_type));
+    if (index_type == GL_UNSIGNED_BYTE)
+        std::copy(indices, indices + count, bytes.begin());
+    else if (index_type == GL_UNSIGNED_SHORT)
+        std::copy(indices, indices + count, (uint16_t*)bytes.data());
+    else
+        std::copy(indices, indices + count, (uint32_t*)bytes.data());
+    return bytes;
+}
+
+// ------------------------------------------
+// RangeAllocator
+
+RangeAllocator::RangeAllocator(uint32_t capacity) {
+    reset(capacity);
+}
+
+uint32_t RangeAllocator::allocate(uint32_t count) {
+    for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+        if (it->second < count) continue;
+        const uint32_t offset = it->first, remaining = it->second - count;
+        free_ranges.erase(it);
+        if (remaining > 0)
+            free_ranges[offset + count] = remaining;
+        used += count;
+        return offset;
+    }
+    return INVALID;
+}
+
+void RangeAllocator::free(uint32_t offset, uint32_t count) {
+    auto it = free_ranges.emplace(offset, count).first;
+    // merge with successor
+    auto next = std::next(it);
+    if (next != free_ranges.end() && it->first + it->second == next->first) {
+        it->second += next->second;
+        free_ranges.erase(next);
+    }
+    // merge with predecessor
+    if (it != free_ranges.begin()) {
+        auto prev = std::prev(it);
+        if (prev->first + prev->second == it->first) {
+            prev->second += it->second;
+            free_ranges.erase(it);
+        }
+    }
+    used -= count;
+}
+
+void RangeAllocator::reset(uint32_t capacity, uint32_t used) {
+    this->capacity = capacity;
+    this->used = used;
+    free_ranges.clear();
+    if (capacity > used)
+        free_ranges[used] = capacity - used;
+}
+
+// ------------------------------------------
+// GeometryArenaImpl
+
+GeometryArenaImpl::GeometryArenaImpl(const std::string& name, uint32_t vertex_capacity, uint32_t index_capacity, GLenum index_type)
+    : name(name), vao(0), index_type(index_type), vertex_alloc(std::max(vertex_capacity, 1u)), index_alloc(std::max(index_capacity, 1u)),
+    num_draw_ids(0), generation(0) {
+    if (has_direct_state_access())
+        glCreateVertexArrays(1, &vao);
+    else
+        glGenVertexArrays(1, &vao);
+    positions = VBO(name + "_positions_0", size_t(vertex_alloc.capacity) * sizeof(glm::vec3));
+    normals = VBO(name + "_normals_0", size_t(vertex_alloc.capacity) * sizeof(glm::vec3));
+    texcoords = VBO(name + "_texcoords_0", size_t(vertex_alloc.capacity) * sizeof(glm::vec2));
+    indices = IBO(name + "_indices_0", size_t(index_alloc.capacity) * index_type_size(index_type));
+    draw_ids = VBO(name + "_draw_ids");
+    reserve_draw_ids(1024);
+    setup_vertex_array();
+}
+
+GeometryArenaImpl::~GeometryArenaImpl() {
+    GLState::forget_vertex_array(vao);
+    glDeleteVertexArrays(1, &vao);
+}
+
+uint32_t GeometryArenaImpl::allocate(const GeometryImpl& geometry) {
+    const uint32_t num_vertices = uint32_t(geometry.positions.size()), num_indices = uint32_t(geometry.indices.size());
+    if (num_vertices == 0 || num_indices == 0)
+        throw std::runtime_error("GeometryArena::allocate: empty geometry " + geometry.name);
+    // indices are relative to base_vertex, so each mesh has to fit the range of the index type (0xFF, 0xFFFF or 0xFFFFFFFF)
+    const uint64_t max_index = (uint64_t(1) << (8 * index_type_size(index_type))) - 1;
+    if (uint64_t(num_vertices - 1) > max_index)
+        throw std::runtime_error("GeometryArena::allocate: geometry " + geometry.name + " has too many vertices for the index type of arena " + name);
+    uint32_t base_vertex = vertex_alloc.allocate(num_vertices);
+    uint32_t first_index = index_alloc.allocate(num_indices);
+    if (base_vertex == RangeAllocator::INVALID || first_index == RangeAllocator::INVALID) {
+        // roll back and make room (relocation packs all live ranges, so the free space is contiguous afterwards)
+        if (base_vertex != RangeAllocator::INVALID) vertex_alloc.free(base_vertex, num_vertices);
+        if (first_index != RangeAllocator::INVALID) index_alloc.free(first_index, num_indices);
+        uint32_t vertex_capacity = vertex_alloc.capacity, index_capacity = index_alloc.capacity;
+        while (vertex_alloc.used + num_vertices > vertex_capacity) vertex_capacity *= 2;
+        while (index_alloc.used + num_indices > index_capacity) index_capacity *= 2;
+        relocate(vertex_capacity, index_capacity);
+        base_vertex = vertex_alloc.allocate(num_vertices);
+        first_index = index_alloc.allocate(num_indices);
+    }
+    // upload (missing attributes are zero-filled to keep the shared layout)
+    positions->upload_subdata(geometry.positions.data(), base_vertex * sizeof(glm::vec3), num_vertices * sizeof(glm::vec3));
+    if (geometry.has_normals())
+        normals->upload_subdata(geometry.normals.data(), base_vertex * sizeof(glm::vec3), num_vertices * sizeof(glm::vec3));
+    else {
+        const std::vector<glm::vec3> zero(num_vertices, glm::vec3(0));
+        normals->upload_subdata(zero.data(), base_vertex * sizeof(glm::vec3), num_vertices * sizeof(glm::vec3));
+    }
+    if (geometry.has_texcoords())
+        texcoords->upload_subdata(geometry.texcoords.data(), base_vertex * sizeof(glm::vec2), num_vertices * sizeof(glm::vec2));
+    else {
+        const std::vector<glm::vec2> zero(num_vertices, glm::vec2(0));
+        texcoords->upload_subdata(zero.data(), base_vertex * sizeof(glm::vec2), num_vertices * sizeof(glm::vec2));
+    }
+    const std::vector<uint8_t> index_data = convert_indices(geometry.indices.data(), num_indices, index_type);
+    indices->upload_subdata(index_data.data(), size_t(first_index) * index_type_size(index_type), index_data.size());
+    // register allocation
+    uint32_t alloc_id;
+    if (!free_ids.empty()) {
+        alloc_id = free_ids.back();
+        free_ids.pop_back();
+    } else {
+        alloc_id = uint32_t(ranges.size());
+        ranges.emplace_back();
+        live.push_back(0);
+    }
+    ranges[alloc_id] = GeometryRange{ base_vertex, num_vertices, first_index, num_indices };
+    live[alloc_id] = 1;
+    ++generation;
+    return alloc_id;
+}
+
+void GeometryArenaImpl::free(uint32_t alloc_id) {
+    const GeometryRange& r = range(alloc_id);
+    vertex_alloc.free(r.base_vertex, r.num_vertices);
+    index_alloc.free(r.first_index, r.num_indices);
+    live[alloc_id] = 0;
+    free_ids.push_back(alloc_id);
+    ++generation;
+}
+
+const GeometryRange& GeometryArenaImpl::range(uint32_t alloc_id) const {
+    if (alloc_id >= ranges.size() || !live[alloc_id])
+        throw std::runtime_error("GeometryArena " + name + ": invalid allocation id " + std::to_string(alloc_id));
+    return ranges[alloc_id];
+}
+
+void GeometryArenaImpl::compact() {
+    relocate(vertex_alloc.capacity, index_alloc.capacity);
+}
+
+void GeometryArenaImpl::relocate(uint32_t vertex_capacity, uint32_t index_capacity) {
+    const std::string suffix = "_" + std::to_string(++generation);
+    VBO new_positions(name + "_positions" + suffix, size_t(vertex_capacity) * sizeof(glm::vec3));
+    VBO new_normals(name + "_normals" + suffix, size_t(vertex_capacity) * sizeof(glm::vec3));
+    VBO new_texcoords(name + "_texcoords" + suffix, size_t(vertex_capacity) * sizeof(glm::vec2));
+    IBO new_indices(name + "_indices" + suffix, size_t(index_capacity) * index_type_size(index_type));
+    std::vector<uint32_t> ids;
+    for (uint32_t id = 0; id < ranges.size(); ++id)
+        if (live[id]) ids.push_back(id);
+    // pack vertices (indices are relative to base_vertex and need no rewrite)
+    std::sort(ids.begin(), ids.end(), [&](uint32_t a, uint32_t b) { return ranges[a].base_vertex < ranges[b].base_vertex; });
+    std::vector<std::pair<uint32_t, uint32_t>> copies;
+    uint32_t packed_vertices = 0;
+    for (uint32_t id : ids) {
+        copies.emplace_back(ranges[id].base_vertex, ranges[id].num_vertices);
+        ranges[id].base_vertex = packed_vertices;
+        packed_vertices += ranges[id].num_vertices;
+    }
+    copy_packed(positions->id, new_positions->id, sizeof(glm::vec3), copies);
+    copy_packed(normals->id, new_normals->id, sizeof(glm::vec3), copies);
+    copy_packed(texcoords->id, new_texcoords->id, sizeof(glm::vec2), copies);
+    // pack indices
+    std::sort(ids.begin(), ids.end(), [&](uint32_t a, uint32_t b) { return ranges[a].first_index < ranges[b].first_index; });
+    copies.clear();
+    uint32_t packed_indices = 0;
+    for (uint32_t id : ids) {
+        copies.emplace_back(ranges[id].first_index, ranges[id].num_indices);
+        ranges[id].first_index = packed_indices;
+        packed_indices += ranges[id].num_indices;
+    }
+    copy_packed(indices->id, new_indices->id, index_type_size(index_type), copies);
+    // swap in new buffers and drop the old ones from the handle maps
+    VBO::erase(positions->name);
+    VBO::erase(normals->name);
+    VBO::erase(texcoords->name);
+    IBO::erase(indices->name);
+    positions = new_positions;
+    normals = new_normals;
+    texcoords = new_texcoords;
+    indices = new_indices;
+    vertex_alloc.reset(vertex_capacity, packed_vertices);
+    index_alloc.reset(index_capacity, packed_indices);
+    setup_vertex_array();
+}
+
+void GeometryArenaImpl::reserve_draw_ids(uint32_t count) {
+    if (count <= num_draw_ids) return;
+    num_draw_ids = std::max(count, 2 * num_draw_ids);
+    std::vector<uint32_t> ids(num_draw_ids);
+    std::iota(ids.begin(), ids.end(), 0u);
+    draw_ids->upload_data(ids.data(), ids.size() * sizeof(uint32_t), GL_STATIC_DRAW);
+}
+
+void GeometryArenaImpl::setup_vertex_array() {
+    const GLuint buffers[3] = { positions->id, normals->id, texcoords->id };
+    const GLint dims[3] = { 3, 3, 2 };
+    if (has_direct_state_access()) {
+        for (uint32_t i = 0; i < 3; ++i) {
+            glEnableVertexArrayAttrib(vao, i);
+            glVertexArrayAttribFormat(vao, i, dims[i], GL_FLOAT, GL_FALSE, 0);
+            glVertexArrayAttribBinding(vao, i, i);
+            glVertexArrayVertexBuffer(vao, i, buffers[i], 0, dims[i] * sizeof(float));
+        }
+        glEnableVertexArrayAttrib(vao, draw_id_location);
+        glVertexArrayAttribIFormat(vao, draw_id_location, 1, GL_UNSIGNED_INT, 0);
+        glVertexArrayAttribBinding(vao, draw_id_location, 3);
+        glVertexArrayVertexBuffer(vao, 3, draw_ids->id, 0, sizeof(uint32_t));
+        glVertexArrayBindingDivisor(vao, 3, 1);
+        glVertexArrayElementBuffer(vao, indices->id);
+        return;
+    }
+    GLState::bind_vertex_array(vao);
+    for (uint32_t i = 0; i < 3; ++i) {
+        GLState::bind_buffer(GL_ARRAY_BUFFER, buffers[i]);
+        glEnableVertexAttribArray(i);
+        glVertexAttribPointer(i, dims[i], GL_FLOAT, GL_FALSE, 0, 0);
+    }
+    draw_ids->bind();
+    glEnableVertexAttribArray(draw_id_location);
+    glVertexAttribIPointer(draw_id_location, 1, GL_UNSIGNED_INT, 0, 0);
+    glVertexAttribDivisor(draw_id_location, 1);
+    indices->bind();
+    GLState::bind_vertex_array(0);
+    draw_ids->unbind();
+}
+
+void GeometryArenaImpl::bind() const {
+    GLState::bind_vertex_array(vao);
+}
+
+void GeometryArenaImpl::unbind() const {
+    GLState::unbind_vertex_array();
+}
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include <GL/gl.h>
+#include "named_handle.h"
+#include "buffer.h"
+#include "geometry.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// index type helpers
+
+// size in bytes of GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT indices
+uint32_t index_type_size(GLenum index_type);
+// smallest index type able to hold max_index (GL_UNSIGNED_BYTE only if allowed, many GPUs handle it slowly)
+GLenum smallest_index_type(uint32_t max_index, bool allow_byte = false);
+// narrow 32-bit indices to the given index type (raw bytes, ready for upload)
+std::vector<uint8_t> convert_indices(const uint32_t* indices, uint32_t count, GLenum index_type);
+
+// ------------------------------------------
+// RangeAllocator (first-fit offset allocator over [0, capacity) with coalescing free list)
+
+class RangeAllocator {
+public:
+    RangeAllocator(uint32_t capacity = 0);
+
+    // returns offset of the allocated range or INVALID if no free range is large enough
+    uint32_t allocate(uint32_t count);
+    void free(uint32_t offset, uint32_t count);
+    // reset to a single allocated range [0, used) within [0, capacity)
+    void reset(uint32_t capacity, uint32_t used = 0);
+
+    inline uint32_t free_count() const { return capacity - used; }
+
+    static const uint32_t INVALID = uint32_t(-1);
+
+    // data
+    uint32_t capacity, used;
+    std::map<uint32_t, uint32_t> free_ranges; // offset -> count
+};
+
+// ------------------------------------------
+// GeometryArena (shared vertex/index buffers holding many meshes)
+
+// location of a mesh inside a GeometryArena
+struct GeometryRange {
+    uint32_t base_vertex;
+    uint32_t num_vertices;
+    uint32_t first_index;
+    uint32_t num_indices;
+};
+
+class GeometryArenaImpl {
+public:
+    // index_type GL_UNSIGNED_SHORT halves index memory, but limits meshes to 65536 vertices (indices are relative to base_vertex)
+    GeometryArenaImpl(const std::string& name, uint32_t vertex_capacity = 1 << 20, uint32_t index_capacity = 1 << 22, GLenum index_type = GL_UNSIGNED_INT);
+    virtual ~GeometryArenaImpl();
+
+    // prevent copies and moves, since GL buffers aren't reference counted
+    GeometryArenaImpl(const GeometryArenaImpl&) = delete;
+    GeometryArenaImpl& operator=(const GeometryArenaImpl&) = delete;
+    GeometryArenaImpl& operator=(const GeometryArenaImpl&&) = delete;
+
+    // upload geometry into the arena (grows or compacts the buffers if required), returns allocation id
+    uint32_t allocate(const GeometryImpl& geometry);
+    void free(uint32_t alloc_id);
+    const GeometryRange& range(uint32_t alloc_id) const;
+
+    // move all live ranges to the front of the buffers (allocation ids stay valid)
+    void compact();
+    // make sure draw ids [0, count) are available to multi draws
+    void reserve_draw_ids(uint32_t count);
+
+    void bind() const;
+    void unbind() const;
+
+    // fixed vertex layout: 0: position, 1: normal, 2: texcoord, draw_id_location: draw id (per instance)
+    static constexpr uint32_t draw_id_location = 7;
+
+    // data
+    const std::string name;
+    GLuint vao;
+    VBO positions, normals, texcoords, draw_ids;
+    IBO indices;
+    const GLenum index_type;
+    RangeAllocator vertex_alloc, index_alloc;
+    std::vector<GeometryRange> ranges;  // indexed by allocation id
+    std::vector<uint8_t> live;          // allocation id in use?
+    std::vector<uint32_t> free_ids;
+    uint32_t num_draw_ids;
+    uint32_t generation;                // incremented whenever ranges change (allocate, free, relocate)
+
+private:
+    // reallocate buffers with the given capacities and copy all live ranges tightly packed
+    void relocate(uint32_t vertex_capacity, uint32_t index_capacity);
+    void setup_vertex_array();
+};
+
+using GeometryArena = NamedHandle<GeometryArenaImpl>;
+template class _API NamedHandle<GeometryArenaImpl>; //needed for Windows DLL export
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,359 @@
+#include "geometry.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cfloat>
+#include <limits>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// helper funcs
+
+// vertex scoring of "Linear-Speed Vertex Cache Optimisation" (Tom Forsyth, 2006)
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRI_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+static float forsyth_score(int cache_pos, uint32_t remaining_tris, uint32_t cache_size) {
+    if (remaining_tris == 0) return -1.f;
+    float score = 0.f;
+    if (cache_pos >= 0)
+        score = cache_pos < 3 ? LAST_TRI_SCORE : std::pow(1.f - float(cache_pos - 3) / float(cache_size - 3), CACHE_DECAY_POWER);
+    return score + VALENCE_BOOST_SCALE * std::pow(float(remaining_tris), -VALENCE_BOOST_POWER);
+}
+
+// FIFO cache simulation: vertex v is cached if it was inserted during the last cache_size misses
+struct FifoCache {
+    FifoCache(size_t num_vertices, uint32_t cache_size) : stamps(num_vertices, 0), time(cache_size + 1), size(cache_size) {}
+    // returns true on miss
+    inline bool access(uint32_t v) {
+        if (time - stamps[v] <= size) return false;
+        stamps[v] = time++;
+        return true;
+    }
+    std::vector<uint32_t> stamps;
+    uint32_t time, size;
+};
+
+// quantized vertex attributes with precomputed hash
+struct WeldKey {
+    int64_t q[8];
+    size_t hash;
+    inline bool operator==(const WeldKey& other) const { return std::memcmp(q, other.q, sizeof(q)) == 0; }
+};
+
+struct WeldKeyHash {
+    inline size_t operator()(const WeldKey& key) const { return key.hash; }
+};
+
+static int64_t quantize(float x, float eps) {
+    if (eps > 0.f) return std::llround(double(x) / double(eps));
+    // bitwise, but treat -0 and +0 as equal
+    x += 0.f;
+    int32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+// bounding sphere and normal cone of triangles [first_tri, end_tri)
+static GeometryImpl::Meshlet make_meshlet(const GeometryImpl& geometry, uint32_t first_tri, uint32_t end_tri, uint32_t num_vertices) {
+    const auto& positions = geometry.positions;
+    const auto& indices = geometry.indices;
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for (uint32_t i = 3 * first_tri; i < 3 * end_tri; ++i) {
+        lo = glm::min(lo, positions[indices[i]]);
+        hi = glm::max(hi, positions[indices[i]]);
+    }
+    const glm::vec3 center = (lo + hi) * 0.5f;
+    float radius = 0.f;
+    for (uint32_t i = 3 * first_tri; i < 3 * end_tri; ++i)
+        radius = std::max(radius, glm::length(positions[indices[i]] - center));
+    // cone around the average triangle normal, disabled if the normals spread too wide
+    std::vector<glm::vec3> tri_normals;
+    tri_normals.reserve(end_tri - first_tri);
+    glm::vec3 axis(0);
+    for (uint32_t t = first_tri; t < end_tri; ++t) {
+        const glm::vec3& a = positions[indices[3 * t]], &b = positions[indices[3 * t + 1]], &c = positions[indices[3 * t + 2]];
+        const glm::vec3 n = glm::cross(b - a, c - a);
+        const float len = glm::length(n);
+        if (len <= 0.f) continue;
+        tri_normals.push_back(n / len);
+        axis += n / len;
+    }
+    glm::vec4 cone(0, 0, 0, 1);
+    const float axis_len = glm::length(axis);
+    if (axis_len > 0.f) {
+        axis /= axis_len;
+        float min_dot = 1.f;
+        for (const auto& n : tri_normals)
+            min_dot = std::min(min_dot, glm::dot(n, axis));
+        if (min_dot > 0.1f)
+            cone = glm::vec4(axis, std::sqrt(1.f - min_dot * min_dot));
+    }
+    return GeometryImpl::Meshlet{ glm::vec4(center, radius), cone, 3 * first_tri, 3 * (end_tri - first_tri), num_vertices, 0 };
+}
+
+// ------------------------------------------
+// GeometryImpl vertex welding
+
+uint32_t GeometryImpl::weld_parallel_threshold = 1 << 16;
+
+uint32_t GeometryImpl::weld(float position_eps, float normal_eps, float texcoord_eps) {
+    const uint32_t num_verts = uint32_t(positions.size());
+    if (num_verts == 0) return 0;
+    const bool use_normals = normals.size() == num_verts, use_texcoords = texcoords.size() == num_verts;
+    // quantize and hash attributes
+    std::vector<WeldKey> keys(num_verts);
+    parallel_for(num_verts, weld_parallel_threshold, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t v = begin; v < end; ++v) {
+            WeldKey& key = keys[v];
+            std::memset(key.q, 0, sizeof(key.q));
+            for (int i = 0; i < 3; ++i) {
+                key.q[i] = quantize(positions[v][i], position_eps);
+                if (use_normals) key.q[3 + i] = quantize(normals[v][i], normal_eps);
+            }
+            for (int i = 0; use_texcoords && i < 2; ++i)
+                key.q[6 + i] = quantize(texcoords[v][i], texcoord_eps);
+            key.hash = 14695981039346656037ull;
+            for (int i = 0; i < 8; ++i)
+                key.hash = (key.hash ^ std::hash<int64_t>()(key.q[i])) * 1099511628211ull;
+        }
+    });
+    // find first occurrence of each key, hash space is sharded so every thread owns its own map
+    std::vector<uint32_t> first(num_verts);
+    const uint32_t num_shards = num_verts < weld_parallel_threshold || ThreadPool::is_worker_thread() ? 1 : ThreadPool::global().size();
+    parallel_for(num_shards, 2, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t shard = begin; shard < end; ++shard) {
+            std::unordered_map<WeldKey, uint32_t, WeldKeyHash> map;
+            map.reserve(num_verts / num_shards);
+            for (uint32_t v = 0; v < num_verts; ++v)
+                if (keys[v].hash % num_shards == shard)
+                    first[v] = map.emplace(keys[v], v).first->second;
+        }
+    });
+    // compact vertex arrays in place (first[v] <= v, so remap[first[v]] is known)
+    std::vector<uint32_t> remap(num_verts);
+    uint32_t next = 0;
+    for (uint32_t v = 0; v < num_verts; ++v) {
+        if (first[v] != v) {
+            remap[v] = remap[first[v]];
+            continue;
+        }
+        remap[v] = next;
+        positions[next] = positions[v];
+        if (use_normals) normals[next] = normals[v];
+        if (use_texcoords) texcoords[next] = texcoords[v];
+        ++next;
+    }
+    positions.resize(next);
+    if (use_normals) normals.resize(next);
+    if (use_texcoords) texcoords.resize(next);
+    parallel_for(uint32_t(indices.size()), weld_parallel_threshold, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i)
+            indices[i] = remap[indices[i]];
+    });
+    return num_verts - next;
+}
+
+// ------------------------------------------
+// GeometryImpl optimization passes
+
+GeometryImpl::CacheStats GeometryImpl::vertex_cache_stats(uint32_t cache_size) const {
+    const size_t num_tris = indices.size() / 3;
+    if (num_tris == 0 || positions.empty()) return CacheStats{ 0.f, 0.f };
+    FifoCache cache(positions.size(), cache_size);
+    uint32_t misses = 0;
+    for (uint32_t idx : indices)
+        misses += cache.access(idx) ? 1 : 0;
+    return CacheStats{ float(misses) / float(num_tris), float(misses) / float(positions.size()) };
+}
+
+void GeometryImpl::optimize_vertex_cache(uint32_t cache_size) {
+    const uint32_t num_tris = uint32_t(indices.size() / 3), num_verts = uint32_t(positions.size());
+    if (num_tris == 0 || cache_size < 4) return;
+    // vertex -> remaining triangles adjacency
+    std::vector<uint32_t> remaining(num_verts, 0), offsets(num_verts + 1, 0);
+    for (uint32_t idx : indices)
+        remaining[idx]++;
+    for (uint32_t v = 0; v < num_verts; ++v)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    std::vector<uint32_t> adjacency(indices.size()), fill(offsets.begin(), offsets.end() - 1);
+    for (uint32_t t = 0; t < num_tris; ++t)
+        for (uint32_t k = 0; k < 3; ++k)
+            adjacency[fill[indices[3 * t + k]]++] = t;
+    // initial scores
+    std::vector<int> cache_pos(num_verts, -1);
+    std::vector<float> vertex_score(num_verts), tri_score(num_tris, 0.f);
+    for (uint32_t v = 0; v < num_verts; ++v)
+        vertex_score[v] = forsyth_score(-1, remaining[v], cache_size);
+    int64_t best = -1;
+    for (uint32_t t = 0; t < num_tris; ++t) {
+        tri_score[t] = vertex_score[indices[3 * t]] + vertex_score[indices[3 * t + 1]] + vertex_score[indices[3 * t + 2]];
+        if (best < 0 || tri_score[t] > tri_score[best]) best = t;
+    }
+    // greedily emit best scoring triangle
+    std::vector<uint8_t> emitted(num_tris, 0);
+    std::vector<uint32_t> cache, new_cache, result;
+    cache.reserve(cache_size + 3);
+    new_cache.reserve(cache_size + 3);
+    result.reserve(indices.size());
+    uint32_t scan = 0;
+    while (best >= 0) {
+        emitted[best] = 1;
+        const uint32_t* tri = &indices[3 * best];
+        result.insert(result.end(), tri, tri + 3);
+        // remove triangle from the adjacency of its vertices
+        for (uint32_t k = 0; k < 3; ++k) {
+            const uint32_t v = tri[k];
+            uint32_t* begin = &adjacency[offsets[v]], *end = begin + remaining[v];
+            std::iter_swap(std::find(begin, end, uint32_t(best)), end - 1);
+            remaining[v]--;
+        }
+        // move triangle vertices to the front of the cache
+        new_cache.assign(tri, tri + 3);
+        for (uint32_t v : cache)
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                new_cache.push_back(v);
+        for (uint32_t i = 0; i < new_cache.size(); ++i)
+            cache_pos[new_cache[i]] = i < cache_size ? int(i) : -1;
+        // rescore affected vertices and triangles, pick the best one
+        for (uint32_t v : new_cache)
+            vertex_score[v] = forsyth_score(cache_pos[v], remaining[v], cache_size);
+        best = -1;
+        for (uint32_t v : new_cache) {
+            for (uint32_t i = offsets[v]; i < offsets[v] + remaining[v]; ++i) {
+                const uint32_t t = adjacency[i];
+                tri_score[t] = vertex_score[indices[3 * t]] + vertex_score[indices[3 * t + 1]] + vertex_score[indices[3 * t + 2]];
+                if (best < 0 || tri_score[t] > tri_score[best]) best = t;
+            }
+        }
+        if (new_cache.size() > cache_size) new_cache.resize(cache_size);
+        std::swap(cache, new_cache);
+        // nothing adjacent to the cache left, continue with the next unemitted triangle
+        if (best < 0) {
+            while (scan < num_tris && emitted[scan]) ++scan;
+            best = scan < num_tris ? int64_t(scan) : -1;
+        }
+    }
+    indices.swap(result);
+}
+
+void GeometryImpl::optimize_overdraw() {
+    const uint32_t num_tris = uint32_t(indices.size() / 3);
+    if (num_tris == 0) return;
+    // split into clusters where the (cache optimized) triangle order restarts with a full cache miss
+    std::vector<uint32_t> cluster_begin;
+    FifoCache cache(positions.size(), 16);
+    for (uint32_t t = 0; t < num_tris; ++t) {
+        const uint32_t misses = cache.access(indices[3 * t]) + cache.access(indices[3 * t + 1]) + cache.access(indices[3 * t + 2]);
+        if (t == 0 || misses == 3) cluster_begin.push_back(t);
+    }
+    cluster_begin.push_back(num_tris);
+    const uint32_t num_clusters = uint32_t(cluster_begin.size() - 1);
+    if (num_clusters < 2) return;
+    // area weighted centroid and normal per cluster
+    std::vector<glm::vec3> centroids(num_clusters, glm::vec3(0)), normals_c(num_clusters, glm::vec3(0));
+    std::vector<float> areas(num_clusters, 0.f);
+    glm::vec3 mesh_centroid(0);
+    float mesh_area = 0.f;
+    for (uint32_t c = 0; c < num_clusters; ++c) {
+        for (uint32_t t = cluster_begin[c]; t < cluster_begin[c + 1]; ++t) {
+            const glm::vec3& a = positions[indices[3 * t]], &b = positions[indices[3 * t + 1]], &d = positions[indices[3 * t + 2]];
+            const glm::vec3 n = glm::cross(b - a, d - a);
+            const float area = glm::length(n) * 0.5f;
+            centroids[c] += (a + b + d) * (area / 3.f);
+            normals_c[c] += n;
+            areas[c] += area;
+        }
+        mesh_centroid += centroids[c];
+        mesh_area += areas[c];
+        if (areas[c] > 0.f) centroids[c] /= areas[c];
+    }
+    if (mesh_area > 0.f) mesh_centroid /= mesh_area;
+    // outward facing clusters first, they are likely to occlude the others
+    std::vector<float> key(num_clusters);
+    std::vector<uint32_t> order(num_clusters);
+    for (uint32_t c = 0; c < num_clusters; ++c) {
+        const float len = glm::length(normals_c[c]);
+        key[c] = len > 0.f ? glm::dot(centroids[c] - mesh_centroid, normals_c[c] / len) : 0.f;
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return key[a] > key[b]; });
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (uint32_t c : order)
+        result.insert(result.end(), indices.begin() + 3 * cluster_begin[c], indices.begin() + 3 * cluster_begin[c + 1]);
+    indices.swap(result);
+}
+
+void GeometryImpl::optimize_vertex_fetch() {
+    const uint32_t INVALID = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(positions.size(), INVALID);
+    uint32_t next = 0;
+    for (uint32_t& idx : indices) {
+        if (remap[idx] == INVALID) remap[idx] = next++;
+        idx = remap[idx];
+    }
+    // move vertex data into first-use order
+    std::vector<glm::vec3> new_positions(next), new_normals(has_normals() ? next : 0);
+    std::vector<glm::vec2> new_texcoords(has_texcoords() ? next : 0);
+    for (uint32_t v = 0; v < remap.size(); ++v) {
+        if (remap[v] == INVALID) continue;
+        new_positions[remap[v]] = positions[v];
+        if (has_normals()) new_normals[remap[v]] = normals[v];
+        if (has_texcoords()) new_texcoords[remap[v]] = texcoords[v];
+    }
+    positions.swap(new_positions);
+    normals.swap(new_normals);
+    texcoords.swap(new_texcoords);
+}
+
+void GeometryImpl::build_meshlets(uint32_t max_vertices, uint32_t max_triangles) {
+    meshlets.clear();
+    if (indices.empty() || indices.size() % 3 != 0 || max_vertices < 3 || max_triangles < 1) return;
+    // cache optimized order keeps neighboring triangles close, so meshlets can be filled greedily in a single scan
+    optimize_vertex_cache();
+    const uint32_t num_tris = uint32_t(indices.size() / 3);
+    const uint32_t INVALID = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> owner(positions.size(), INVALID); // last meshlet referencing a vertex
+    const auto count_new_vertices = [&](uint32_t t) {
+        const uint32_t* tri = &indices[3 * t];
+        const uint32_t id = uint32_t(meshlets.size());
+        return uint32_t(owner[tri[0]] != id) + uint32_t(owner[tri[1]] != id && tri[1] != tri[0]) +
+            uint32_t(owner[tri[2]] != id && tri[2] != tri[0] && tri[2] != tri[1]);
+    };
+    uint32_t first_tri = 0, num_vertices = 0;
+    for (uint32_t t = 0; t < num_tris; ++t) {
+        uint32_t new_vertices = count_new_vertices(t);
+        if (num_vertices + new_vertices > max_vertices || t - first_tri >= max_triangles) {
+            meshlets.push_back(make_meshlet(*this, first_tri, t, num_vertices));
+            first_tri = t;
+            num_vertices = 0;
+            new_vertices = count_new_vertices(t);
+        }
+        for (uint32_t k = 0; k < 3; ++k)
+            owner[indices[3 * t + k]] = uint32_t(meshlets.size());
+        num_vertices += new_vertices;
+    }
+    meshlets.push_back(make_meshlet(*this, first_tri, num_tris, num_vertices));
+}
+
+void GeometryImpl::optimize(bool verbose) {
+    if (indices.empty() || indices.size() % 3 != 0) return;
+    const CacheStats before = vertex_cache_stats();
+    optimize_vertex_cache();
+    optimize_overdraw();
+    optimize_vertex_fetch();
+    if (verbose) {
+        const CacheStats after = vertex_cache_stats();
+        std::cout << "Optimized " << name << ": ACMR " << before.acmr << " -> " << after.acmr
+            << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+    }
+}
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,243 @@
+#include "geometry.h"
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// helper funcs
+
+// symmetric 4x4 error quadric (Garland/Heckbert), error is normalized by the accumulated weight
+struct Quadric {
+    double a2 = 0, b2 = 0, c2 = 0, d2 = 0, ab = 0, ac = 0, ad = 0, bc = 0, bd = 0, cd = 0, w = 0;
+
+    // plane n.p + d = 0 with unit normal n
+    void add_plane(const glm::vec3& n, float d, double weight) {
+        const double a = n.x, b = n.y, c = n.z;
+        a2 += weight * a * a; b2 += weight * b * b; c2 += weight * c * c; d2 += weight * d * d;
+        ab += weight * a * b; ac += weight * a * c; ad += weight * a * d;
+        bc += weight * b * c; bd += weight * b * d; cd += weight * c * d;
+        w += weight;
+    }
+
+    Quadric& operator+=(const Quadric& q) {
+        a2 += q.a2; b2 += q.b2; c2 += q.c2; d2 += q.d2; ab += q.ab; ac += q.ac; ad += q.ad; bc += q.bc; bd += q.bd; cd += q.cd; w += q.w;
+        return *this;
+    }
+
+    // mean squared distance of p to the accumulated planes
+    double error(const glm::vec3& p) const {
+        const double x = p.x, y = p.y, z = p.z;
+        const double e = a2 * x * x + b2 * y * y + c2 * z * z + 2 * (ab * x * y + ac * x * z + bc * y * z) + 2 * (ad * x + bd * y + cd * z) + d2;
+        return w > 0 ? std::max(e, 0.0) / w : 0.0;
+    }
+};
+
+// weight of border constraint planes relative to surface planes
+static const double BORDER_WEIGHT = 10.0;
+
+static inline uint64_t edge_key(uint32_t a, uint32_t b) {
+    return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+}
+
+struct PositionHash {
+    inline size_t operator()(const glm::vec3& p) const {
+        uint32_t bits[3];
+        std::memcpy(bits, &p, sizeof(bits));
+        return (size_t(bits[0]) * 73856093) ^ (size_t(bits[1]) * 19349663) ^ (size_t(bits[2]) * 83492791);
+    }
+};
+
+// ------------------------------------------
+// GeometryImpl simplification
+
+std::vector<uint32_t> GeometryImpl::simplify(const std::vector<uint32_t>& source, uint32_t target_index_count, float target_error, float* result_error) const {
+    if (result_error) *result_error = 0.f;
+    const uint32_t num_verts = uint32_t(positions.size());
+    if (source.size() % 3 != 0 || source.size() <= target_index_count) return source;
+    // collapse on position topology (one canonical vertex per position), so attribute seams move together and don't crack
+    std::vector<uint32_t> canon(num_verts), group_next(num_verts, uint32_t(-1));
+    {
+        std::unordered_map<glm::vec3, uint32_t, PositionHash> first;
+        first.reserve(num_verts);
+        for (uint32_t v = 0; v < num_verts; ++v) {
+            auto it = first.emplace(positions[v] + glm::vec3(0.f), v).first; // +0: merge -0 and 0
+            canon[v] = it->second;
+            if (it->second != v) {
+                group_next[v] = group_next[it->second];
+                group_next[it->second] = v;
+            }
+        }
+    }
+    std::vector<uint32_t> tris(source.size()), corners(source);
+    for (size_t i = 0; i < source.size(); ++i)
+        tris[i] = canon[source[i]];
+    // area weighted plane quadrics and border constraints
+    std::vector<Quadric> quadrics(num_verts);
+    std::unordered_map<uint64_t, uint32_t> edge_count;
+    edge_count.reserve(source.size());
+    for (size_t t = 0; t < tris.size(); t += 3)
+        for (uint32_t k = 0; k < 3; ++k)
+            edge_count[edge_key(tris[t + k], tris[t + (k + 1) % 3])]++;
+    std::vector<uint8_t> border(num_verts, 0);
+    for (size_t t = 0; t < tris.size(); t += 3) {
+        const glm::vec3& a = positions[tris[t]], &b = positions[tris[t + 1]], &c = positions[tris[t + 2]];
+        glm::vec3 n = glm::cross(b - a, c - a);
+        const float len = glm::length(n);
+        if (len <= 0.f) continue;
+        n /= len;
+        for (uint32_t k = 0; k < 3; ++k)
+            quadrics[tris[t + k]].add_plane(n, -glm::dot(n, a), 0.5 * len);
+        // constrain border edges by a plane perpendicular to the triangle
+        for (uint32_t k = 0; k < 3; ++k) {
+            const uint32_t v0 = tris[t + k], v1 = tris[t + (k + 1) % 3];
+            if (edge_count[edge_key(v0, v1)] != 1) continue;
+            const glm::vec3 e = positions[v1] - positions[v0];
+            const float e_len = glm::length(e);
+            if (e_len <= 0.f) continue;
+            const glm::vec3 bn = glm::normalize(glm::cross(e, n));
+            quadrics[v0].add_plane(bn, -glm::dot(bn, positions[v0]), BORDER_WEIGHT * e_len * e_len);
+            quadrics[v1].add_plane(bn, -glm::dot(bn, positions[v0]), BORDER_WEIGHT * e_len * e_len);
+            border[v0] = border[v1] = 1;
+        }
+    }
+    // greedy passes of independent edge collapses (u -> v, vertices stay in place), cheapest first
+    struct Collapse { uint32_t u, v; double cost; };
+    const double max_cost = double(target_error) * double(target_error);
+    double max_error = 0;
+    std::vector<uint32_t> offsets, adjacency;
+    std::vector<uint64_t> edges;
+    std::vector<Collapse> collapses;
+    std::vector<uint8_t> locked(num_verts);
+    std::vector<uint32_t> remap(num_verts);
+    while (tris.size() > target_index_count) {
+        // vertex -> triangle adjacency
+        offsets.assign(num_verts + 1, 0);
+        for (uint32_t v : tris) offsets[v + 1]++;
+        for (uint32_t v = 0; v < num_verts; ++v) offsets[v + 1] += offsets[v];
+        adjacency.resize(tris.size());
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < tris.size(); ++i) adjacency[fill[tris[i]]++] = uint32_t(i / 3);
+        // candidate collapses
+        edges.clear();
+        for (size_t t = 0; t < tris.size(); t += 3)
+            for (uint32_t k = 0; k < 3; ++k)
+                edges.push_back(edge_key(tris[t + k], tris[t + (k + 1) % 3]));
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+        collapses.clear();
+        for (uint64_t e : edges) {
+            const uint32_t a = uint32_t(e >> 32), b = uint32_t(e & 0xFFFFFFFF);
+            if (a == b) continue;
+            // border vertices may only slide along the border
+            const bool border_edge = edge_count.count(e) && edge_count[e] == 1;
+            Quadric q = quadrics[a];
+            q += quadrics[b];
+            const double cost_ab = (border[a] && !border_edge) ? DBL_MAX : q.error(positions[b]);
+            const double cost_ba = (border[b] && !border_edge) ? DBL_MAX : q.error(positions[a]);
+            if (std::min(cost_ab, cost_ba) > max_cost) continue;
+            collapses.push_back(cost_ab <= cost_ba ? Collapse{ a, b, cost_ab } : Collapse{ b, a, cost_ba });
+        }
+        if (collapses.empty()) break;
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+        // apply as many non-overlapping collapses as possible
+        std::fill(locked.begin(), locked.end(), 0);
+        for (uint32_t v = 0; v < num_verts; ++v) remap[v] = v;
+        size_t remaining = tris.size();
+        uint32_t num_collapsed = 0;
+        for (const Collapse& c : collapses) {
+            if (remaining <= target_index_count) break;
+            if (locked[c.u] || locked[c.v]) continue;
+            // reject collapses that flip a triangle around u
+            bool flips = false;
+            uint32_t removed = 0;
+            for (uint32_t i = offsets[c.u]; i < offsets[c.u + 1] && !flips; ++i) {
+                const uint32_t* tri = &tris[3 * adjacency[i]];
+                if (tri[0] == c.v || tri[1] == c.v || tri[2] == c.v) {
+                    removed++;
+                    continue;
+                }
+                const uint32_t k = tri[0] == c.u ? 0 : (tri[1] == c.u ? 1 : 2);
+                const glm::vec3& p1 = positions[tri[(k + 1) % 3]], &p2 = positions[tri[(k + 2) % 3]];
+                const glm::vec3 n_old = glm::cross(p1 - positions[c.u], p2 - positions[c.u]);
+                const glm::vec3 n_new = glm::cross(p1 - positions[c.v], p2 - positions[c.v]);
+                flips = glm::dot(n_old, n_new) <= 0.f;
+            }
+            if (flips) continue;
+            remap[c.u] = c.v;
+            quadrics[c.v] += quadrics[c.u];
+            max_error = std::max(max_error, c.cost);
+            remaining -= 3 * removed;
+            num_collapsed++;
+            // lock the one-ring of u, its triangles change
+            for (uint32_t i = offsets[c.u]; i < offsets[c.u + 1]; ++i)
+                for (uint32_t k = 0; k < 3; ++k)
+                    locked[tris[3 * adjacency[i] + k]] = 1;
+        }
+        if (num_collapsed == 0) break;
+        // rewrite triangles and drop degenerate ones
+        size_t out = 0;
+        for (size_t t = 0; t < tris.size(); t += 3) {
+            const uint32_t a = remap[tris[t]], b = remap[tris[t + 1]], c = remap[tris[t + 2]];
+            if (a == b || b == c || a == c) continue;
+            tris[out] = a; tris[out + 1] = b; tris[out + 2] = c;
+            corners[out] = corners[t]; corners[out + 1] = corners[t + 1]; corners[out + 2] = corners[t + 2];
+            out += 3;
+        }
+        tris.resize(out);
+        corners.resize(out);
+        // rebuild border edge counts for the next pass
+        edge_count.clear();
+        for (size_t t = 0; t < tris.size(); t += 3)
+            for (uint32_t k = 0; k < 3; ++k)
+                edge_count[edge_key(tris[t + k], tris[t + (k + 1) % 3])]++;
+    }
+    // pick the vertex of the target position whose attributes best match the original corner
+    const auto attribute_distance = [&](uint32_t a, uint32_t b) {
+        float d = 0.f;
+        if (has_texcoords()) d += glm::length(texcoords[a] - texcoords[b]);
+        if (has_normals()) d += glm::length(normals[a] - normals[b]);
+        return d;
+    };
+    std::vector<uint32_t> result(tris.size());
+    for (size_t i = 0; i < tris.size(); ++i) {
+        const uint32_t corner = corners[i];
+        if (canon[corner] == tris[i]) {
+            result[i] = corner;
+            continue;
+        }
+        uint32_t best = tris[i];
+        float best_dist = attribute_distance(best, corner);
+        for (uint32_t v = group_next[tris[i]]; v != uint32_t(-1); v = group_next[v]) {
+            const float dist = attribute_distance(v, corner);
+            if (dist < best_dist) {
+                best = v;
+                best_dist = dist;
+            }
+        }
+        result[i] = best;
+    }
+    if (result_error) *result_error = float(std::sqrt(max_error));
+    return result;
+}
+
+void GeometryImpl::build_lods(uint32_t max_lods, float reduction, float max_error) {
+    lods.clear();
+    float error = 0.f;
+    for (uint32_t i = 0; i < max_lods; ++i) {
+        const std::vector<uint32_t>& source = lods.empty() ? indices : lods.back().indices;
+        const uint32_t target = uint32_t(float(source.size() / 3) * reduction) * 3;
+        if (target < 3) break;
+        float step_error = 0.f;
+        std::vector<uint32_t> result = simplify(source, target, max_error, &step_error);
+        // stop if the simplifier got stuck (border or error bound)
+        if (result.empty() || result.size() > source.size() * 0.9f) break;
+        error += step_error;
+        lods.push_back(Lod{ std::move(result), error });
+    }
+}
+
+CPPGL_NAMESPACE_END
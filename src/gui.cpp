@@ -29,6 +29,7 @@ void gui_draw() {
     window_length +=    entry_length*TimerQueryGL::map.size();
     window_length +=    entry_length*PrimitiveQueryGL::map.size();
     window_length +=    entry_length*FragmentQueryGL::map.size();
+    window_length +=    entry_length/2; // GL state changes
 
     // timers
     ImGui::SetNextWindowPos(ImVec2(0, 20));
@@ -52,6 +53,8 @@ void gui_draw() {
             ImGui::Separator();
             gui_display_query_counter(*query, name.c_str());
         }
+        ImGui::Separator();
+        ImGui::Text("GL state changes: %u issued, %u elided", GLState::issued_last_frame(), GLState::elided_last_frame());
     }
     ImGui::PopStyleVar();
     ImGui::PopStyleColor();
@@ -86,6 +89,14 @@ void gui_draw() {
         ImGui::Separator();
         if (ImGui::Button("Screenshot"))
             Context::screenshot("screenshot.png");
+        if (ImGui::Button(Context::capturing() ? "Stop capture" : "Capture")) {
+            if (Context::capturing())
+                Context::stop_capture();
+            else
+                Context::start_capture();
+        }
+        if (Context::capturing())
+            ImGui::Text("%lu frames (%lu dropped)", (unsigned long)Context::captured_frames(), (unsigned long)Context::dropped_frames());
         ImGui::EndMainMenuBar();
     }
 
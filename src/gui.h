@@ -11,6 +11,7 @@
 #include "geometry.h"
 #include "drawelement.h"
 #include "framebuffer.h"
+#include "state.h"
 
 CPPGL_NAMESPACE_BEGIN
 
@@ -4,40 +4,106 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stbi/stb_image_write.h"
 #include <algorithm>
-#include <thread>
+#include <iostream>
+#include <cstring>
+#include <functional>
+#include <condition_variable>
+#include "thread_pool.h"
+#include "mapped_file.h"
+#include "pixel_convert.h"
+#include <limits>
+#include <cstdlib>
 
 CPPGL_NAMESPACE_BEGIN
 
 ///////////////////////
 //load
 
-std::tuple<std::vector<uint8_t>, int, int, int, bool> image_load(const std::filesystem::path& path) {
-    stbi_set_flip_vertically_on_load(1); // important: the default value for this is different on windows and linux
+ImageBuffer::ImageBuffer(const uint8_t* data, size_t size) : ptr((uint8_t*)malloc(size)), length(size) {
+    if (size > 0 && !ptr) throw std::bad_alloc();
+    if (size > 0) memcpy(ptr, data, size);
+}
+
+ImageBuffer::ImageBuffer(const ImageBuffer& other) : ImageBuffer(other.ptr, other.length) {}
+
+ImageBuffer::ImageBuffer(ImageBuffer&& other) noexcept : ptr(other.ptr), length(other.length) {
+    other.ptr = nullptr;
+    other.length = 0;
+}
+
+ImageBuffer& ImageBuffer::operator=(ImageBuffer other) noexcept {
+    std::swap(ptr, other.ptr);
+    std::swap(length, other.length);
+    return *this;
+}
+
+ImageBuffer::~ImageBuffer() {
+    // stb allocates with malloc unless STBI_MALLOC is overridden, copies use malloc as well
+    stbi_image_free(ptr);
+}
 
+ImageBuffer ImageBuffer::adopt(uint8_t* stbi_data, size_t size) {
+    ImageBuffer buffer;
+    buffer.ptr = stbi_data;
+    buffer.length = size;
+    return buffer;
+}
+
+// decode from the mapped file, the returned memory has to be released with stbi_image_free
+static uint8_t* image_decode(const std::filesystem::path& path, ImageInfo& info) {
+    const MappedFile file(path);
+    if (file.size() > size_t(std::numeric_limits<int>::max()))
+        throw std::runtime_error("Image file too large: " + path.string());
+    const int length = int(file.size());
     uint8_t* data = 0;
-    int w_out, h_out, channels_out;
-    bool is_hdr_out = stbi_is_hdr(path.string().c_str());
-    size_t size_of_buffer = 0;
-
-    // load image from disk
-    if (is_hdr_out) {
-        data = (uint8_t*)stbi_loadf(path.string().c_str(), &w_out, &h_out, &channels_out, 0);
-        size_of_buffer = w_out * h_out * channels_out * sizeof(float);
-    } else {
-        data = stbi_load(path.string().c_str(), &w_out, &h_out, &channels_out, 0);
-        size_of_buffer = w_out * h_out * channels_out;
-    }
+    info.is_hdr = stbi_is_hdr_from_memory(file.data(), length);
+    if (info.is_hdr)
+        data = (uint8_t*)stbi_loadf_from_memory(file.data(), length, &info.w, &info.h, &info.channels, 0);
+    else
+        data = stbi_load_from_memory(file.data(), length, &info.w, &info.h, &info.channels, 0);
     if (!data)
-        throw std::runtime_error("Failed to load image file: " + path.string());
+        throw std::runtime_error("Failed to load image file: " + path.string() + " (" + stbi_failure_reason() + ")");
+    return data;
+}
 
-    // copy array to output
-    std::vector<uint8_t> data_out;
-    data_out.insert(data_out.end(), &data[0], &data[size_of_buffer]);
-    
-    // free data
-    stbi_image_free(data);
+ImageData image_load(const std::filesystem::path& path) {
+    stbi_set_flip_vertically_on_load_thread(1); // important: the default value for this is different on windows and linux (per thread, images are decoded in parallel)
 
-    return { data_out, w_out, h_out, channels_out, is_hdr_out };
+    ImageInfo info;
+    uint8_t* data = image_decode(path, info);
+    // hand out stb's buffer as is
+    return { ImageBuffer::adopt(data, info.size_bytes()), info.w, info.h, info.channels, info.is_hdr };
+}
+
+ImageInfo image_load_into(const std::filesystem::path& path, const std::function<void*(const ImageInfo&)>& destination,
+        const ImageRowConverter& convert) {
+    stbi_set_flip_vertically_on_load_thread(0); // flipped while copying instead
+
+    ImageInfo info;
+    uint8_t* data = image_decode(path, info);
+    uint8_t* dst = nullptr;
+    try {
+        dst = (uint8_t*)destination(info);
+    } catch (...) {
+        stbi_image_free(data);
+        throw;
+    }
+    const size_t row_bytes = info.size_bytes() / info.h;
+    if (dst && !convert)
+        flip_rows(data, dst, row_bytes, info.h);
+    else if (dst) {
+        try {
+            for (int y = 0; y < info.h; ++y)
+                dst += convert(info, data + (info.h - 1 - y) * row_bytes, dst);
+        } catch (...) {
+            stbi_image_free(data);
+            throw;
+        }
+    }
+    stbi_image_free(data);
+    if (!dst)
+        throw std::runtime_error("image_load_into: no destination for " + path.string());
+    return info;
 }
 
 ///////////////////////
@@ -46,51 +112,161 @@ std::tuple<std::vector<uint8_t>, int, int, int, bool> image_load(const std::file
 void image_store_ldr_impl(const std::filesystem::path& path, const uint8_t* image_data, int w, int h, int channels, bool flip) {
     stbi_flip_vertically_on_write(flip);
 
+    int ok = 0;
     if (path.extension() == ".png")
-        stbi_write_png(path.string().c_str(), w, h, channels, image_data, 0); // stride 0, tightly packed
+        ok = stbi_write_png(path.string().c_str(), w, h, channels, image_data, 0); // stride 0, tightly packed
     else if (path.extension() == ".jpg" || path.extension() == ".jpeg")
-        stbi_write_jpg(path.string().c_str(), w, h, channels, image_data, 100); // quality fixed at 100%
+        ok = stbi_write_jpg(path.string().c_str(), w, h, channels, image_data, 100); // quality fixed at 100%
     else if (path.extension() == ".tga")
-        stbi_write_tga(path.string().c_str(), w, h, channels, image_data);
+        ok = stbi_write_tga(path.string().c_str(), w, h, channels, image_data);
     else if (path.extension() == ".bmp")
-        stbi_write_bmp(path.string().c_str(), w, h, channels, image_data);
+        ok = stbi_write_bmp(path.string().c_str(), w, h, channels, image_data);
     else
         throw std::runtime_error("save_image_ldr: unsupported image format: " + path.extension().string());
-}
-
-void image_store_ldr_thread(const std::filesystem::path& path, const std::shared_ptr<std::vector<uint8_t>>& image_data, int w, int h, int channels, bool flip) {
-    image_store_ldr_impl(path, image_data->data(), w, h, channels, flip);
+    if (!ok)
+        throw std::runtime_error("Failed to write image file: " + path.string());
 }
 
 void image_store_ldr(const std::filesystem::path& path, const uint8_t* image_data, int w, int h, int channels, bool flip, bool async) {
-    if (async) {
-        std::shared_ptr<std::vector<uint8_t>> image_data_vector = std::make_shared<std::vector<uint8_t>>(image_data, image_data + size_t(w) * h * channels);
-        std::thread worker(image_store_ldr_thread, path, image_data_vector, w, h, channels, flip);
-        worker.detach();
-    } else
+    if (async)
+        ImageWriter::store_ldr(path, image_data, w, h, channels, flip);
+    else
         image_store_ldr_impl(path, image_data, w, h, channels, flip);
 }
 
 void image_store_hdr_impl(const std::filesystem::path& path, const float* image_data, int w, int h, int channels, bool flip) {
     stbi_flip_vertically_on_write(flip);
 
-    if (path.extension() == ".hdr")
-        stbi_write_hdr(path.string().c_str(), w, h, channels, image_data);
-    else
+    if (path.extension() != ".hdr")
         throw std::runtime_error("save_image_hdr: unsupported image format: " + path.extension().string());
-}
-
-void image_store_hdr_thread(const std::filesystem::path& path, const std::shared_ptr<std::vector<float>>& image_data, int w, int h, int channels, bool flip) {
-    image_store_hdr_impl(path, image_data->data(), w, h, channels, flip);
+    if (!stbi_write_hdr(path.string().c_str(), w, h, channels, image_data))
+        throw std::runtime_error("Failed to write image file: " + path.string());
 }
 
 void image_store_hdr(const std::filesystem::path& path, const float* image_data, int w, int h, int channels, bool flip, bool async) {
-    if (async) {
-        std::shared_ptr<std::vector<float>> image_data_vector = std::make_shared<std::vector<float>>(image_data, image_data + size_t(w) * h * channels);
-        std::thread worker(image_store_hdr_thread, path, image_data_vector, w, h, channels, flip);
-        worker.detach();
-    } else
+    if (async)
+        ImageWriter::store_hdr(path, image_data, w, h, channels, flip);
+    else
         image_store_hdr_impl(path, image_data, w, h, channels, flip);
 }
 
+void image_store_srgb(const std::filesystem::path& path, const float* image_data, int w, int h, int channels, bool flip, bool async) {
+    // sRGB encode color, alpha stays linear
+    const size_t pixels = size_t(w) * h;
+    std::vector<uint8_t> encoded(pixels * channels);
+    linear_to_srgb(image_data, encoded.data(), encoded.size());
+    if (channels == 2 || channels == 4)
+        for (size_t i = 0; i < pixels; ++i)
+            encoded[i * channels + channels - 1] = uint8_t(std::clamp(image_data[i * channels + channels - 1], 0.f, 1.f) * 255.f + 0.5f);
+    image_store_ldr(path, encoded.data(), w, h, channels, flip, async); // async copies into a staging buffer
+}
+
+///////////////////////
+//writer pool
+
+uint32_t ImageWriter::num_threads = 2;
+uint32_t ImageWriter::max_queued = 16;
+ImageWriterPolicy ImageWriter::policy = IMAGE_WRITER_BLOCK;
+
+static std::mutex writer_mutex;
+static std::condition_variable writer_cv;
+static uint32_t writer_pending = 0;
+static uint64_t writer_dropped = 0;
+static std::vector<std::vector<uint8_t>> writer_buffers; // staging buffers for reuse
+
+static ThreadPool& writer_pool() {
+    // workers drain the queue on destruction, so writes queued at exit are not lost
+    static ThreadPool pool(std::max(1u, ImageWriter::num_threads));
+    return pool;
+}
+
+static bool writer_acquire_slot() {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    if (writer_pending >= ImageWriter::max_queued) {
+        if (ImageWriter::policy == IMAGE_WRITER_DROP) {
+            writer_dropped++;
+            return false;
+        }
+        if (ImageWriter::policy == IMAGE_WRITER_BLOCK)
+            writer_cv.wait(lock, [] { return writer_pending < ImageWriter::max_queued; });
+    }
+    writer_pending++;
+    return true;
+}
+
+static std::vector<uint8_t> writer_acquire_buffer(size_t size_bytes) {
+    std::vector<uint8_t> buffer;
+    {
+        const std::lock_guard<std::mutex> lock(writer_mutex);
+        if (!writer_buffers.empty()) {
+            buffer = std::move(writer_buffers.back());
+            writer_buffers.pop_back();
+        }
+    }
+    buffer.resize(size_bytes);
+    return buffer;
+}
+
+static void writer_release(std::vector<uint8_t>&& buffer) {
+    {
+        const std::lock_guard<std::mutex> lock(writer_mutex);
+        if (writer_buffers.size() < ImageWriter::max_queued)
+            writer_buffers.push_back(std::move(buffer));
+        writer_pending--;
+    }
+    writer_cv.notify_all();
+}
+
+static std::future<void> writer_enqueue(const std::filesystem::path& path, const uint8_t* image_data, size_t row_bytes, int h, bool flip,
+        const std::function<void(const std::filesystem::path&, const uint8_t*)>& write) {
+    if (!writer_acquire_slot()) {
+        std::promise<void> skipped;
+        skipped.set_exception(std::make_exception_ptr(std::runtime_error("ImageWriter: queue full, dropped " + path.string())));
+        return skipped.get_future();
+    }
+    // flip while copying, so workers write unflipped
+    std::vector<uint8_t> staging = writer_acquire_buffer(row_bytes * h);
+    if (flip)
+        flip_rows(image_data, staging.data(), row_bytes, h);
+    else
+        memcpy(staging.data(), image_data, row_bytes * h);
+    return writer_pool().enqueue([path, staging = std::move(staging), write]() mutable {
+        try {
+            write(path, staging.data());
+        } catch (const std::exception& e) {
+            std::cerr << "WARN: " << e.what() << std::endl;
+            writer_release(std::move(staging));
+            throw;
+        }
+        writer_release(std::move(staging));
+    });
+}
+
+std::future<void> ImageWriter::store_ldr(const std::filesystem::path& path, const uint8_t* image_data, int w, int h, int channels, bool flip) {
+    return writer_enqueue(path, image_data, size_t(w) * channels, h, flip, [w, h, channels](const std::filesystem::path& path, const uint8_t* data) {
+        image_store_ldr_impl(path, data, w, h, channels, false);
+    });
+}
+
+std::future<void> ImageWriter::store_hdr(const std::filesystem::path& path, const float* image_data, int w, int h, int channels, bool flip) {
+    return writer_enqueue(path, (const uint8_t*)image_data, size_t(w) * channels * sizeof(float), h, flip, [w, h, channels](const std::filesystem::path& path, const uint8_t* data) {
+        image_store_hdr_impl(path, (const float*)data, w, h, channels, false);
+    });
+}
+
+void ImageWriter::wait_idle() {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    writer_cv.wait(lock, [] { return writer_pending == 0; });
+}
+
+uint32_t ImageWriter::pending() {
+    const std::lock_guard<std::mutex> lock(writer_mutex);
+    return writer_pending;
+}
+
+uint64_t ImageWriter::dropped() {
+    const std::lock_guard<std::mutex> lock(writer_mutex);
+    return writer_dropped;
+}
+
 CPPGL_NAMESPACE_END
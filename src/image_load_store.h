@@ -1,19 +1,103 @@
 #pragma once
+#include <tuple>
 #include <vector>
+#include <future>
+#include <functional>
 #include <filesystem>
 #include "platform.h"
 
 CPPGL_NAMESPACE_BEGIN
 
+// ------------------------------------------
+// ImageBuffer (decoded pixels, adopts the decoder's allocation instead of copying it)
+
+class ImageBuffer {
+public:
+    ImageBuffer() : ptr(nullptr), length(0) {}
+    ImageBuffer(const uint8_t* data, size_t size); // copies
+    ImageBuffer(const ImageBuffer& other);
+    ImageBuffer(ImageBuffer&& other) noexcept;
+    ImageBuffer& operator=(ImageBuffer other) noexcept;
+    ~ImageBuffer();
+
+    // take ownership of memory returned by stbi_load*
+    static ImageBuffer adopt(uint8_t* stbi_data, size_t size);
+
+    inline uint8_t* data() { return ptr; }
+    inline const uint8_t* data() const { return ptr; }
+    inline size_t size() const { return length; }
+    inline bool empty() const { return length == 0; }
+    inline uint8_t& operator[](size_t i) { return ptr[i]; }
+    inline const uint8_t& operator[](size_t i) const { return ptr[i]; }
+
+private:
+    uint8_t* ptr;
+    size_t length;
+};
+
+// image data, width, height, channels, is_hdr
+using ImageData = std::tuple<ImageBuffer, int, int, int, bool>;
+
+struct ImageInfo {
+    int w = 0, h = 0, channels = 0;
+    bool is_hdr = false; // float pixels
+
+    inline size_t size_bytes() const { return size_t(w) * h * channels * (is_hdr ? sizeof(float) : 1); }
+};
+
 // Return values: image data, width, height, channels, is_hdr
 // Usage: auto [data, w, h, c, is_hdr] = load_image(path);
 // Note: if is_hdr is set, image data is of type float stored as byte array
-std::tuple<std::vector<uint8_t>, int, int, int, bool> image_load(const std::filesystem::path& path);
+// Thread-safe, does not touch GL
+// Files are memory mapped and decoded from memory
+ImageData image_load(const std::filesystem::path& path);
+
+// converts one decoded row into dst, returns the bytes written (the row stride in dst)
+using ImageRowConverter = std::function<size_t(const ImageInfo& info, const uint8_t* src, uint8_t* dst)>;
+
+// Decode into memory provided by destination(info) (e.g. a mapped PUBO), which is written exactly once (flipped like image_load).
+// Rows are copied as is (destination holds info.size_bytes()) or passed through convert.
+// Returns the info passed to destination. Thread-safe if the callbacks are, does not touch GL
+ImageInfo image_load_into(const std::filesystem::path& path, const std::function<void*(const ImageInfo&)>& destination,
+        const ImageRowConverter& convert = {});
 
 // Write LDR image to disk, supported file formats: .png, .jpg/.jpeg, .tga, .bmp
+// async: fire and forget via ImageWriter::store_ldr
 void image_store_ldr(const std::filesystem::path& path, const uint8_t* image_data, int w, int h, int channels, bool flip = true, bool async = false);
 
 // Write HDR image to disk, supported file formats: .hdr
+// async: fire and forget via ImageWriter::store_hdr
 void image_store_hdr(const std::filesystem::path& path, const float* image_data, int w, int h, int channels, bool flip = true, bool async = false);
 
+// Write linear float image sRGB encoded (alpha stays linear) to an LDR format, see image_store_ldr
+void image_store_srgb(const std::filesystem::path& path, const float* image_data, int w, int h, int channels, bool flip = true, bool async = false);
+
+// ------------------------------------------
+// ImageWriter (fixed-size writer pool for asynchronous image stores, bounded queue, recycled staging buffers)
+
+enum ImageWriterPolicy {
+    IMAGE_WRITER_BLOCK, // caller waits for a free queue slot
+    IMAGE_WRITER_DROP,  // write is skipped (and counted), the future throws
+    IMAGE_WRITER_GROW,  // queue grows beyond max_queued
+};
+
+class ImageWriter {
+public:
+    // copy (and flip) into a staging buffer and write on the pool, the future rethrows write errors
+    static std::future<void> store_ldr(const std::filesystem::path& path, const uint8_t* image_data, int w, int h, int channels, bool flip = true);
+    static std::future<void> store_hdr(const std::filesystem::path& path, const float* image_data, int w, int h, int channels, bool flip = true);
+
+    // block until all queued writes are done (called on context destruction)
+    static void wait_idle();
+    // number of queued or running writes
+    static uint32_t pending();
+    // number of writes dropped by IMAGE_WRITER_DROP
+    static uint64_t dropped();
+
+    // settings (num_threads takes effect on first use)
+    static uint32_t num_threads;
+    static uint32_t max_queued;
+    static ImageWriterPolicy policy;
+};
+
 CPPGL_NAMESPACE_END
@@ -0,0 +1,70 @@
+#include "mapped_file.h"
+#include <stdexcept>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+CPPGL_NAMESPACE_BEGIN
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const fs::path& path) : ptr(nullptr), length(0), file_handle(INVALID_HANDLE_VALUE), mapping_handle(nullptr) {
+    file_handle = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("MappedFile: failed to open: " + path.string());
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file_handle, &file_size);
+    length = size_t(file_size.QuadPart);
+    if (length == 0) return; // empty files can't be mapped
+    mapping_handle = CreateFileMappingW(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle)
+        ptr = (const uint8_t*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    if (!ptr) {
+        if (mapping_handle) CloseHandle(mapping_handle);
+        CloseHandle(file_handle);
+        throw std::runtime_error("MappedFile: failed to map: " + path.string());
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (ptr) UnmapViewOfFile(ptr);
+    if (mapping_handle) CloseHandle(mapping_handle);
+    if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+}
+
+#else
+
+MappedFile::MappedFile(const fs::path& path) : ptr(nullptr), length(0) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("MappedFile: failed to open: " + path.string());
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("MappedFile: failed to stat: " + path.string());
+    }
+    length = size_t(st.st_size);
+    if (length > 0) {
+        void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("MappedFile: failed to map: " + path.string());
+        }
+        ptr = (const uint8_t*)mapping;
+    }
+    close(fd); // the mapping stays valid
+}
+
+MappedFile::~MappedFile() {
+    if (ptr) munmap((void*)ptr, length);
+}
+
+#endif
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+namespace fs = std::filesystem;
+#include "platform.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// MappedFile (read-only memory mapping of a whole file, pages are loaded on demand by the OS)
+
+class MappedFile {
+public:
+    // throws std::runtime_error if the file can't be opened or mapped
+    MappedFile(const fs::path& path);
+    virtual ~MappedFile();
+
+    // prevent copies, since the mapping isn't reference counted
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    inline const uint8_t* data() const { return ptr; }
+    inline size_t size() const { return length; }
+
+private:
+    const uint8_t* ptr;
+    size_t length;
+#ifdef _WIN32
+    void* file_handle;
+    void* mapping_handle;
+#endif
+};
+
+CPPGL_NAMESPACE_END
@@ -1,11 +1,40 @@
 #include "material.h"
+#include "texture_cache.h"
+#include "async_loader.h"
 #include <iostream>
 
 CPPGL_NAMESPACE_BEGIN
 
+bool MaterialImpl::lazy_textures = true;
+
 MaterialImpl::MaterialImpl(const std::string& name) : name(name) {}
 
-MaterialImpl::MaterialImpl(const std::string& name, const fs::path& base_path, const aiMaterial* mat_ai) : name(name) {
+// texture types parsed by MaterialImpl
+static const aiTextureType texture_types[] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_AMBIENT, aiTextureType_EMISSIVE,
+    aiTextureType_HEIGHT, aiTextureType_OPACITY, aiTextureType_SHININESS, aiTextureType_DISPLACEMENT, aiTextureType_LIGHTMAP };
+
+std::vector<fs::path> MaterialImpl::texture_paths(const fs::path& base_path, const aiMaterial* mat_ai) {
+    std::vector<fs::path> paths;
+    for (aiTextureType type : texture_types) {
+        if (mat_ai->GetTextureCount(type) > 0) {
+            aiString path_ai;
+            mat_ai->GetTexture(type, 0, &path_ai);
+            paths.push_back(base_path / path_ai.C_Str());
+        }
+    }
+    return paths;
+}
+
+MaterialImpl::MaterialImpl(const std::string& name, const fs::path& base_path, const aiMaterial* mat_ai, const ImageFutures& images) : name(name) {
+    // use decoded image if available, otherwise load (lazily) from disk
+    const auto load_texture = [&](const std::string& uniform_name, const std::string& texture_name, const fs::path& path) {
+        const auto it = images.find(path);
+        if (it == images.end())
+            add_texture(uniform_name, texture_name, path);
+        else
+            texture_map[uniform_name] = TextureCache::load(texture_name, path, it->second.get());
+    };
+
     // TODO include more (useful) assimp params?
     // ambient, diffuse, specular and emissive color are handled via fallback 1x1 textures
     // parse assimp material parameters (http://assimp.sourceforge.net/lib_html/materials.html)
@@ -44,68 +73,68 @@ MaterialImpl::MaterialImpl(const std::string& name, const fs::path& base_path, c
     if (mat_ai->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
         aiString path_ai;
         mat_ai->GetTexture(aiTextureType_DIFFUSE, 0, &path_ai);
-        texture_map["diffuse"] = Texture2D(name + "_diffuse_" + name_ai.C_Str(), base_path / path_ai.C_Str());
+        load_texture("diffuse", name + "_diffuse_" + name_ai.C_Str(), base_path / path_ai.C_Str());
     } else if (mat_ai->Get(AI_MATKEY_COLOR_DIFFUSE, vec3_value) == AI_SUCCESS) {
         // 1x1 fallback texture
-        texture_map["diffuse"] = Texture2D(name + "_diffuse_" + name_ai.C_Str(), 1, 1, GL_RGB32F, GL_RGB, GL_FLOAT, &vec3_value.r);
+        texture_map["diffuse"] = TextureCache::load(name + "_diffuse_" + name_ai.C_Str(), 1, 1, GL_RGB32F, GL_RGB, GL_FLOAT, &vec3_value.r);
     }
     // specular
     if (mat_ai->GetTextureCount(aiTextureType_SPECULAR) > 0) {
         aiString path_ai;
         mat_ai->GetTexture(aiTextureType_SPECULAR, 0, &path_ai);
-        texture_map["specular"] = Texture2D(name + "_specular_" + name_ai.C_Str(), base_path / path_ai.C_Str());
+        load_texture("specular", name + "_specular_" + name_ai.C_Str(), base_path / path_ai.C_Str());
     } else if (mat_ai->Get(AI_MATKEY_COLOR_SPECULAR, vec3_value) == AI_SUCCESS) {
         // 1x1 fallback texture
-        texture_map["specular"] = Texture2D(name + "_specular_" + name_ai.C_Str(), 1, 1, GL_RGB32F, GL_RGB, GL_FLOAT, &vec3_value.r);
+        texture_map["specular"] = TextureCache::load(name + "_specular_" + name_ai.C_Str(), 1, 1, GL_RGB32F, GL_RGB, GL_FLOAT, &vec3_value.r);
     }
     // ambient
     if (mat_ai->GetTextureCount(aiTextureType_AMBIENT) > 0) {
         aiString path_ai;
         mat_ai->GetTexture(aiTextureType_AMBIENT, 0, &path_ai);
-        texture_map["ambient"] = Texture2D(name + "_ambient_" + name_ai.C_Str(), base_path / path_ai.C_Str());
+        load_texture("ambient", name + "_ambient_" + name_ai.C_Str(), base_path / path_ai.C_Str());
     } else if (mat_ai->Get(AI_MATKEY_COLOR_AMBIENT, vec3_value) == AI_SUCCESS) {
         // 1x1 fallback texture
-        texture_map["ambient"] = Texture2D(name + "_ambient_" + name_ai.C_Str(), 1, 1, GL_RGB32F, GL_RGB, GL_FLOAT, &vec3_value.r);
+        texture_map["ambient"] = TextureCache::load(name + "_ambient_" + name_ai.C_Str(), 1, 1, GL_RGB32F, GL_RGB, GL_FLOAT, &vec3_value.r);
     }
     // emissive
     if (mat_ai->GetTextureCount(aiTextureType_EMISSIVE) > 0) {
         aiString path_ai;
         mat_ai->GetTexture(aiTextureType_EMISSIVE, 0, &path_ai);
-        texture_map["emissive"] = Texture2D(name + "_emissive_" + name_ai.C_Str(), base_path / path_ai.C_Str());
+        load_texture("emissive", name + "_emissive_" + name_ai.C_Str(), base_path / path_ai.C_Str());
     } else if (mat_ai->Get(AI_MATKEY_COLOR_EMISSIVE, vec3_value) == AI_SUCCESS) {
         // 1x1 fallback texture
-        texture_map["emissive"] = Texture2D(name + "_emissive_" + name_ai.C_Str(), 1, 1, GL_RGB32F, GL_RGB, GL_FLOAT, &vec3_value.r);
+        texture_map["emissive"] = TextureCache::load(name + "_emissive_" + name_ai.C_Str(), 1, 1, GL_RGB32F, GL_RGB, GL_FLOAT, &vec3_value.r);
     }
 
     // heightmap / normalmap (obj: map_Bump somehow is aiTextureType_HEIGHT, not aiTextureType_NORMALS) TODO test other file formats
     if (mat_ai->GetTextureCount(aiTextureType_HEIGHT) > 0) {
         aiString path_ai;
         mat_ai->GetTexture(aiTextureType_HEIGHT, 0, &path_ai);
-        texture_map["normalmap"] = Texture2D(name + "_normal_" + name_ai.C_Str(), base_path / path_ai.C_Str());
+        load_texture("normalmap", name + "_normal_" + name_ai.C_Str(), base_path / path_ai.C_Str());
     }
     // alphamap (TODO how to handle alphamap vs opacity parameter, or alpha channel of diffuse texture such as in SMG?)
     if (mat_ai->GetTextureCount(aiTextureType_OPACITY) > 0) {
         aiString path_ai;
         mat_ai->GetTexture(aiTextureType_OPACITY, 0, &path_ai);
-        texture_map["alphamap"] = Texture2D(name + "_alpha_" + name_ai.C_Str(), base_path / path_ai.C_Str());
+        load_texture("alphamap", name + "_alpha_" + name_ai.C_Str(), base_path / path_ai.C_Str());
     }
     // roughness texture (TODO do we want this, or just the static roughness param?)
     if (mat_ai->GetTextureCount(aiTextureType_SHININESS) > 0) {
         aiString path_ai;
         mat_ai->GetTexture(aiTextureType_SHININESS, 0, &path_ai);
-        texture_map["roughness"] = Texture2D(name + "_roughness_" + name_ai.C_Str(), base_path / path_ai.C_Str());
+        load_texture("roughness", name + "_roughness_" + name_ai.C_Str(), base_path / path_ai.C_Str());
     }
     // displacement map
     if (mat_ai->GetTextureCount(aiTextureType_DISPLACEMENT) > 0) {
         aiString path_ai;
         mat_ai->GetTexture(aiTextureType_DISPLACEMENT, 0, &path_ai);
-        texture_map["displacement"] = Texture2D(name + "_displacement_" + name_ai.C_Str(), base_path / path_ai.C_Str());
+        load_texture("displacement", name + "_displacement_" + name_ai.C_Str(), base_path / path_ai.C_Str());
     }
     // lightmap (baked AO or something)
     if (mat_ai->GetTextureCount(aiTextureType_LIGHTMAP) > 0) {
         aiString path_ai;
         mat_ai->GetTexture(aiTextureType_LIGHTMAP, 0, &path_ai);
-        texture_map["lightmap"] = Texture2D(name + "_light_" + name_ai.C_Str(), base_path / path_ai.C_Str());
+        load_texture("lightmap", name + "_light_" + name_ai.C_Str(), base_path / path_ai.C_Str());
     }
     // whatever
     if (mat_ai->GetTextureCount(aiTextureType_UNKNOWN) > 0)
@@ -114,6 +143,52 @@ MaterialImpl::MaterialImpl(const std::string& name, const fs::path& base_path, c
 
 MaterialImpl::~MaterialImpl() {}
 
+void MaterialImpl::add_texture(const std::string& uniform_name, const std::string& texture_name, const fs::path& path) {
+    // shared with other materials using the same file, a placeholder without GL texture if lazy (loaded on first use)
+    texture_map[uniform_name] = TextureCache::load(texture_name, path, true, lazy_textures);
+    if (lazy_textures)
+        lazy.insert(uniform_name);
+}
+
+Texture2D MaterialImpl::get_texture(const std::string& uniform_name) const {
+    if (lazy.count(uniform_name))
+        load_lazy(uniform_name);
+    return texture_map.at(uniform_name);
+}
+
+Texture2D MaterialImpl::placeholder() {
+    static Texture2D texture;
+    if (!texture) {
+        const uint8_t white[4] = { 255, 255, 255, 255 };
+        texture = Texture2D("cppgl_placeholder", 1, 1, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    }
+    return texture;
+}
+
+void MaterialImpl::load_lazy(const std::string& uniform_name) const {
+    lazy.erase(uniform_name);
+    Texture2D texture = texture_map.at(uniform_name);
+    if (texture->id != 0) return; // shared texture already loaded via another material
+    try {
+        // load into a temporary and move the GL texture into the placeholder, so all handles stay valid
+        Texture2DImpl loaded(texture->name, texture->loaded_from_path);
+        texture->swap(loaded);
+    } catch (const std::exception& e) {
+        std::cerr << "WARN: material <" << name << ">: " << e.what() << std::endl;
+    }
+}
+
+void MaterialImpl::load_lazy_async(const std::string& uniform_name) const {
+    lazy.erase(uniform_name);
+    const Texture2D texture = texture_map.at(uniform_name);
+    if (texture->id != 0) return; // shared texture already loaded via another material
+    // other materials sharing the texture must not start a second decode (failed loads stay in the set and are not retried)
+    static std::set<std::weak_ptr<Texture2DImpl>, std::owner_less<std::weak_ptr<Texture2DImpl>>> loading;
+    const std::weak_ptr<Texture2DImpl> key = texture.ptr;
+    if (!loading.insert(key).second) return;
+    AsyncLoader::load_into(texture, true, [key](const Texture2DImpl&) { loading.erase(key); });
+}
+
 void MaterialImpl::bind(const Shader& shader) const {
     // bind parameters as uniforms
     for (const auto& entry : int_map)
@@ -126,10 +201,13 @@ void MaterialImpl::bind(const Shader& shader) const {
         shader->uniform(entry.first, entry.second);
     for (const auto& entry : vec4_map)
         shader->uniform(entry.first, entry.second);
-    // bind textures as sampler2Ds
+    // bind textures as sampler2Ds, lazy textures start loading once a shader samples them
     uint32_t unit = 0;
-    for (const auto& entry : texture_map)
-        shader->uniform(entry.first, entry.second, unit++);
+    for (const auto& entry : texture_map) {
+        if (lazy.count(entry.first) && shader->uniform_location(entry.first) >= 0)
+            load_lazy_async(entry.first);
+        shader->uniform(entry.first, entry.second->id != 0 ? entry.second : placeholder(), unit++);
+    }
 }
 
 void MaterialImpl::unbind() const {
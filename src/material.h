@@ -1,8 +1,11 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <string>
 #include <memory>
+#include <future>
+#include <vector>
 #include <filesystem>
 namespace fs = std::filesystem;
 #include <GL/glew.h>
@@ -18,18 +21,26 @@ CPPGL_NAMESPACE_BEGIN
 // ------------------------------------------
 // Material
 
+// images being decoded on worker threads, keyed by path
+using ImageFutures = std::map<fs::path, std::shared_future<ImageData>>;
+
 class MaterialImpl {
 public:
     MaterialImpl(const std::string& name);
-    MaterialImpl(const std::string& name, const fs::path& base_path, const aiMaterial* mat_ai);
+    // textures found in images are taken from there instead of being loaded from disk (see lazy_textures)
+    MaterialImpl(const std::string& name, const fs::path& base_path, const aiMaterial* mat_ai, const ImageFutures& images = ImageFutures());
     virtual ~MaterialImpl();
 
+    // paths of all texture files referenced by mat_ai (to decode them ahead of construction)
+    static std::vector<fs::path> texture_paths(const fs::path& base_path, const aiMaterial* mat_ai);
+
     void bind(const Shader& shader) const;
     void unbind() const;
 
     inline bool has_texture(const std::string& uniform_name) const { return texture_map.count(uniform_name); }
-    inline Texture2D get_texture(const std::string& uniform_name) const { return texture_map.at(uniform_name); }
-    inline void add_texture(const std::string& uniform_name, const Texture2D& texture) { texture_map[uniform_name] = texture; }
+    Texture2D get_texture(const std::string& uniform_name) const; // loads lazy textures right away
+    inline void add_texture(const std::string& uniform_name, const Texture2D& texture) { texture_map[uniform_name] = texture; lazy.erase(uniform_name); }
+    void add_texture(const std::string& uniform_name, const std::string& texture_name, const fs::path& path); // lazily, if enabled
 
     // data
     const std::string name;
@@ -39,6 +50,17 @@ public:
     std::map<std::string, glm::vec3> vec3_map;
     std::map<std::string, glm::vec4> vec4_map;
     std::map<std::string, Texture2D> texture_map;
+
+    // load textures on first bind to a shader sampling them (via active uniforms), instead of on construction (default: on)
+    // they are decoded in the background (see AsyncLoader::load_into), the placeholder is bound until uploaded
+    static bool lazy_textures;
+    // shared 1x1 white texture bound in place of textures without data (not yet loaded or streamed)
+    static Texture2D placeholder();
+
+private:
+    mutable std::set<std::string> lazy; // texture_map entries that are placeholders to be loaded on first use
+    void load_lazy(const std::string& uniform_name) const;
+    void load_lazy_async(const std::string& uniform_name) const;
 };
 
 using Material = NamedHandle<MaterialImpl>;
@@ -7,6 +7,18 @@
 #include <assimp/mesh.h>
 #include <assimp/material.h>
 #include "buffer.h"
+#include "capabilities.h"
+#include "state.h"
+#include "culling.h"
+#include "mesh_cache.h"
+#include "thread_pool.h"
+#include "image_load_store.h"
+#include "draw_bucket.h"
+#include <cmath>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <glm/gtc/packing.hpp>
 
 CPPGL_NAMESPACE_BEGIN
 
@@ -34,61 +46,325 @@ inline uint32_t type_to_bytes(GLenum type) {
     }
 }
 
+// point attribute index of vao to (binding point / buffer) at offset with stride, normalized integers are read as floats
+static void setup_vertex_attrib(GLuint vao, uint32_t index, uint32_t binding, GLuint buffer, GLenum type, uint32_t dim,
+        bool normalized, uint32_t offset, uint32_t stride) {
+    const bool is_integer = !normalized && (type == GL_BYTE || type == GL_UNSIGNED_BYTE ||
+            type == GL_SHORT || type == GL_UNSIGNED_SHORT ||
+            type == GL_INT || type == GL_UNSIGNED_INT);
+    if (has_direct_state_access()) {
+        glEnableVertexArrayAttrib(vao, index);
+        if (is_integer)
+            glVertexArrayAttribIFormat(vao, index, dim, type, offset);
+        else if (type == GL_DOUBLE)
+            glVertexArrayAttribLFormat(vao, index, dim, type, offset);
+        else
+            glVertexArrayAttribFormat(vao, index, dim, type, normalized ? GL_TRUE : GL_FALSE, offset);
+        glVertexArrayAttribBinding(vao, index, binding);
+        glVertexArrayVertexBuffer(vao, binding, buffer, 0, stride);
+        return;
+    }
+    GLState::bind_vertex_array(vao);
+    GLState::bind_buffer(GL_ARRAY_BUFFER, buffer);
+    glEnableVertexAttribArray(index);
+    if (is_integer)
+        glVertexAttribIPointer(index, dim, type, stride, (void*)size_t(offset));
+    else if (type == GL_DOUBLE)
+        glVertexAttribLPointer(index, dim, type, stride, (void*)size_t(offset));
+    else
+        glVertexAttribPointer(index, dim, type, normalized ? GL_TRUE : GL_FALSE, stride, (void*)size_t(offset));
+    GLState::bind_vertex_array(0);
+    GLState::unbind_buffer(GL_ARRAY_BUFFER);
+}
+
+// octahedral mapping of a direction (any length) to [-1, 1]^2
+static glm::vec2 oct_encode(const glm::vec3& n) {
+    const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (!(l1 > 0.f)) return glm::vec2(0); // degenerate (or NaN) normal: encode (0, 0, 1)
+    const glm::vec3 p = n / l1;
+    if (p.z >= 0.f) return glm::vec2(p.x, p.y);
+    return glm::vec2((1.f - std::abs(p.y)) * (p.x >= 0.f ? 1.f : -1.f), (1.f - std::abs(p.x)) * (p.y >= 0.f ? 1.f : -1.f));
+}
+
 // ------------------------------------------
 // MeshImpl
 
-MeshImpl::MeshImpl(const std::string& name, const Geometry& geometry, const Material& material)
-    : name(name), geometry(geometry), material(material), vao(0), num_vertices(0), num_indices(0), primitive_type(GL_TRIANGLES) {
-    glGenVertexArrays(1, &vao);
+uint32_t MeshImpl::default_vertex_layout = VERTEX_LAYOUT_SEPARATE;
+bool MeshImpl::allow_byte_indices = false;
+bool MeshImpl::meshlet_culling = false;
+
+MeshImpl::MeshImpl(const std::string& name, const Geometry& geometry, const Material& material, const GeometryArena& arena)
+    : name(name), geometry(geometry), material(material), arena(arena), arena_alloc(RangeAllocator::INVALID), vao(0),
+    num_vertices(0), num_indices(0), index_type(GL_UNSIGNED_INT), primitive_type(GL_TRIANGLES), vertex_layout(default_vertex_layout), position_offset(0), position_scale(1), num_meshlets(0), meshlet_generation(0) {
+    if (!arena) { // otherwise the arena's vertex array is used
+        if (has_direct_state_access())
+            glCreateVertexArrays(1, &vao);
+        else
+            glGenVertexArrays(1, &vao);
+    }
     upload_gpu();
 }
 
 MeshImpl::~MeshImpl() {
     clear_gpu();
+    GLState::forget_vertex_array(vao);
     glDeleteVertexArrays(1, &vao);
 }
 
 void MeshImpl::clear_gpu() {
+    if (arena && arena_alloc != RangeAllocator::INVALID)
+        arena->free(arena_alloc);
+    arena_alloc = RangeAllocator::INVALID;
     ibo = IBO();
     vbos.clear();
     vbo_types.clear();
     vbo_dims.clear();
     num_vertices = num_indices = 0;
+    lods.clear();
+    meshlets = SSBO();
+    meshlet_commands = DIBO();
+    meshlet_count = ACBO();
+    num_meshlets = 0;
 }
 
 void MeshImpl::upload_gpu() {
     if (!geometry) return;
     // free gpu resources
     clear_gpu();
+    if (arena) {
+        if (!geometry->lods.empty())
+            std::cerr << "WARN: Mesh " << name << ": LODs are not supported in a geometry arena, drawing the full mesh only" << std::endl;
+        arena_alloc = arena->allocate(*geometry);
+        num_vertices = uint32_t(geometry->positions.size());
+        num_indices = uint32_t(geometry->indices.size());
+        index_type = arena->index_type;
+        upload_meshlets();
+        return;
+    }
     // (re-)upload data to GL
-    add_vertex_buffer(GL_FLOAT, 3, uint32_t(geometry->positions.size()), geometry->positions.data());
-    if (geometry->has_normals())
-        add_vertex_buffer(GL_FLOAT, 3, uint32_t(geometry->normals.size()), geometry->normals.data());
-    if (geometry->has_texcoords())
-        add_vertex_buffer(GL_FLOAT, 2, uint32_t(geometry->texcoords.size()), geometry->texcoords.data());
-    add_index_buffer(uint32_t(geometry->indices.size()), geometry->indices.data());
+    if (vertex_layout != VERTEX_LAYOUT_SEPARATE)
+        upload_vertices_packed();
+    else {
+        add_vertex_buffer(GL_FLOAT, 3, uint32_t(geometry->positions.size()), geometry->positions.data());
+        if (geometry->has_normals())
+            add_vertex_buffer(GL_FLOAT, 3, uint32_t(geometry->normals.size()), geometry->normals.data());
+        if (geometry->has_texcoords())
+            add_vertex_buffer(GL_FLOAT, 2, uint32_t(geometry->texcoords.size()), geometry->texcoords.data());
+    }
+    if (geometry->lods.empty())
+        add_index_buffer(uint32_t(geometry->indices.size()), geometry->indices.data());
+    else {
+        // all levels in one index buffer
+        std::vector<uint32_t> all_indices(geometry->indices);
+        lods.push_back(LodRange{ 0, uint32_t(geometry->indices.size()), 0.f });
+        for (const auto& lod : geometry->lods) {
+            lods.push_back(LodRange{ uint32_t(all_indices.size()), uint32_t(lod.indices.size()), lod.error });
+            all_indices.insert(all_indices.end(), lod.indices.begin(), lod.indices.end());
+        }
+        add_index_buffer(uint32_t(all_indices.size()), all_indices.data());
+        num_indices = lods[0].num_indices;
+    }
+    upload_meshlets();
+}
+
+void MeshImpl::upload_meshlets() {
+    if (geometry->meshlets.empty() || !has_multi_draw_indirect() || primitive_type != GL_TRIANGLES) return;
+    num_meshlets = uint32_t(geometry->meshlets.size());
+    meshlets = SSBO(name + "_meshlets");
+    meshlets->upload_data(geometry->meshlets.data(), num_meshlets * sizeof(GeometryImpl::Meshlet), GL_STATIC_DRAW);
+    meshlet_commands = DIBO(name + "_meshlet_commands");
+    meshlet_count = ACBO(name + "_meshlet_count");
+    // until culled, all meshlets are drawn
+    write_meshlet_commands();
+}
+
+void MeshImpl::write_meshlet_commands() const {
+    const uint32_t first_index = arena ? arena->range(arena_alloc).first_index : 0;
+    const int32_t base_vertex = arena ? int32_t(arena->range(arena_alloc).base_vertex) : 0;
+    std::vector<DrawElementsIndirectCommand> commands(num_meshlets);
+    for (uint32_t i = 0; i < num_meshlets; ++i)
+        commands[i] = DrawElementsIndirectCommand{ geometry->meshlets[i].num_indices, 1, first_index + geometry->meshlets[i].first_index, base_vertex, 0 };
+    meshlet_commands->upload_data(commands.data(), commands.size() * sizeof(DrawElementsIndirectCommand));
+    meshlet_count->upload_data(&num_meshlets, sizeof(uint32_t));
+    meshlet_generation = arena ? arena->generation : 0;
+}
+
+void MeshImpl::set_vertex_layout(uint32_t layout) {
+    vertex_layout = layout;
+    upload_gpu();
+}
+
+void MeshImpl::upload_vertices_packed() {
+    // attribute formats (same attribute indices as the separate layout)
+    struct Attrib { GLenum type; uint32_t dim; bool normalized; uint32_t size; std::vector<uint8_t> data; };
+    std::vector<Attrib> attribs;
+    const uint32_t n = uint32_t(geometry->positions.size());
+    // positions
+    if (vertex_layout & VERTEX_LAYOUT_QUANTIZED_POSITIONS) {
+        glm::vec3 bb_min(FLT_MAX), bb_max(-FLT_MAX);
+        for (const auto& p : geometry->positions) {
+            bb_min = glm::min(bb_min, p);
+            bb_max = glm::max(bb_max, p);
+        }
+        position_offset = bb_min;
+        position_scale = glm::max(bb_max - bb_min, glm::vec3(1e-20f));
+        Attrib a = { GL_UNSIGNED_SHORT, 4, true, 4 * sizeof(uint16_t), std::vector<uint8_t>(size_t(n) * 4 * sizeof(uint16_t)) };
+        uint16_t* dst = (uint16_t*)a.data.data();
+        for (uint32_t i = 0; i < n; ++i) {
+            const glm::vec3 q = glm::clamp((geometry->positions[i] - position_offset) / position_scale, 0.f, 1.f) * 65535.f + 0.5f;
+            dst[4 * i + 0] = uint16_t(q.x);
+            dst[4 * i + 1] = uint16_t(q.y);
+            dst[4 * i + 2] = uint16_t(q.z);
+            dst[4 * i + 3] = 65535;
+        }
+        attribs.push_back(std::move(a));
+    } else {
+        position_offset = glm::vec3(0);
+        position_scale = glm::vec3(1);
+        Attrib a = { GL_FLOAT, 3, false, sizeof(glm::vec3), std::vector<uint8_t>(size_t(n) * sizeof(glm::vec3)) };
+        std::memcpy(a.data.data(), geometry->positions.data(), a.data.size());
+        attribs.push_back(std::move(a));
+    }
+    // normals
+    if (geometry->has_normals() && (vertex_layout & VERTEX_LAYOUT_OCTAHEDRAL_NORMALS)) {
+        Attrib a = { GL_SHORT, 2, true, 2 * sizeof(int16_t), std::vector<uint8_t>(size_t(n) * 2 * sizeof(int16_t)) };
+        int16_t* dst = (int16_t*)a.data.data();
+        for (uint32_t i = 0; i < n; ++i) {
+            const glm::vec2 e = oct_encode(geometry->normals[i]); // scale invariant, no normalize needed
+            dst[2 * i + 0] = int16_t(std::round(glm::clamp(e.x, -1.f, 1.f) * 32767.f));
+            dst[2 * i + 1] = int16_t(std::round(glm::clamp(e.y, -1.f, 1.f) * 32767.f));
+        }
+        attribs.push_back(std::move(a));
+    } else if (geometry->has_normals()) {
+        Attrib a = { GL_FLOAT, 3, false, sizeof(glm::vec3), std::vector<uint8_t>(size_t(n) * sizeof(glm::vec3)) };
+        std::memcpy(a.data.data(), geometry->normals.data(), a.data.size());
+        attribs.push_back(std::move(a));
+    }
+    // texcoords
+    if (geometry->has_texcoords() && (vertex_layout & VERTEX_LAYOUT_HALF_TEXCOORDS)) {
+        Attrib a = { GL_HALF_FLOAT, 2, false, 2 * sizeof(uint16_t), std::vector<uint8_t>(size_t(n) * 2 * sizeof(uint16_t)) };
+        uint16_t* dst = (uint16_t*)a.data.data();
+        for (uint32_t i = 0; i < n; ++i) {
+            dst[2 * i + 0] = glm::packHalf1x16(geometry->texcoords[i].x);
+            dst[2 * i + 1] = glm::packHalf1x16(geometry->texcoords[i].y);
+        }
+        attribs.push_back(std::move(a));
+    } else if (geometry->has_texcoords()) {
+        Attrib a = { GL_FLOAT, 2, false, sizeof(glm::vec2), std::vector<uint8_t>(size_t(n) * sizeof(glm::vec2)) };
+        std::memcpy(a.data.data(), geometry->texcoords.data(), a.data.size());
+        attribs.push_back(std::move(a));
+    }
+
+    // upload as one interleaved or one buffer per attribute (vbo_types/vbo_dims then describe raw bytes per vertex)
+    num_vertices = n;
+    if (vertex_layout & VERTEX_LAYOUT_INTERLEAVED) {
+        uint32_t stride = 0;
+        for (const auto& a : attribs) stride += a.size;
+        std::vector<uint8_t> interleaved(size_t(n) * stride);
+        uint32_t offset = 0;
+        for (const auto& a : attribs) {
+            for (uint32_t i = 0; i < n; ++i)
+                std::memcpy(&interleaved[size_t(i) * stride + offset], &a.data[size_t(i) * a.size], a.size);
+            offset += a.size;
+        }
+        vbos.emplace_back(name + "_vertex_buffer_0");
+        vbos[0]->upload_data(interleaved.data(), interleaved.size(), GL_STATIC_DRAW);
+        vbo_types.push_back(GL_UNSIGNED_BYTE);
+        vbo_dims.push_back(stride);
+        offset = 0;
+        for (uint32_t i = 0; i < attribs.size(); ++i) {
+            setup_vertex_attrib(vao, i, 0, vbos[0]->id, attribs[i].type, attribs[i].dim, attribs[i].normalized, offset, stride);
+            offset += attribs[i].size;
+        }
+    } else {
+        for (uint32_t i = 0; i < attribs.size(); ++i) {
+            vbos.emplace_back(name + "_vertex_buffer_" + std::to_string(i));
+            vbos[i]->upload_data(attribs[i].data.data(), attribs[i].data.size(), GL_STATIC_DRAW);
+            vbo_types.push_back(GL_UNSIGNED_BYTE);
+            vbo_dims.push_back(attribs[i].size);
+            setup_vertex_attrib(vao, i, i, vbos[i]->id, attribs[i].type, attribs[i].dim, attribs[i].normalized, 0, attribs[i].size);
+        }
+    }
 }
 
 void MeshImpl::bind(const Shader& shader) const {
-    glBindVertexArray(vao);
+    if (arena)
+        arena->bind();
+    else
+        GLState::bind_vertex_array(vao);
     if (material)
         material->bind(shader);
+    // decode parameters of <cppgl/vertex.glsl>
+    if (shader) {
+        shader->uniform("vertex_layout", int(arena ? VERTEX_LAYOUT_SEPARATE : vertex_layout));
+        shader->uniform("vertex_position_offset", position_offset);
+        shader->uniform("vertex_position_scale", position_scale);
+    }
 }
 
-void MeshImpl::draw() const {
-    if (ibo)
-        glDrawElements(primitive_type, num_indices, GL_UNSIGNED_INT, 0);
+void MeshImpl::draw(uint32_t lod) const {
+    if (arena) {
+        const GeometryRange& r = arena->range(arena_alloc);
+        glDrawElementsBaseVertex(primitive_type, r.num_indices, index_type, (void*)(size_t(r.first_index) * index_type_size(index_type)), r.base_vertex);
+    } else if (ibo && lod > 0 && lod < lods.size())
+        glDrawElements(primitive_type, lods[lod].num_indices, index_type, (void*)(size_t(lods[lod].first_index) * index_type_size(index_type)));
+    else if (ibo)
+        glDrawElements(primitive_type, num_indices, index_type, 0);
     else
         glDrawArrays(primitive_type, 0, num_vertices);
 }
 
+void MeshImpl::draw_instanced(uint32_t instance_count) const {
+    if (arena) {
+        const GeometryRange& r = arena->range(arena_alloc);
+        glDrawElementsInstancedBaseVertex(primitive_type, r.num_indices, index_type, (void*)(size_t(r.first_index) * index_type_size(index_type)), instance_count, r.base_vertex);
+    } else if (ibo)
+        glDrawElementsInstanced(primitive_type, num_indices, index_type, 0, instance_count);
+    else
+        glDrawArraysInstanced(primitive_type, 0, num_vertices, instance_count);
+}
+
+void MeshImpl::cull_meshlets(const glm::mat4& model) const {
+    if (!has_meshlets()) return;
+    cppgl::cull_meshlets(std::vector<MeshletCullJob>{ meshlet_cull_job(model) });
+}
+
+MeshletCullJob MeshImpl::meshlet_cull_job(const glm::mat4& model) const {
+    if (!has_meshlets()) return MeshletCullJob{ 0, 0, 0, 0, model, 0, 0 };
+    const uint32_t first_index = arena ? arena->range(arena_alloc).first_index : 0;
+    const int32_t base_vertex = arena ? int32_t(arena->range(arena_alloc).base_vertex) : 0;
+    meshlet_generation = arena ? arena->generation : 0; // the job writes commands at the current location
+    // without indirect count, culled commands are kept with zero instances instead of being compacted
+    return MeshletCullJob{ meshlets->id, meshlet_commands->id, has_indirect_draw_count() ? meshlet_count->id : 0, num_meshlets, model, first_index, base_vertex };
+}
+
+void MeshImpl::draw_meshlets() const {
+    if (!has_meshlets()) return draw();
+    // culled commands point to the old location after the arena moved ranges
+    if (arena && meshlet_generation != arena->generation)
+        write_meshlet_commands();
+    meshlet_commands->bind();
+    if (has_indirect_draw_count()) {
+        GLState::bind_buffer(GL_PARAMETER_BUFFER, meshlet_count->id);
+        if (GLEW_VERSION_4_6)
+            glMultiDrawElementsIndirectCount(primitive_type, index_type, 0, 0, num_meshlets, 0);
+        else
+            glMultiDrawElementsIndirectCountARB(primitive_type, index_type, 0, 0, num_meshlets, 0);
+        GLState::unbind_buffer(GL_PARAMETER_BUFFER);
+    } else
+        glMultiDrawElementsIndirect(primitive_type, index_type, 0, num_meshlets, 0);
+    meshlet_commands->unbind();
+}
+
 void MeshImpl::unbind() const {
-    glBindVertexArray(0);
+    GLState::unbind_vertex_array();
     if (material)
         material->unbind();
 }
 
 uint32_t MeshImpl::add_vertex_buffer(GLenum type, uint32_t element_dim, uint32_t num_vertices, const void* data, GLenum hint) {
+    if (arena)
+        throw std::runtime_error("Mesh::add_vertex_buffer: not supported for meshes stored in a geometry arena!");
     if (this->num_vertices && this->num_vertices != num_vertices)
         throw std::runtime_error("Mesh::add_vertex_buffer: vertex buffer size mismatch!");
     // setup vbo
@@ -100,30 +376,31 @@ uint32_t MeshImpl::add_vertex_buffer(GLenum type, uint32_t element_dim, uint32_t
     vbo_types.push_back(type);
     vbo_dims.push_back(element_dim);
     // setup vertex attributes
-    glBindVertexArray(vao);
-    vbos[buf_id]->bind();;
-    glEnableVertexAttribArray(buf_id);
-    if (type == GL_BYTE || type == GL_UNSIGNED_BYTE ||
-            type == GL_SHORT || type == GL_UNSIGNED_SHORT ||
-            type == GL_INT || type == GL_UNSIGNED_INT)
-        glVertexAttribIPointer(buf_id, element_dim, type, 0, 0);
-    else if (type == GL_DOUBLE)
-        glVertexAttribLPointer(buf_id, element_dim, type, 0, 0);
-    else
-        glVertexAttribPointer(buf_id, element_dim, type, GL_FALSE, 0, 0);
-    glBindVertexArray(0);
-    vbos[buf_id]->unbind();
+    setup_vertex_attrib(vao, buf_id, buf_id, vbos[buf_id]->id, type, element_dim, false, 0, type_to_bytes(type) * element_dim);
     return buf_id;
 }
 
 void MeshImpl::add_index_buffer(uint32_t num_indices, const uint32_t* data, GLenum hint) {
+    if (arena)
+        throw std::runtime_error("Mesh::add_index_buffer: not supported for meshes stored in a geometry arena!");
     this->num_indices = num_indices;
     ibo = IBO(name + "_index_buffer");
-    ibo->upload_data(data, sizeof(uint32_t) * num_indices, hint);
+    const uint32_t max_index = num_indices > 0 ? *std::max_element(data, data + num_indices) : 0;
+    index_type = smallest_index_type(max_index, allow_byte_indices);
+    if (index_type == GL_UNSIGNED_INT)
+        ibo->upload_data(data, sizeof(uint32_t) * num_indices, hint);
+    else {
+        const std::vector<uint8_t> narrowed = convert_indices(data, num_indices, index_type);
+        ibo->upload_data(narrowed.data(), narrowed.size(), hint);
+    }
     // setup vao+ibo
-    glBindVertexArray(vao);
+    if (has_direct_state_access()) {
+        glVertexArrayElementBuffer(vao, ibo->id);
+        return;
+    }
+    GLState::bind_vertex_array(vao);
     ibo->bind();
-    glBindVertexArray(0);
+    GLState::bind_vertex_array(0);
     ibo->unbind();
 }
 
@@ -162,20 +439,42 @@ void MeshImpl::unmap_ibo() const {
 // ------------------------------------------
 // Mesh loader (Ass-Imp)
 
-std::vector<std::pair<Geometry, Material>> load_meshes_cpu(const fs::path& path, bool normalize) {
+ImportedScene import_scene(const fs::path& path, const MeshLoadOptions& options, ImageFutures* images) {
+    const bool normalize = options.normalize, weld = options.weld, optimize = options.optimize;
     // load from disk
-    Assimp::Importer importer;
+    ImportedScene imported;
+    imported.importer = std::make_shared<Assimp::Importer>();
     std::cout << "Loading: " << path << "..." << std::endl;
-    const aiScene* scene_ai = importer.ReadFile(path.string(), aiProcess_Triangulate | aiProcess_GenNormals);// | aiProcess_FlipUVs);
+    const aiScene* scene_ai = imported.importer->ReadFile(path.string(), aiProcess_Triangulate | aiProcess_GenNormals);// | aiProcess_FlipUVs);
     if (!scene_ai) // handle error
         throw std::runtime_error("ERROR: Failed to load file: " + path.string() + "!");
+    imported.scene = scene_ai;
     const std::string base_name = path.filename().replace_extension("").string();
-    // load geometries
-    std::vector<Geometry> geometries;
+    // extract geometries on the worker pool
+    std::vector<std::future<Geometry>> geometry_futures;
     for (uint32_t i = 0; i < scene_ai->mNumMeshes; ++i) {
         const aiMesh* ai_mesh = scene_ai->mMeshes[i];
-        geometries.push_back(Geometry(base_name + "_" + ai_mesh->mName.C_Str() + "_" + std::to_string(i), ai_mesh));
+        const std::string name = base_name + "_" + ai_mesh->mName.C_Str() + "_" + std::to_string(i);
+        // unnamed handle: the Geometry map is iterated on the GL thread, link_materials registers it
+        geometry_futures.push_back(run_async([name, ai_mesh]() {
+            Geometry geometry;
+            geometry.ptr = std::make_shared<GeometryImpl>(name, ai_mesh);
+            return geometry;
+        }));
     }
+    // decode all textures on the worker pool, materials pick them up when created (lazy textures are decoded on first use instead)
+    if (images && !MaterialImpl::lazy_textures) {
+        for (uint32_t i = 0; i < scene_ai->mNumMaterials; ++i)
+            for (const auto& texture_path : MaterialImpl::texture_paths(path.parent_path(), scene_ai->mMaterials[i]))
+                if (!images->count(texture_path))
+                    (*images)[texture_path] = run_async([texture_path]() { return image_load(texture_path); }).share();
+    }
+    // tasks reference the scene, so let all finish before an exception leaves this scope
+    for (auto& future : geometry_futures)
+        future.wait();
+    std::vector<Geometry>& geometries = imported.geometries;
+    for (auto& future : geometry_futures)
+        geometries.push_back(future.get());
     // move and scale geometry to fit into [-1, 1]^3?
     if (normalize) {
         glm::vec3 bb_min(FLT_MAX), bb_max(FLT_MIN);
@@ -192,26 +491,99 @@ std::vector<std::pair<Geometry, Material>> load_meshes_cpu(const fs::path& path,
             geom->scale(glm::vec3(scale_f));
         }
     }
-    // load materials
+    // merge duplicate vertices and optimize triangle and vertex order? (on the worker pool)
+    struct ProcessStats { uint32_t welded; GeometryImpl::CacheStats before, after; };
+    std::vector<std::future<ProcessStats>> process_futures;
+    if (weld || optimize) {
+        for (Geometry geom : geometries) {
+            process_futures.push_back(run_async([geom, weld, optimize]() mutable {
+                ProcessStats stats = { 0, {}, {} };
+                if (weld) stats.welded = geom->weld();
+                if (optimize) {
+                    stats.before = geom->vertex_cache_stats();
+                    geom->optimize(false);
+                    stats.after = geom->vertex_cache_stats();
+                }
+                return stats;
+            }));
+        }
+    }
+    for (auto& future : process_futures)
+        future.wait();
+    for (uint32_t i = 0; i < process_futures.size(); ++i) {
+        const ProcessStats stats = process_futures[i].get();
+        if (stats.welded > 0)
+            std::cout << "Welded " << geometries[i]->name << ": " << stats.welded << " duplicate vertices removed" << std::endl;
+        if (optimize)
+            std::cout << "Optimized " << geometries[i]->name << ": ACMR " << stats.before.acmr << " -> " << stats.after.acmr
+                << ", ATVR " << stats.before.atvr << " -> " << stats.after.atvr << std::endl;
+    }
+    return imported;
+}
+
+std::vector<std::pair<Geometry, Material>> link_materials(const fs::path& path, const ImportedScene& imported, const ImageFutures& images) {
+    // load materials (GL uploads stay on this thread)
+    const aiScene* scene_ai = imported.scene;
+    const std::string base_name = path.filename().replace_extension("").string();
     std::vector<Material> materials;
     for (uint32_t i = 0; i < scene_ai->mNumMaterials; ++i) {
         aiString name_ai;
         scene_ai->mMaterials[i]->Get(AI_MATKEY_NAME, name_ai);
-        materials.push_back(Material(base_name + "_" + name_ai.C_Str(), path.parent_path(), scene_ai->mMaterials[i]));
+        materials.push_back(Material(base_name + "_" + name_ai.C_Str(), path.parent_path(), scene_ai->mMaterials[i], images));
     }
     // link geometry <-> material
     std::vector<std::pair<Geometry, Material>> result;
-    for (uint32_t i = 0; i < scene_ai->mNumMeshes; ++i)
-        result.push_back(std::make_pair(geometries[i], materials[scene_ai->mMeshes[i]->mMaterialIndex]));
+    for (uint32_t i = 0; i < scene_ai->mNumMeshes; ++i) {
+        Geometry::insert(imported.geometries[i]);
+        result.push_back(std::make_pair(imported.geometries[i], materials[scene_ai->mMeshes[i]->mMaterialIndex]));
+    }
+    return result;
+}
+
+// import via assimp
+static std::vector<std::pair<Geometry, Material>> import_meshes(const fs::path& path, const MeshLoadOptions& options) {
+    ImageFutures images;
+    const ImportedScene imported = import_scene(path, options, &images);
+    return link_materials(path, imported, images);
+}
+
+std::vector<std::pair<Geometry, Material>> load_meshes_cpu(const fs::path& path, const MeshLoadOptions& options) {
+    if (!MeshCache::enabled)
+        return import_meshes(path, options);
+    // try binary cache first, (re-)generate it if missing or stale
+    const uint32_t flags = (options.normalize ? 1 : 0) | (options.weld ? 2 : 0) | (options.optimize ? 4 : 0);
+    std::vector<std::pair<Geometry, Material>> result;
+    if (MeshCache::load(path, flags, result)) {
+        std::cout << "Loaded from cache: " << MeshCache::path(path, flags) << std::endl;
+        return result;
+    }
+    result = import_meshes(path, options);
+    try {
+        MeshCache::store(path, flags, result);
+    } catch (const std::exception& e) {
+        std::cerr << "WARN: " << e.what() << std::endl;
+    }
     return result;
 }
 
-std::vector<Mesh> load_meshes_gpu(const fs::path& path, bool normalize) {
+std::vector<Mesh> load_meshes_gpu(const fs::path& path, const MeshLoadOptions& options, const GeometryArena& arena) {
     // build meshes from cpu data
     std::vector<Mesh> meshes;
-    for (const auto& [geometry, material] : load_meshes_cpu(path, normalize))
-        meshes.push_back(Mesh(geometry->name + "/" + material->name, geometry, material));
+    for (const auto& [geometry, material] : load_meshes_cpu(path, options))
+        meshes.push_back(Mesh(geometry->name + "/" + material->name, geometry, material, arena));
     return meshes;
 }
 
+std::vector<std::pair<Geometry, Material>> load_meshes_cpu(const fs::path& path, bool normalize) {
+    MeshLoadOptions options;
+    options.normalize = normalize;
+    return load_meshes_cpu(path, options);
+}
+
+std::vector<Mesh> load_meshes_gpu(const fs::path& path, bool normalize, const GeometryArena& arena) {
+    MeshLoadOptions options;
+    options.normalize = normalize;
+    return load_meshes_gpu(path, options, arena);
+}
+
 CPPGL_NAMESPACE_END
@@ -3,6 +3,7 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <algorithm>
 #include <filesystem>
 namespace fs = std::filesystem;
 #include <GL/glew.h>
@@ -11,15 +12,32 @@ namespace fs = std::filesystem;
 #include "buffer.h"
 #include "geometry.h"
 #include "material.h"
+#include "geometry_arena.h"
+#include "culling.h"
+
+namespace Assimp { class Importer; }
+struct aiScene;
 
 CPPGL_NAMESPACE_BEGIN
 
+// ------------------------------------------
+// Vertex layouts (combinable, decode in shaders via #include <cppgl/vertex.glsl>)
+
+enum VertexLayout : uint32_t {
+    VERTEX_LAYOUT_SEPARATE = 0,                 // one float stream per attribute (32 bytes/vertex)
+    VERTEX_LAYOUT_INTERLEAVED = 1 << 0,         // all attributes in a single stream
+    VERTEX_LAYOUT_QUANTIZED_POSITIONS = 1 << 1, // 4x16 bit unorm positions, normalized to the AABB
+    VERTEX_LAYOUT_OCTAHEDRAL_NORMALS = 1 << 2,  // 2x16 bit snorm octahedral encoded normals
+    VERTEX_LAYOUT_HALF_TEXCOORDS = 1 << 3,      // 2x16 bit half float texcoords
+    VERTEX_LAYOUT_COMPACT = 0xF,                // all of the above (16 bytes/vertex)
+};
+
 // ------------------------------------------
 // Mesh
 
 class MeshImpl {
 public:
-    MeshImpl(const std::string& name, const Geometry& geometry = Geometry(), const Material& material = Material());
+    MeshImpl(const std::string& name, const Geometry& geometry = Geometry(), const Material& material = Material(), const GeometryArena& arena = GeometryArena());
     virtual ~MeshImpl();
 
     // prevent copies and moves, since GL buffers aren't reference counted
@@ -28,23 +46,37 @@ public:
     MeshImpl& operator=(const MeshImpl&&) = delete;
 
     void clear_gpu(); // free gpu resources
-    void upload_gpu(); // cpu -> gpu transfer
+    void upload_gpu(); // cpu -> gpu transfer (into the arena, if given)
+    void set_vertex_layout(uint32_t layout); // VertexLayout flags, re-uploads (ignored for meshes in an arena)
 
     // call in this order to draw
     void bind(const Shader& shader) const;
-    void draw() const;
+    void draw(uint32_t lod = 0) const;
+    void draw_instanced(uint32_t instance_count) const;
     void unbind() const;
 
+    // levels of detail (from geometry->build_lods() before upload, not supported for meshes in an arena)
+    inline uint32_t num_lods() const { return std::max(uint32_t(lods.size()), 1u); }
+
+    // meshlet culling (requires geometry->build_meshlets() before upload and GL 4.3)
+    inline bool has_meshlets() const { return num_meshlets > 0; }
+    // cull meshlets against the current camera, unbinds the current program (call before bind)
+    void cull_meshlets(const glm::mat4& model) const;
+    // arguments of cull_meshlets() for batching many meshes, see DrawelementImpl::cull_meshlets
+    MeshletCullJob meshlet_cull_job(const glm::mat4& model) const;
+    // draw meshlets surviving the last cull (all, if never culled or the arena changed since)
+    void draw_meshlets() const;
+
     // GL vertex and index buffer operations
     uint32_t add_vertex_buffer(GLenum type, uint32_t element_dim, uint32_t num_vertices, const void* data, GLenum hint = GL_STATIC_DRAW);
-    void add_index_buffer(uint32_t num_indices, const uint32_t* data, GLenum hint = GL_STATIC_DRAW);
+    void add_index_buffer(uint32_t num_indices, const uint32_t* data, GLenum hint = GL_STATIC_DRAW); // stored with the smallest sufficient index type
     void update_vertex_buffer(uint32_t buf_id, const void* data); // assumes matching size for buffer buf_id from add_vertex_buffer()
     void set_primitive_type(GLenum type); // default: GL_TRIANGLES
 
     // map/unmap from GPU mem (https://www.seas.upenn.edu/~pcozzi/OpenGLInsights/OpenGLInsights-AsynchronousBufferTransfers.pdf)
     void* map_vbo(uint32_t buf_id, GLenum access = GL_READ_WRITE) const;
     void unmap_vbo(uint32_t buf_id) const;
-    void* map_ibo(GLenum access = GL_READ_WRITE) const;
+    void* map_ibo(GLenum access = GL_READ_WRITE) const; // elements are of index_type
     void unmap_ibo() const;
 
     // CPU data
@@ -52,14 +84,42 @@ public:
     Geometry geometry;
     Material material;
     // GPU data
+    GeometryArena arena;    // if set, geometry lives in the shared arena instead of own buffers
+    uint32_t arena_alloc;   // allocation id within arena
     GLuint vao;
     IBO ibo;
     uint32_t num_vertices;
     uint32_t num_indices;
+    GLenum index_type;      // GL_UNSIGNED_INT, GL_UNSIGNED_SHORT or GL_UNSIGNED_BYTE
     std::vector<VBO> vbos;
     std::vector<GLenum> vbo_types;
     std::vector<uint32_t> vbo_dims;
     GLenum primitive_type;
+    uint32_t vertex_layout;
+    glm::vec3 position_offset, position_scale; // dequantization of positions (identity unless quantized)
+    struct LodRange {
+        uint32_t first_index;
+        uint32_t num_indices;
+        float error;        // object space, see GeometryImpl::Lod
+    };
+    std::vector<LodRange> lods; // all levels incl. the full mesh, stored behind each other in ibo (empty without LODs)
+    uint32_t num_meshlets;
+    SSBO meshlets;                  // GeometryImpl::Meshlet per cluster
+    mutable DIBO meshlet_commands;  // output of cull_meshlets()
+    mutable ACBO meshlet_count;     // number of visible meshlets (if compacted)
+    mutable uint32_t meshlet_generation; // GeometryArenaImpl::generation baked into meshlet_commands
+
+    // vertex layout of newly constructed meshes
+    static uint32_t default_vertex_layout;
+    // allow GL_UNSIGNED_BYTE indices for meshes with at most 256 vertices (default: off, slow path on many GPUs)
+    static bool allow_byte_indices;
+    // let DrawelementImpl::draw draw the meshlets surviving the last DrawelementImpl::cull_meshlets pre-pass (default: off)
+    static bool meshlet_culling;
+
+private:
+    void upload_vertices_packed();
+    void upload_meshlets();
+    void write_meshlet_commands() const; // all meshlets visible, at the current location in the arena
 };
 
 using Mesh = NamedHandle<MeshImpl>;
@@ -68,7 +128,29 @@ template class _API NamedHandle<MeshImpl>; //needed for Windows DLL export
 // ------------------------------------------
 // Mesh loader (Ass-Imp)
 
-std::vector<std::pair<Geometry, Material>> load_meshes_cpu(const fs::path& path, bool normalize = false);
-std::vector<Mesh> load_meshes_gpu(const fs::path& path, bool normalize = false);
+// post-processing of imported geometry (new options are appended, set fields by name)
+struct MeshLoadOptions {
+    bool normalize = false; // move and scale all geometry to fit into [-1, 1]^3
+    bool weld = false;      // merge duplicate vertices (see GeometryImpl::weld)
+    bool optimize = false;  // reorder triangles and vertices for vertex cache, overdraw and vertex fetch (see GeometryImpl::optimize)
+};
+
+std::vector<std::pair<Geometry, Material>> load_meshes_cpu(const fs::path& path, const MeshLoadOptions& options = MeshLoadOptions());
+std::vector<Mesh> load_meshes_gpu(const fs::path& path, const MeshLoadOptions& options = MeshLoadOptions(), const GeometryArena& arena = GeometryArena());
+// shorthands for options with only normalize set
+std::vector<std::pair<Geometry, Material>> load_meshes_cpu(const fs::path& path, bool normalize);
+std::vector<Mesh> load_meshes_gpu(const fs::path& path, bool normalize, const GeometryArena& arena = GeometryArena());
+
+// building blocks of load_meshes_cpu (bypassing the MeshCache), e.g. for AsyncLoader
+struct ImportedScene {
+    std::shared_ptr<Assimp::Importer> importer; // owns scene
+    const aiScene* scene = nullptr;
+    std::vector<Geometry> geometries; // not yet stored in the Geometry map
+};
+// parse file and extract geometries, no GL calls and no handle registration: safe to call from worker threads
+// if images is given, decoding of all referenced textures is started on the worker pool (unless MaterialImpl::lazy_textures)
+ImportedScene import_scene(const fs::path& path, const MeshLoadOptions& options = MeshLoadOptions(), ImageFutures* images = nullptr);
+// create materials (GL thread only), register the geometries and pair both
+std::vector<std::pair<Geometry, Material>> link_materials(const fs::path& path, const ImportedScene& imported, const ImageFutures& images = ImageFutures());
 
 CPPGL_NAMESPACE_END
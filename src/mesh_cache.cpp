@@ -0,0 +1,293 @@
+#include "mesh_cache.h"
+#include "mapped_file.h"
+#include "texture_cache.h"
+#include "capabilities.h"
+#include "state.h"
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// file format
+
+static const char MAGIC[8] = { 'C', 'P', 'P', 'G', 'L', 'M', 'C', '\0' };
+static const size_t ALIGNMENT = 16; // of vertex and index arrays
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    int64_t source_mtime;
+    uint64_t source_size;
+    uint32_t num_geometries;
+    uint32_t num_materials;
+};
+
+enum TextureSource : uint8_t {
+    TEXTURE_FROM_PATH = 0,
+    TEXTURE_FROM_DATA = 1,
+};
+
+// ------------------------------------------
+// helper funcs
+
+// FNV-1a
+static uint64_t path_hash(const std::string& path) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const char c : path)
+        hash = (hash ^ uint8_t(c)) * 1099511628211ull;
+    return hash;
+}
+
+static int64_t source_mtime(const fs::path& source) {
+    return int64_t(fs::last_write_time(source).time_since_epoch().count());
+}
+
+static uint32_t format_channels(GLenum format) {
+    switch (format) {
+    case GL_RED: return 1;
+    case GL_RG: return 2;
+    case GL_RGB: return 3;
+    case GL_RGBA: return 4;
+    default: return 0;
+    }
+}
+
+struct CacheWriter {
+    template <typename T> void write(const T& value) {
+        const uint8_t* p = (const uint8_t*)&value;
+        data.insert(data.end(), p, p + sizeof(T));
+    }
+    void write_string(const std::string& str) {
+        write(uint32_t(str.size()));
+        data.insert(data.end(), str.begin(), str.end());
+    }
+    template <typename T> void write_array(const std::vector<T>& array) {
+        data.resize((data.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT, 0);
+        const uint8_t* p = (const uint8_t*)array.data();
+        data.insert(data.end(), p, p + array.size() * sizeof(T));
+    }
+    template <typename T> void write_map(const std::map<std::string, T>& map) {
+        write(uint32_t(map.size()));
+        for (const auto& [key, value] : map) {
+            write_string(key);
+            write(value);
+        }
+    }
+    std::vector<uint8_t> data;
+};
+
+struct CacheReader {
+    CacheReader(const uint8_t* begin, size_t size) : begin(begin), ptr(begin), end(begin + size) {}
+    void check(size_t bytes) const {
+        if (size_t(end - ptr) < bytes) throw std::runtime_error("MeshCache: unexpected end of file");
+    }
+    template <typename T> T read() {
+        check(sizeof(T));
+        T value;
+        std::memcpy(&value, ptr, sizeof(T));
+        ptr += sizeof(T);
+        return value;
+    }
+    std::string read_string() {
+        const uint32_t size = read<uint32_t>();
+        check(size);
+        const std::string str((const char*)ptr, size);
+        ptr += size;
+        return str;
+    }
+    // arrays are copied straight from the mapping
+    template <typename T> void read_array(std::vector<T>& array, uint32_t count) {
+        ptr = begin + (size_t(ptr - begin) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        check(size_t(count) * sizeof(T));
+        array.resize(count);
+        std::memcpy(array.data(), ptr, size_t(count) * sizeof(T));
+        ptr += size_t(count) * sizeof(T);
+    }
+    template <typename T> void read_map(std::map<std::string, T>& map) {
+        const uint32_t size = read<uint32_t>();
+        for (uint32_t i = 0; i < size; ++i) {
+            const std::string key = read_string();
+            map[key] = read<T>();
+        }
+    }
+    const uint8_t* begin, *ptr, *end;
+};
+
+// ------------------------------------------
+// MeshCache
+
+bool MeshCache::enabled = true;
+fs::path MeshCache::directory = ".cppgl_cache";
+const uint32_t MeshCache::version = 1;
+
+fs::path MeshCache::path(const fs::path& source, uint32_t flags) {
+    const fs::path dir = directory.empty() ? source.parent_path() : directory;
+    // the absolute path hash keeps same-named models from different directories apart in a shared cache directory
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)path_hash(fs::absolute(source).string()));
+    return dir / (source.filename().string() + "." + hash + "." + std::to_string(flags) + ".meshcache");
+}
+
+bool MeshCache::load(const fs::path& source, uint32_t flags, std::vector<std::pair<Geometry, Material>>& meshes) {
+    const fs::path cache_path = path(source, flags);
+    std::error_code ec;
+    if (!fs::exists(cache_path, ec) || !fs::exists(source, ec)) return false;
+    try {
+        const MappedFile file(cache_path);
+        CacheReader reader(file.data(), file.size());
+        const CacheHeader header = reader.read<CacheHeader>();
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != version || header.flags != flags ||
+                header.source_mtime != source_mtime(source) || header.source_size != uint64_t(fs::file_size(source)) ||
+                reader.read_string() != fs::absolute(source).string())
+            return false; // stale
+        // materials
+        std::vector<Material> materials;
+        for (uint32_t m = 0; m < header.num_materials; ++m) {
+            Material material(reader.read_string());
+            reader.read_map(material->int_map);
+            reader.read_map(material->float_map);
+            reader.read_map(material->vec2_map);
+            reader.read_map(material->vec3_map);
+            reader.read_map(material->vec4_map);
+            const uint32_t num_textures = reader.read<uint32_t>();
+            for (uint32_t t = 0; t < num_textures; ++t) {
+                const std::string uniform_name = reader.read_string();
+                const std::string texture_name = reader.read_string();
+                if (reader.read<uint8_t>() == TEXTURE_FROM_PATH)
+                    material->add_texture(uniform_name, texture_name, fs::path(reader.read_string()));
+                else {
+                    const uint32_t w = reader.read<uint32_t>(), h = reader.read<uint32_t>();
+                    const GLint internal_format = reader.read<GLint>();
+                    const GLenum format = reader.read<GLenum>(), type = reader.read<GLenum>();
+                    std::vector<uint8_t> pixels;
+                    reader.read_array(pixels, reader.read<uint32_t>());
+                    material->texture_map[uniform_name] = TextureCache::load(texture_name, w, h, internal_format, format, type, pixels.data());
+                }
+            }
+            materials.push_back(material);
+        }
+        // geometries
+        std::vector<std::pair<Geometry, Material>> result;
+        for (uint32_t g = 0; g < header.num_geometries; ++g) {
+            Geometry geometry(reader.read_string());
+            const uint32_t material_index = reader.read<uint32_t>();
+            if (material_index >= materials.size())
+                throw std::runtime_error("MeshCache: material index out of range");
+            geometry->bb_min = reader.read<glm::vec3>();
+            geometry->bb_max = reader.read<glm::vec3>();
+            const uint32_t num_positions = reader.read<uint32_t>(), num_normals = reader.read<uint32_t>();
+            const uint32_t num_texcoords = reader.read<uint32_t>(), num_indices = reader.read<uint32_t>();
+            reader.read_array(geometry->positions, num_positions);
+            reader.read_array(geometry->normals, num_normals);
+            reader.read_array(geometry->texcoords, num_texcoords);
+            reader.read_array(geometry->indices, num_indices);
+            result.push_back(std::make_pair(geometry, materials[material_index]));
+        }
+        meshes = std::move(result);
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "WARN: MeshCache: ignoring " << cache_path << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+void MeshCache::store(const fs::path& source, uint32_t flags, const std::vector<std::pair<Geometry, Material>>& meshes) {
+    // unique materials
+    std::vector<Material> materials;
+    std::vector<uint32_t> material_indices;
+    for (const auto& [geometry, material] : meshes) {
+        uint32_t index = 0;
+        while (index < materials.size() && materials[index].ptr != material.ptr) ++index;
+        if (index == materials.size()) materials.push_back(material);
+        material_indices.push_back(index);
+    }
+    CacheWriter writer;
+    CacheHeader header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = version;
+    header.flags = flags;
+    header.source_mtime = source_mtime(source);
+    header.source_size = uint64_t(fs::file_size(source));
+    header.num_geometries = uint32_t(meshes.size());
+    header.num_materials = uint32_t(materials.size());
+    writer.write(header);
+    writer.write_string(fs::absolute(source).string());
+    for (const auto& material : materials) {
+        writer.write_string(material->name);
+        writer.write_map(material->int_map);
+        writer.write_map(material->float_map);
+        writer.write_map(material->vec2_map);
+        writer.write_map(material->vec3_map);
+        writer.write_map(material->vec4_map);
+        writer.write(uint32_t(material->texture_map.size()));
+        for (const auto& [uniform_name, texture] : material->texture_map) {
+            writer.write_string(uniform_name);
+            writer.write_string(texture->name);
+            if (!texture->loaded_from_path.empty()) {
+                writer.write(uint8_t(TEXTURE_FROM_PATH));
+                writer.write_string(texture->loaded_from_path.string());
+                continue;
+            }
+            // generated textures (e.g. 1x1 color fallbacks) are read back, packed float layouts (half, RGB9E5) as float
+            const GLenum format = texture->pixel_format();
+            const uint32_t channels = format_channels(format);
+            const bool is_float = texture->type == GL_FLOAT || texture->type == GL_HALF_FLOAT || texture->type == GL_UNSIGNED_INT_5_9_9_9_REV;
+            if (channels == 0 || (!is_float && texture->type != GL_UNSIGNED_BYTE))
+                throw std::runtime_error("MeshCache: unsupported format of texture " + texture->name);
+            const GLenum type = is_float ? GL_FLOAT : GL_UNSIGNED_BYTE;
+            std::vector<uint8_t> pixels(size_t(texture->w) * texture->h * channels * (is_float ? 4 : 1));
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            if (has_direct_state_access())
+                glGetTextureImage(texture->id, 0, format, type, GLsizei(pixels.size()), pixels.data());
+            else {
+                GLState::bind_texture(GL_TEXTURE_2D, texture->id);
+                glGetTexImage(GL_TEXTURE_2D, 0, format, type, pixels.data());
+                GLState::unbind_texture(GL_TEXTURE_2D, texture->id);
+            }
+            // internal format is kept, GL converts on upload
+            writer.write(uint8_t(TEXTURE_FROM_DATA));
+            writer.write(uint32_t(texture->w));
+            writer.write(uint32_t(texture->h));
+            writer.write(texture->internal_format);
+            writer.write(format);
+            writer.write(type);
+            writer.write(uint32_t(pixels.size()));
+            writer.write_array(pixels);
+        }
+    }
+    for (uint32_t i = 0; i < meshes.size(); ++i) {
+        const GeometryImpl& geometry = *meshes[i].first;
+        writer.write_string(geometry.name);
+        writer.write(material_indices[i]);
+        writer.write(geometry.bb_min);
+        writer.write(geometry.bb_max);
+        writer.write(uint32_t(geometry.positions.size()));
+        writer.write(uint32_t(geometry.normals.size()));
+        writer.write(uint32_t(geometry.texcoords.size()));
+        writer.write(uint32_t(geometry.indices.size()));
+        writer.write_array(geometry.positions);
+        writer.write_array(geometry.normals);
+        writer.write_array(geometry.texcoords);
+        writer.write_array(geometry.indices);
+    }
+    // write to a temporary file first, so concurrent readers never see a partial cache
+    const fs::path cache_path = path(source, flags), tmp_path = cache_path.string() + ".tmp";
+    std::error_code ec;
+    if (cache_path.has_parent_path())
+        fs::create_directories(cache_path.parent_path(), ec); // failure shows up when opening the file
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file || !file.write((const char*)writer.data.data(), writer.data.size()))
+            throw std::runtime_error("MeshCache: failed to write: " + tmp_path.string());
+    }
+    fs::rename(tmp_path, cache_path);
+}
+
+CPPGL_NAMESPACE_END
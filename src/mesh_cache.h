@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <filesystem>
+namespace fs = std::filesystem;
+#include "platform.h"
+#include "geometry.h"
+#include "material.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// MeshCache (versioned binary cache of imported geometry and materials, bypasses assimp in load_meshes_cpu)
+// A cache file is keyed by the source path, its modification time and size, and the import flags.
+// Files are memory mapped on load, so vertex and index arrays are copied straight out of the mapping without parsing.
+
+class MeshCache {
+public:
+    // cache file for the given source and import flags (<file>.<absolute path hash>.<flags>.meshcache)
+    static fs::path path(const fs::path& source, uint32_t flags);
+    // returns false if there is no cache, or it is stale (source modified, other flags or format version) or corrupt
+    static bool load(const fs::path& source, uint32_t flags, std::vector<std::pair<Geometry, Material>>& meshes);
+    // write (or overwrite) the cache, throws std::runtime_error on failure
+    static void store(const fs::path& source, uint32_t flags, const std::vector<std::pair<Geometry, Material>>& meshes);
+
+    static bool enabled;        // use the cache in load_meshes_cpu (default: true)
+    static fs::path directory;  // where to put cache files (default: ".cppgl_cache" in the working directory, empty: next to the source file)
+    static const uint32_t version;
+};
+
+CPPGL_NAMESPACE_END
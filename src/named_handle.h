@@ -24,10 +24,10 @@ public:
     template <class... Args> NamedHandle(const std::string& name, Args&&... args) : ptr(std::make_shared<T>(name, args...)) {
         static_assert(HasName<T>::value, "Template type T is required to have a member \"name\"!");
         static_assert(std::is_same<decltype(T::name), std::string>::value || std::is_same<decltype(T::name), const std::string>::value, "bad type bro");
+        const std::lock_guard<std::mutex> lock(mutex);
 #ifndef NDEBUG
         if (map.count(ptr->name)) std::cerr << "Warning: Name \"" << ptr->name << "\" is not unique!" << std::endl;
 #endif
-        const std::lock_guard<std::mutex> lock(mutex);
         map[ptr->name] = *this;
     }
 
@@ -56,8 +56,19 @@ public:
         const std::lock_guard<std::mutex> lock(mutex);
         return map[name];
     }
+    // store an existing handle (e.g. created unnamed on a worker thread) in the map under its name
+    static void insert(const NamedHandle<T>& handle) {
+        const std::lock_guard<std::mutex> lock(mutex);
+        map[handle->name] = handle;
+    }
+    // store an existing handle under an additional name (alias, the object keeps its own name)
+    static void insert(const std::string& name, const NamedHandle<T>& handle) {
+        const std::lock_guard<std::mutex> lock(mutex);
+        map[name] = handle;
+    }
     // remove element from map for given name
     static void erase(const std::string& name) {
+        const std::lock_guard<std::mutex> lock(mutex);
         map.erase(name);
     }
     // clear saved handles and free unsused memory
@@ -0,0 +1,208 @@
+#include "pixel_convert.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#if defined(__SSSE3__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// helper funcs
+
+static uint16_t half_from_float(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    const uint16_t sign = uint16_t((x >> 16) & 0x8000);
+    x &= 0x7FFFFFFF;
+    if (x >= 0x7F800000) return sign | (x > 0x7F800000 ? 0x7E00 : 0x7C00); // NaN, inf
+    if (x >= 0x477FF000) return sign | 0x7C00; // rounds to >= 65520: inf
+    if (x < 0x38800000) { // subnormal half (< 2^-14)
+        if (x <= 0x33000000) return sign; // <= 2^-25 rounds to 0
+        const uint32_t m = (x & 0x7FFFFF) | 0x800000, shift = 126 - (x >> 23);
+        const uint32_t rem = m & ((1u << shift) - 1), half = 1u << (shift - 1);
+        uint32_t h = m >> shift;
+        if (rem > half || (rem == half && (h & 1))) h++;
+        return sign | uint16_t(h);
+    }
+    // rebias exponent, round mantissa to nearest even (a carry correctly bumps the exponent)
+    uint32_t h = (x - 0x38000000) >> 13;
+    const uint32_t rem = x & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return sign | uint16_t(h);
+}
+
+static float srgb_encode(float x) {
+    return x <= 0.0031308f ? 12.92f * x : 1.055f * std::pow(x, 1.f / 2.4f) - 0.055f;
+}
+
+static float srgb_decode(float x) {
+    return x <= 0.04045f ? x / 12.92f : std::pow((x + 0.055f) / 1.055f, 2.4f);
+}
+
+// encode: indexed by exponent and top 10 mantissa bits of floats in [2^-13, 1), below that the result rounds to 0
+static const uint32_t SRGB_ENCODE_MIN_BITS = 0x39000000; // 2^-13
+static const uint32_t SRGB_ENCODE_ONE_BITS = 0x3F800000; // 1.0
+static const uint32_t SRGB_ENCODE_SHIFT = 13;
+
+struct SRGBTables {
+    float decode[256];
+    uint8_t encode[(SRGB_ENCODE_ONE_BITS - SRGB_ENCODE_MIN_BITS) >> SRGB_ENCODE_SHIFT];
+
+    SRGBTables() {
+        for (int i = 0; i < 256; ++i)
+            decode[i] = srgb_decode(i / 255.f);
+        for (uint32_t i = 0; i < sizeof(encode); ++i) {
+            // evaluate at the bucket center
+            const uint32_t bits = SRGB_ENCODE_MIN_BITS + (i << SRGB_ENCODE_SHIFT) + (1u << (SRGB_ENCODE_SHIFT - 1));
+            float x;
+            memcpy(&x, &bits, sizeof(x));
+            encode[i] = uint8_t(std::min(srgb_encode(x) * 255.f + 0.5f, 255.f));
+        }
+    }
+};
+
+static const SRGBTables& srgb_tables() {
+    static const SRGBTables tables;
+    return tables;
+}
+
+// ------------------------------------------
+// swizzles
+
+void swizzle_u8(const uint8_t* src, uint32_t src_channels, uint8_t* dst, uint32_t dst_channels, const uint8_t* order, size_t pixels) {
+    size_t i = 0;
+#ifdef __SSSE3__
+    // as many pixels as fit into 16 bytes on both sides per shuffle, stores overlap into the next step
+    const uint32_t step = 16 / std::max(src_channels, dst_channels);
+    alignas(16) uint8_t shuffle[16], ones[16];
+    for (uint32_t j = 0; j < 16; ++j) {
+        const uint32_t p = j / dst_channels, c = j % dst_channels;
+        const bool constant = p >= step || order[c] == SWIZZLE_ONE;
+        shuffle[j] = constant ? 0x80 : uint8_t(p * src_channels + order[c]);
+        ones[j] = p < step && order[c] == SWIZZLE_ONE ? 0xFF : 0;
+    }
+    const __m128i mask = _mm_load_si128((const __m128i*)shuffle), one = _mm_load_si128((const __m128i*)ones);
+    const size_t src_bytes = pixels * src_channels, dst_bytes = pixels * dst_channels;
+    for (; i * src_channels + 16 <= src_bytes && i * dst_channels + 16 <= dst_bytes; i += step) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + i * src_channels));
+        _mm_storeu_si128((__m128i*)(dst + i * dst_channels), _mm_or_si128(_mm_shuffle_epi8(v, mask), one));
+    }
+#endif
+    for (; i < pixels; ++i)
+        for (uint32_t c = 0; c < dst_channels; ++c)
+            dst[i * dst_channels + c] = order[c] == SWIZZLE_ONE ? 255 : src[i * src_channels + order[c]];
+}
+
+void rgb_to_rgba(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    static const uint8_t order[4] = { 0, 1, 2, SWIZZLE_ONE };
+    swizzle_u8(src, 3, dst, 4, order, pixels);
+}
+
+void bgra_to_rgb(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    static const uint8_t order[3] = { 2, 1, 0 };
+    swizzle_u8(src, 4, dst, 3, order, pixels);
+}
+
+void bgra_to_rgba(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    static const uint8_t order[4] = { 2, 1, 0, 3 };
+    swizzle_u8(src, 4, dst, 4, order, pixels);
+}
+
+// ------------------------------------------
+// float packing
+
+void float_to_rgba(const float* src, uint32_t src_channels, float* dst, size_t pixels) {
+    if (src_channels == 4) {
+        memcpy(dst, src, pixels * 4 * sizeof(float));
+        return;
+    }
+    for (size_t i = 0; i < pixels; ++i) {
+        const float* s = src + i * src_channels;
+        float* d = dst + i * 4;
+        d[0] = s[0];
+        d[1] = src_channels > 1 ? s[1] : 0.f;
+        d[2] = src_channels > 2 ? s[2] : 0.f;
+        d[3] = 1.f;
+    }
+}
+
+void float_to_half(const float* src, uint16_t* dst, size_t count) {
+    size_t i = 0;
+#if defined(__F16C__) && defined(__AVX__)
+    for (; i + 8 <= count; i += 8)
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+#elif defined(__F16C__)
+    for (; i + 4 <= count; i += 4)
+        _mm_storel_epi64((__m128i*)(dst + i), _mm_cvtps_ph(_mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+    for (; i < count; ++i)
+        dst[i] = half_from_float(src[i]);
+}
+
+void float_to_rgb9e5(const float* src, uint32_t src_channels, uint32_t* dst, size_t pixels) {
+    // see GL_EXT_texture_shared_exponent: 9 bit mantissas, 5 bit exponent with bias 15
+    const float max_value = 65408.f; // (2^9 - 1) / 2^9 * 2^(31 - 15)
+    for (size_t i = 0; i < pixels; ++i) {
+        float rgb[3];
+        for (uint32_t c = 0; c < 3; ++c) {
+            const float v = c < src_channels ? src[i * src_channels + c] : 0.f;
+            rgb[c] = v > 0.f ? std::min(v, max_value) : 0.f; // also maps NaN to 0
+        }
+        const float max_c = std::max(rgb[0], std::max(rgb[1], rgb[2]));
+        if (max_c <= 0.f) {
+            dst[i] = 0;
+            continue;
+        }
+        int exponent;
+        std::frexp(max_c, &exponent); // max_c = m * 2^exponent, m in [0.5, 1)
+        int shared = std::max(-16, exponent - 1) + 16;
+        if (std::floor(std::ldexp(max_c, 24 - shared) + 0.5f) >= 512.f) shared++;
+        uint32_t packed = uint32_t(shared) << 27;
+        for (uint32_t c = 0; c < 3; ++c)
+            packed |= std::min(uint32_t(std::floor(std::ldexp(rgb[c], 24 - shared) + 0.5f)), 511u) << (9 * c);
+        dst[i] = packed;
+    }
+}
+
+// ------------------------------------------
+// sRGB
+
+void linear_to_srgb(const float* src, uint8_t* dst, size_t count) {
+    const SRGBTables& tables = srgb_tables();
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t bits;
+        memcpy(&bits, &src[i], sizeof(bits));
+        // negative floats compare larger than 1.0 as unsigned, so test the sign first (NaN maps to 0 or 255)
+        if ((bits & 0x80000000) || bits < SRGB_ENCODE_MIN_BITS)
+            dst[i] = 0;
+        else if (bits >= SRGB_ENCODE_ONE_BITS)
+            dst[i] = 255;
+        else
+            dst[i] = tables.encode[(bits - SRGB_ENCODE_MIN_BITS) >> SRGB_ENCODE_SHIFT];
+    }
+}
+
+void srgb_to_linear(const uint8_t* src, float* dst, size_t count) {
+    const SRGBTables& tables = srgb_tables();
+    for (size_t i = 0; i < count; ++i)
+        dst[i] = tables.decode[src[i]];
+}
+
+// ------------------------------------------
+// rows
+
+void flip_rows(const void* src, void* dst, size_t row_bytes, size_t rows) {
+    const uint8_t* s = (const uint8_t*)src;
+    uint8_t* d = (uint8_t*)dst;
+    if (s == d) {
+        for (size_t y = 0; y < rows / 2; ++y)
+            std::swap_ranges(d + y * row_bytes, d + (y + 1) * row_bytes, d + (rows - 1 - y) * row_bytes);
+        return;
+    }
+    for (size_t y = 0; y < rows; ++y)
+        memcpy(d + y * row_bytes, s + (rows - 1 - y) * row_bytes, row_bytes);
+}
+
+CPPGL_NAMESPACE_END
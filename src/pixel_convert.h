@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "platform.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// Pixel format conversion kernels (SSSE3/F16C/AVX paths selected at compile time, see -march=native, scalar fallback)
+// Thread-safe, does not touch GL. src and dst must not overlap unless noted.
+
+// swizzle_u8 order entry: write 255 instead of a source channel
+static const uint8_t SWIZZLE_ONE = 0xFF;
+
+// reorder, drop or add 8 bit channels: dst channel i = src channel order[i] (or 255 for SWIZZLE_ONE), 1-4 channels each
+void swizzle_u8(const uint8_t* src, uint32_t src_channels, uint8_t* dst, uint32_t dst_channels, const uint8_t* order, size_t pixels);
+// common swizzles
+void rgb_to_rgba(const uint8_t* src, uint8_t* dst, size_t pixels); // alpha = 255
+void bgra_to_rgb(const uint8_t* src, uint8_t* dst, size_t pixels);
+void bgra_to_rgba(const uint8_t* src, uint8_t* dst, size_t pixels);
+
+// float channels to 4, missing color channels are 0, missing alpha is 1
+void float_to_rgba(const float* src, uint32_t src_channels, float* dst, size_t pixels);
+// IEEE half floats, round to nearest even (values beyond the half range become inf)
+void float_to_half(const float* src, uint16_t* dst, size_t count);
+// GL_RGB9_E5 shared exponent packing of the first three channels (negatives clamp to 0)
+void float_to_rgb9e5(const float* src, uint32_t src_channels, uint32_t* dst, size_t pixels);
+
+// sRGB transfer function, 8 bit encoded <-> linear float (clamped to [0, 1] when encoding)
+void linear_to_srgb(const float* src, uint8_t* dst, size_t count);
+void srgb_to_linear(const uint8_t* src, float* dst, size_t count);
+
+// reverse row order (GL bottom-up <-> top-down), src == dst flips in place
+void flip_rows(const void* src, void* dst, size_t row_bytes, size_t rows);
+
+CPPGL_NAMESPACE_END
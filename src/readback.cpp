@@ -0,0 +1,223 @@
+#include "readback.h"
+#include <list>
+#include <future>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include "capabilities.h"
+#include "image_load_store.h"
+#include "thread_pool.h"
+#include "state.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// helper funcs
+
+static uint32_t format_channels(GLenum format) {
+    switch (format) {
+    case GL_RG: return 2;
+    case GL_RGB: case GL_BGR: return 3;
+    case GL_RGBA: case GL_BGRA: return 4;
+    default: return 1; // GL_RED, GL_DEPTH_COMPONENT, ...
+    }
+}
+
+static uint32_t type_bytes(GLenum type) {
+    switch (type) {
+    case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: return 2;
+    case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT: return 4;
+    default: return 1;
+    }
+}
+
+static bool is_depth_format(GLenum format) {
+    return format == GL_DEPTH_COMPONENT || format == GL_DEPTH_STENCIL || format == GL_STENCIL_INDEX;
+}
+
+// glReadPixels into the bound pack buffer, restores the read framebuffer binding and its read buffer
+static void read_pixels(GLuint framebuffer, GLenum attachment, int x, int y, int w, int h, GLenum format, GLenum type) {
+    GLint prev_framebuffer = 0, prev_read_buffer = 0;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prev_framebuffer);
+    GLState::bind_framebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    if (!is_depth_format(format)) {
+        glGetIntegerv(GL_READ_BUFFER, &prev_read_buffer);
+        glReadBuffer(attachment);
+    }
+    glReadPixels(x, y, w, h, format, type, nullptr);
+    if (!is_depth_format(format))
+        glReadBuffer(GLenum(prev_read_buffer));
+    GLState::bind_framebuffer(GL_READ_FRAMEBUFFER, GLuint(prev_framebuffer));
+}
+
+// ------------------------------------------
+// readback state
+
+struct PendingReadback {
+    std::unique_ptr<Readback> readback;
+    Readback::Callback on_ready;
+    fs::path store_path; // store() instead of on_ready
+    bool flip;
+    std::future<void> writing;
+};
+static std::list<PendingReadback> pending_readbacks;
+static std::vector<std::unique_ptr<GLBufferImpl<GL_PIXEL_PACK_BUFFER>>> free_pbos;
+static const size_t MAX_FREE_PBOS = 8;
+static uint32_t num_pbos = 0;
+
+// ------------------------------------------
+// Readback
+
+Readback::Readback(const Texture2DImpl& texture, GLenum type, int x, int y, int w, int h, uint32_t level)
+    : w(w > 0 ? w : std::max(texture.w >> level, 1)), h(h > 0 ? h : std::max(texture.h >> level, 1)), format(texture.pixel_format()), type(type),
+    fence(nullptr), mapped(nullptr) {
+    begin();
+    const GLenum attachment = is_depth_format(format) ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0;
+    if (has_direct_state_access())
+        glGetTextureSubImage(texture.id, level, x, y, 0, this->w, this->h, 1, format, type, GLsizei(size_bytes()), nullptr);
+    else if (x == 0 && y == 0 && this->w == std::max(texture.w >> level, 1) && this->h == std::max(texture.h >> level, 1)) {
+        GLState::bind_texture(GL_TEXTURE_2D, texture.id);
+        glGetTexImage(GL_TEXTURE_2D, level, format, type, nullptr);
+        GLState::unbind_texture(GL_TEXTURE_2D, texture.id);
+    } else { // sub-rectangle via a temporary framebuffer (the caller's read binding is restored)
+        GLint prev_framebuffer = 0;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prev_framebuffer);
+        GLuint framebuffer;
+        glGenFramebuffers(1, &framebuffer);
+        GLState::bind_framebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture.id, level);
+        read_pixels(framebuffer, attachment, x, y, this->w, this->h, format, type);
+        GLState::bind_framebuffer(GL_READ_FRAMEBUFFER, GLuint(prev_framebuffer));
+        GLState::forget_framebuffer(framebuffer);
+        glDeleteFramebuffers(1, &framebuffer);
+    }
+    end();
+}
+
+Readback::Readback(GLuint framebuffer, GLenum attachment, int x, int y, int w, int h, GLenum format, GLenum type)
+    : w(w), h(h), format(format), type(type), fence(nullptr), mapped(nullptr) {
+    begin();
+    read_pixels(framebuffer, attachment, x, y, w, h, format, type);
+    end();
+}
+
+Readback::~Readback() {
+    if (fence) glDeleteSync(fence);
+    if (mapped) {
+        if (has_direct_state_access())
+            glUnmapNamedBuffer(pbo->id);
+        else {
+            pbo->bind();
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            pbo->unbind();
+        }
+    }
+    if (free_pbos.size() < MAX_FREE_PBOS)
+        free_pbos.push_back(std::move(pbo));
+}
+
+void Readback::begin() {
+    channels = format_channels(format);
+    bytes_per_channel = type_bytes(type);
+    // recycle a PBO (not registered as NamedHandle, since readbacks are transient)
+    if (!free_pbos.empty()) {
+        pbo = std::move(free_pbos.back());
+        free_pbos.pop_back();
+    } else
+        pbo = std::make_unique<GLBufferImpl<GL_PIXEL_PACK_BUFFER>>("cppgl_readback_" + std::to_string(num_pbos++));
+    if (pbo->size_bytes < size_bytes())
+        pbo->resize(size_bytes(), GL_STREAM_READ);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    pbo->bind();
+}
+
+void Readback::end() {
+    pbo->unbind();
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool Readback::ready() {
+    if (mapped) return true;
+    if (fence) {
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) return false;
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (has_direct_state_access())
+        mapped = glMapNamedBufferRange(pbo->id, 0, size_bytes(), GL_MAP_READ_BIT);
+    else {
+        pbo->bind();
+        mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size_bytes(), GL_MAP_READ_BIT);
+        pbo->unbind();
+    }
+    return true;
+}
+
+const void* Readback::wait() {
+    if (fence) {
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while (result == GL_TIMEOUT_EXPIRED)
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1ms
+    }
+    ready();
+    return mapped;
+}
+
+void Readback::enqueue(std::unique_ptr<Readback> readback, const Callback& on_ready) {
+    pending_readbacks.push_back(PendingReadback{ std::move(readback), on_ready, fs::path(), false, std::future<void>() });
+}
+
+void Readback::store(std::unique_ptr<Readback> readback, const fs::path& path, bool flip) {
+    pending_readbacks.push_back(PendingReadback{ std::move(readback), Callback(), path, flip, std::future<void>() });
+}
+
+void Readback::update() {
+    for (auto it = pending_readbacks.begin(); it != pending_readbacks.end();) {
+        PendingReadback& pending = *it;
+        if (pending.writing.valid()) { // keep mapped until the writer is done
+            if (pending.writing.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                ++it;
+                continue;
+            }
+            try {
+                pending.writing.get();
+            } catch (const std::exception& e) {
+                std::cerr << "WARN: Readback: " << e.what() << std::endl;
+            }
+            it = pending_readbacks.erase(it);
+            continue;
+        }
+        if (!pending.readback->ready()) {
+            ++it;
+            continue;
+        }
+        if (!pending.store_path.empty()) {
+            const Readback* readback = pending.readback.get();
+            const fs::path path = pending.store_path;
+            const bool flip = pending.flip;
+            pending.writing = ThreadPool::global().enqueue([readback, path, flip]() {
+                if (readback->type == GL_FLOAT)
+                    image_store_hdr(path, (const float*)readback->data(), readback->w, readback->h, readback->channels, flip);
+                else
+                    image_store_ldr(path, (const uint8_t*)readback->data(), readback->w, readback->h, readback->channels, flip);
+            });
+            ++it;
+            continue;
+        }
+        if (pending.on_ready) pending.on_ready(*pending.readback);
+        it = pending_readbacks.erase(it);
+    }
+}
+
+void Readback::clear() {
+    for (auto& pending : pending_readbacks)
+        if (pending.writing.valid()) pending.writing.wait();
+    pending_readbacks.clear();
+    free_pbos.clear();
+}
+
+uint32_t Readback::pending() {
+    return uint32_t(pending_readbacks.size());
+}
+
+CPPGL_NAMESPACE_END
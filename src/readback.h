@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <functional>
+#include <filesystem>
+namespace fs = std::filesystem;
+#include <GL/glew.h>
+#include <GL/gl.h>
+#include "platform.h"
+#include "buffer.h"
+#include "texture.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// Readback (asynchronous GPU -> CPU pixel transfer into a PPBO, completion is tracked with a GLsync fence)
+// Transient, so not a NamedHandle. GL thread only, except for reading data() while mapped.
+
+class Readback {
+public:
+    // pixels are only valid during the call
+    using Callback = std::function<void(const Readback&)>;
+
+    // queue read of (a sub-rectangle of) a texture level, w/h = 0: whole level
+    Readback(const Texture2DImpl& texture, GLenum type = GL_UNSIGNED_BYTE, int x = 0, int y = 0, int w = 0, int h = 0, uint32_t level = 0);
+    // queue read of a framebuffer attachment (framebuffer 0 with GL_BACK/GL_FRONT: default framebuffer)
+    Readback(GLuint framebuffer, GLenum attachment, int x, int y, int w, int h, GLenum format = GL_RGB, GLenum type = GL_UNSIGNED_BYTE);
+    virtual ~Readback();
+
+    // prevent copies and moves, the PBO may be mapped
+    Readback(const Readback&) = delete;
+    Readback& operator=(const Readback&) = delete;
+
+    // non-blocking poll, maps the PBO once the GPU is done
+    bool ready();
+    // block until the data arrived
+    const void* wait();
+    // tightly packed rows (bottom row first, like GL), nullptr until ready
+    inline const void* data() const { return mapped; }
+    inline size_t size_bytes() const { return size_t(w) * h * channels * bytes_per_channel; }
+
+    // fire and forget: call on_ready on the GL thread once the data arrived (polled in Context::swap_buffers)
+    static void enqueue(std::unique_ptr<Readback> readback, const Callback& on_ready);
+    // fire and forget: write to disk once arrived, encoded on a worker straight from the mapped PBO
+    // (.png/.jpg/.tga/.bmp for GL_UNSIGNED_BYTE, .hdr for GL_FLOAT)
+    static void store(std::unique_ptr<Readback> readback, const fs::path& path, bool flip = true);
+    // poll queued readbacks (called by Context::swap_buffers)
+    static void update();
+    // wait for and drop all queued readbacks (called on context destruction)
+    static void clear();
+    // number of queued readbacks (incl. those still being written)
+    static uint32_t pending();
+
+    // data
+    int w, h;
+    uint32_t channels, bytes_per_channel;
+    GLenum format, type;
+
+private:
+    void begin(); // allocate PBO, set pack state
+    void end();   // fence
+
+    std::unique_ptr<GLBufferImpl<GL_PIXEL_PACK_BUFFER>> pbo; // recycled between readbacks
+    GLsync fence;
+    void* mapped;
+};
+
+CPPGL_NAMESPACE_END
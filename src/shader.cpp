@@ -1,8 +1,13 @@
 #include "shader.h"
+#include "state.h"
+#include "camera.h"
+#include "drawelement.h"
+#include "draw_bucket.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <cstring>
 #include <glm/gtc/type_ptr.hpp>
 
 CPPGL_NAMESPACE_BEGIN
@@ -10,6 +15,61 @@ CPPGL_NAMESPACE_BEGIN
 // paths where to search for shader files  
 std::vector<fs::path> ShaderImpl::shader_search_paths = {};  
 
+// ----------------------------------------------------
+// builtin #include files (used if no file of that name exists next to the shader)
+
+static const std::map<std::string, std::string> builtin_includes = {
+    // per-frame camera data, see CameraImpl::update() for the std140 layout
+    { "cppgl/camera.glsl", R"(
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 view_normal;
+    mat4 proj;
+    vec4 camera_pos;
+    vec4 camera_dir;
+};
+)" },
+    // per-instance data of InstancedDrawelements, index with gl_InstanceID (requires #version 430)
+    { "cppgl/instancing.glsl", R"(
+struct Instance {
+    mat4 model;
+    mat4 model_normal;
+    vec4 data;
+};
+layout(std430, binding = )" + std::to_string(InstancedDrawelementImpl::ssbo_binding) + R"() readonly buffer Instances {
+    Instance instances[];
+};
+)" },
+    // per-draw data and draw id of DrawBucket multi draws (requires #version 430)
+    { "cppgl/multidraw.glsl", R"(
+layout(location = )" + std::to_string(GeometryArenaImpl::draw_id_location) + R"() in uint in_draw_id;
+struct DrawData {
+    mat4 model;
+    mat4 model_normal;
+    vec4 data;
+};
+layout(std430, binding = )" + std::to_string(DrawBucketImpl::ssbo_binding) + R"() readonly buffer Draws {
+    DrawData draws[];
+};
+)" },
+    // decoding of compressed vertex layouts (see VertexLayout), parameters are set in MeshImpl::bind()
+    { "cppgl/vertex.glsl", R"(
+uniform int vertex_layout;
+uniform vec3 vertex_position_offset;
+uniform vec3 vertex_position_scale;
+vec3 decode_position(vec4 p) {
+    return (vertex_layout & )" + std::to_string(VERTEX_LAYOUT_QUANTIZED_POSITIONS) + R"() != 0 ? vertex_position_offset + p.xyz * vertex_position_scale : p.xyz;
+}
+vec3 decode_normal(vec3 n) {
+    if ((vertex_layout & )" + std::to_string(VERTEX_LAYOUT_OCTAHEDRAL_NORMALS) + R"() == 0) return n;
+    vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+    float t = max(-v.z, 0.0);
+    v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);
+    return normalize(v);
+}
+)" },
+};
+
 // ----------------------------------------------------
 // helper funcs
 
@@ -48,9 +108,14 @@ static std::string get_log(GLuint object) {
 }
 
 static GLuint compile_shader(GLenum type, ShaderImpl& impl) {
-    std::cout << "Loading: " << impl.source_files[type] << "..." << std::endl;
-    std::string source = read_file(impl.source_files[type]);
-    impl.timestamps[type] = fs::last_write_time(impl.source_files[type]);
+    std::string source;
+    if (impl.source_strings.count(type))
+        source = impl.source_strings[type];
+    else {
+        std::cout << "Loading: " << impl.source_files[type] << "..." << std::endl;
+        source = read_file(impl.source_files[type]);
+        impl.timestamps[type] = fs::last_write_time(impl.source_files[type]);
+    }
     if (source.empty())
         throw std::runtime_error("ERROR: Trying to compile shader from empty source!");
 
@@ -75,7 +140,7 @@ static GLuint compile_shader(GLenum type, ShaderImpl& impl) {
             throw std::runtime_error("ERROR: Failed to parse #include string: " + inc_str);
 
         // read #include-file
-        fs::path p = impl.source_files[type];
+        fs::path p = impl.source_files.count(type) ? impl.source_files[type] : fs::path();
         p = p.remove_filename() / inc_file;
         std::ifstream f(p.c_str(), std::ios::in);
         if (f.is_open()) {
@@ -84,11 +149,12 @@ static GLuint compile_shader(GLenum type, ShaderImpl& impl) {
                 inc_src += line + "\n";
             // replace #include with file
             source.replace(inc_at, inc_to - inc_at, inc_src);
+            // store include file timestamp for reloads
+            impl.include_timestamps[p] = fs::last_write_time(p);
+        } else if (builtin_includes.count(inc_file)) {
+            source.replace(inc_at, inc_to - inc_at, builtin_includes.at(inc_file));
         } else
             throw std::runtime_error("ERROR: Failed to open #include file: " + inc_str);
-
-        // store include file timestamp for reloads
-        impl.include_timestamps[p] = fs::last_write_time(p);
     }
 
     // actually compile shader
@@ -141,20 +207,20 @@ bool reload_modified_shaders() {
 // ----------------------------------------------------
 // ShaderImpl
 
-ShaderImpl::ShaderImpl(const std::string& name) : name(name), id(0) {}
+ShaderImpl::ShaderImpl(const std::string& name) : name(name), id(0), uses_camera_block(false) {}
 
-ShaderImpl::ShaderImpl(const std::string& name, const fs::path& compute_source) : name(name), id(0) {
+ShaderImpl::ShaderImpl(const std::string& name, const fs::path& compute_source) : name(name), id(0), uses_camera_block(false) {
     set_compute_source(compute_source);
     compile();
 }
 
-ShaderImpl::ShaderImpl(const std::string& name, const fs::path& vertex_source, const fs::path& fragment_source) : name(name), id(0)  {
+ShaderImpl::ShaderImpl(const std::string& name, const fs::path& vertex_source, const fs::path& fragment_source) : name(name), id(0), uses_camera_block(false) {
     set_vertex_source(vertex_source);
     set_fragment_source(fragment_source);
     compile();
 }
 
-ShaderImpl::ShaderImpl(const std::string& name, const fs::path& vertex_source, const fs::path& geometry_source, const fs::path& fragment_source) : name(name), id(0)  {
+ShaderImpl::ShaderImpl(const std::string& name, const fs::path& vertex_source, const fs::path& geometry_source, const fs::path& fragment_source) : name(name), id(0), uses_camera_block(false) {
     set_vertex_source(vertex_source);
     set_geometry_source(geometry_source);
     set_fragment_source(fragment_source);
@@ -166,16 +232,21 @@ ShaderImpl::~ShaderImpl() {
 }
 
 void ShaderImpl::clear() {
+    GLState::forget_program(id);
     if (glIsProgram(id))
         glDeleteProgram(id);
     id = 0;
     source_files.clear();
     timestamps.clear();
+    source_strings.clear();
+    uniforms.clear();
+    uniform_shadows.clear();
+    uses_camera_block = false;
 }
 
-void ShaderImpl::bind() const { glUseProgram(id); }
+void ShaderImpl::bind() const { GLState::use_program(id); }
 
-void ShaderImpl::unbind() const { glUseProgram(0); }
+void ShaderImpl::unbind() const { GLState::unbind_program(); }
 
 void ShaderImpl::set_source(GLenum type, const fs::path& path) {
     if (!fs::exists(path)) {
@@ -225,10 +296,14 @@ void ShaderImpl::set_compute_source(const fs::path& path) {
     set_source(GL_COMPUTE_SHADER, path);
 }
 
+void ShaderImpl::set_source_string(GLenum type, const std::string& source) {
+    source_strings[type] = source;
+}
+
 void ShaderImpl::compile() {
     // compile shaders
     GLuint program = glCreateProgram();
-    if (source_files.count(GL_COMPUTE_SHADER)) { // is compute shader
+    if (has_source(GL_COMPUTE_SHADER)) { // is compute shader
         GLuint shader = compile_shader(GL_COMPUTE_SHADER, *this);
         if (!shader) {
             glDeleteProgram(program);
@@ -236,7 +311,7 @@ void ShaderImpl::compile() {
         }
         glAttachShader(program, shader);
     } else { // is pipeline
-        if (source_files.count(GL_VERTEX_SHADER)) {
+        if (has_source(GL_VERTEX_SHADER)) {
             GLuint shader = compile_shader(GL_VERTEX_SHADER, *this);
             if (!shader) {
                 glDeleteProgram(program);
@@ -244,7 +319,7 @@ void ShaderImpl::compile() {
             }
             glAttachShader(program, shader);
         }
-        if (source_files.count(GL_TESS_CONTROL_SHADER)) {
+        if (has_source(GL_TESS_CONTROL_SHADER)) {
             GLuint shader = compile_shader(GL_TESS_CONTROL_SHADER, *this);
             if (!shader) {
                 glDeleteProgram(program);
@@ -252,7 +327,7 @@ void ShaderImpl::compile() {
             }
             glAttachShader(program, shader);
         }
-        if (source_files.count(GL_TESS_EVALUATION_SHADER)) {
+        if (has_source(GL_TESS_EVALUATION_SHADER)) {
             GLuint shader = compile_shader(GL_TESS_EVALUATION_SHADER, *this);
             if (!shader) {
                 glDeleteProgram(program);
@@ -260,7 +335,7 @@ void ShaderImpl::compile() {
             }
             glAttachShader(program, shader);
         }
-        if (source_files.count(GL_GEOMETRY_SHADER)) {
+        if (has_source(GL_GEOMETRY_SHADER)) {
             GLuint shader = compile_shader(GL_GEOMETRY_SHADER, *this);
             if (!shader) {
                 glDeleteProgram(program);
@@ -268,7 +343,7 @@ void ShaderImpl::compile() {
             }
             glAttachShader(program, shader);
         }
-        if (source_files.count(GL_FRAGMENT_SHADER)) {
+        if (has_source(GL_FRAGMENT_SHADER)) {
             GLuint shader = compile_shader(GL_FRAGMENT_SHADER, *this);
             if (!shader) {
                 glDeleteProgram(program);
@@ -291,9 +366,62 @@ void ShaderImpl::compile() {
         throw std::runtime_error("Shader compilation failed, see full output in std::cerr");
     }
     // success, set new id
+    GLState::forget_program(id);
     if (glIsProgram(id))
         glDeleteProgram(id);
     id = program;
+    build_uniform_table();
+    // hook up camera uniform block to its fixed binding point
+    const GLuint camera_block = glGetUniformBlockIndex(id, "Camera");
+    uses_camera_block = camera_block != GL_INVALID_INDEX;
+    if (uses_camera_block)
+        glUniformBlockBinding(id, camera_block, CameraImpl::ubo_binding);
+}
+
+void ShaderImpl::build_uniform_table() {
+    uniforms.clear();
+    uniform_shadows.clear();
+    GLint num_uniforms = 0, max_length = 0;
+    glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &num_uniforms);
+    glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::vector<GLchar> buf(max_length + 1);
+    for (GLint i = 0; i < num_uniforms; ++i) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(id, GLuint(i), GLsizei(buf.size()), &length, &size, &type, buf.data());
+        const std::string uniform_name(buf.data(), length);
+        const GLint loc = glGetUniformLocation(id, uniform_name.c_str());
+        if (loc < 0) continue; // member of an uniform block
+        uniforms[uniform_name] = loc;
+        // arrays are reported as "name[0]", but are usually referred to as "name"
+        if (uniform_name.size() > 3 && uniform_name.compare(uniform_name.size() - 3, 3, "[0]") == 0)
+            uniforms[uniform_name.substr(0, uniform_name.size() - 3)] = loc;
+    }
+}
+
+GLint ShaderImpl::uniform_location(const std::string& name) const {
+    auto it = uniforms.find(name);
+    if (it == uniforms.end()) // not in table (e.g. array element or inactive), look up once and cache
+        it = uniforms.emplace(name, glGetUniformLocation(id, name.c_str())).first;
+    return it->second;
+}
+
+GLint ShaderImpl::changed_uniform_location(const std::string& name, const void* data, size_t size_bytes, uint32_t count) const {
+    const GLint location = uniform_location(name);
+    if (location < 0)
+        return -1;
+    // array uploads and element names ("arr[i]") cover locations other writes may alias, so they are never elided
+    // and drop the shadow of the first location ("arr" and "arr[0]" share it)
+    if (count > 1 || (!name.empty() && name.back() == ']')) {
+        uniform_shadows.erase(location);
+        return location;
+    }
+    std::vector<uint8_t>& shadow = uniform_shadows[location];
+    if (shadow.size() == size_bytes && std::memcmp(shadow.data(), data, size_bytes) == 0)
+        return -1;
+    shadow.assign((const uint8_t*)data, (const uint8_t*)data + size_bytes);
+    return location;
 }
 
 void ShaderImpl::dispatch_compute(uint32_t w, uint32_t h, uint32_t d, GLbitfield memory_barrier_bits) const {
@@ -305,100 +433,100 @@ void ShaderImpl::dispatch_compute(uint32_t w, uint32_t h, uint32_t d, GLbitfield
 }
 
 void ShaderImpl::uniform(const std::string& name, int val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform1i(loc, val);
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniform1i(loc, val);
 }
 
 void ShaderImpl::uniform(const std::string& name, int *val, uint32_t count) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform1iv(loc, count, val);
+    const int loc = changed_uniform_location(name, val, sizeof(int) * count, count);
+    if (loc >= 0) glUniform1iv(loc, count, val);
 }
 
 void ShaderImpl::uniform(const std::string& name, uint32_t val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform1ui(loc, val);
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniform1ui(loc, val);
 }
 
 void ShaderImpl::uniform(const std::string& name, uint32_t* val, uint32_t count) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform1uiv(loc, count, val);
+    const int loc = changed_uniform_location(name, val, sizeof(uint32_t) * count, count);
+    if (loc >= 0) glUniform1uiv(loc, count, val);
 }
 
 void ShaderImpl::uniform(const std::string& name, float val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform1f(loc, val);
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniform1f(loc, val);
 }
 
 void ShaderImpl::uniform(const std::string& name, float *val, uint32_t count) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform1fv(loc, count, val);
+    const int loc = changed_uniform_location(name, val, sizeof(float) * count, count);
+    if (loc >= 0) glUniform1fv(loc, count, val);
 }
 
 void ShaderImpl::uniform(const std::string& name, const glm::vec2& val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform2f(loc, val.x, val.y);
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniform2f(loc, val.x, val.y);
 }
 
 void ShaderImpl::uniform(const std::string& name, const glm::vec3& val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform3f(loc, val.x, val.y, val.z);
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniform3f(loc, val.x, val.y, val.z);
 }
 
 void ShaderImpl::uniform(const std::string& name, const glm::vec4& val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform4f(loc, val.x, val.y, val.z, val.w);
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniform4f(loc, val.x, val.y, val.z, val.w);
 }
 
 void ShaderImpl::uniform(const std::string& name, const glm::ivec2& val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform2i(loc, val.x, val.y);
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniform2i(loc, val.x, val.y);
 }
 
 void ShaderImpl::uniform(const std::string& name, const glm::ivec3& val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform3i(loc, val.x, val.y, val.z);
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniform3i(loc, val.x, val.y, val.z);
 }
 
 void ShaderImpl::uniform(const std::string& name, const glm::ivec4& val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform4i(loc, val.x, val.y, val.z, val.w);
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniform4i(loc, val.x, val.y, val.z, val.w);
 }
 
 void ShaderImpl::uniform(const std::string& name, const glm::uvec2& val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform2ui(loc, val.x, val.y);
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniform2ui(loc, val.x, val.y);
 }
 
 void ShaderImpl::uniform(const std::string& name, const glm::uvec3& val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform3ui(loc, val.x, val.y, val.z);
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniform3ui(loc, val.x, val.y, val.z);
 }
 
 void ShaderImpl::uniform(const std::string& name, const glm::uvec4& val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniform4ui(loc, val.x, val.y, val.z, val.w);
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniform4ui(loc, val.x, val.y, val.z, val.w);
 }
 
 void ShaderImpl::uniform(const std::string& name, const glm::mat3& val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniformMatrix3fv(loc, 1, GL_FALSE, glm::value_ptr(val));
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniformMatrix3fv(loc, 1, GL_FALSE, glm::value_ptr(val));
 }
 
 void ShaderImpl::uniform(const std::string& name, const glm::mat4& val) const {
-    int loc = glGetUniformLocation(id, name.c_str());
-    glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(val));
+    const int loc = changed_uniform_location(name, &val, sizeof(val));
+    if (loc >= 0) glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(val));
 }
 
 void ShaderImpl::uniform(const std::string& name, const Texture2D& tex, uint32_t unit) const {
-    int loc = glGetUniformLocation(id, name.c_str());
     tex->bind(unit);
-    glUniform1i(loc, unit);
+    const int loc = changed_uniform_location(name, &unit, sizeof(unit));
+    if (loc >= 0) glUniform1i(loc, unit);
 }
 
 void ShaderImpl::uniform(const std::string& name, const Texture3D& tex, uint32_t unit) const {
-    int loc = glGetUniformLocation(id, name.c_str());
     tex->bind(unit);
-    glUniform1i(loc, unit);
+    const int loc = changed_uniform_location(name, &unit, sizeof(unit));
+    if (loc >= 0) glUniform1i(loc, unit);
 }
 
 bool ShaderImpl::reload_if_modified() {
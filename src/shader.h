@@ -6,6 +6,7 @@ namespace fs = std::filesystem;
 #include <map>
 #include <memory>
 #include <vector>
+#include <unordered_map>
 #include <GL/glew.h>
 #include <GL/gl.h>
 #include <glm/glm.hpp>
@@ -46,6 +47,8 @@ public:
     void set_geometry_source(const fs::path& path);
     void set_fragment_source(const fs::path& path);
     void set_compute_source(const fs::path& path);
+    // set source code directly (e.g. for shaders embedded in the library), takes precedence over a source file
+    void set_source_string(GLenum type, const std::string& source);
 
     // compile and link shader from previously given source files
     void compile();
@@ -74,6 +77,9 @@ public:
     void uniform(const std::string& name, const Texture2D& tex, uint32_t unit) const;
     void uniform(const std::string& name, const Texture3D& tex, uint32_t unit) const;
 
+    // cached uniform location lookup (-1 if not an active uniform)
+    GLint uniform_location(const std::string& name) const;
+
     // clear shader
     void clear();
     // check and reload if modified (return true if reloaded)
@@ -86,10 +92,26 @@ public:
     const std::string name;
     GLuint id;
     std::map<GLenum, fs::path> source_files;
+    std::map<GLenum, std::string> source_strings;
     std::map<GLenum, fs::file_time_type> timestamps;
     std::map<fs::path, fs::file_time_type> include_timestamps;
+
+    // uniform location table (built on link), several names may share a location ("name" and "name[0]")
+    mutable std::unordered_map<std::string, GLint> uniforms;
+    // shadow copies of the last uploaded values, keyed by location
+    mutable std::unordered_map<GLint, std::vector<uint8_t>> uniform_shadows;
+    // true if the program declares the Camera uniform block (#include <cppgl/camera.glsl>)
+    bool uses_camera_block;
     
     static std::vector<fs::path> shader_search_paths;
+
+private:
+    inline bool has_source(GLenum type) const { return source_files.count(type) || source_strings.count(type); }
+    // rebuild uniform table from the active uniforms of the linked program
+    void build_uniform_table();
+    // returns location if the uniform exists and its value differs from the shadow copy (and updates the shadow), -1 otherwise.
+    // uploads of count > 1 values and array element names are not shadowed
+    GLint changed_uniform_location(const std::string& name, const void* data, size_t size_bytes, uint32_t count = 1) const;
 };
 
 using Shader = NamedHandle<ShaderImpl>;
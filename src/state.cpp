@@ -0,0 +1,252 @@
+#include "state.h"
+#include "capabilities.h"
+#include <map>
+#include <vector>
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// shadowed state
+
+static const GLuint UNKNOWN = GLuint(-1);
+
+static struct {
+    GLuint program = UNKNOWN;
+    GLuint vao = UNKNOWN;
+    uint32_t active_unit = UNKNOWN;
+    std::map<std::pair<uint32_t, GLenum>, GLuint> textures; // (unit, target), each unit has one binding per target
+    std::map<GLenum, GLuint> buffers;
+    std::map<std::pair<GLenum, uint32_t>, GLuint> indexed_buffers;
+    GLuint draw_framebuffer = UNKNOWN, read_framebuffer = UNKNOWN;
+    glm::ivec4 viewport = glm::ivec4(0);
+    bool viewport_known = false;
+    bool lazy_unbind = false;
+    // statistics
+    uint32_t issued = 0, elided = 0;
+    uint32_t issued_last_frame = 0, elided_last_frame = 0;
+} state;
+
+// returns true if the state change has to be issued (and updates the shadow)
+static inline bool changed(GLuint& shadow, GLuint value) {
+    if (shadow == value) {
+        state.elided++;
+        return false;
+    }
+    shadow = value;
+    state.issued++;
+    return true;
+}
+
+static inline void active_texture(uint32_t unit) {
+    if (state.active_unit != unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        state.active_unit = unit;
+        state.issued++;
+    }
+}
+
+// ------------------------------------------
+// GLState
+
+void GLState::use_program(GLuint program) {
+    if (changed(state.program, program))
+        glUseProgram(program);
+}
+
+void GLState::bind_vertex_array(GLuint vao) {
+    if (changed(state.vao, vao)) {
+        glBindVertexArray(vao);
+        // element array buffer binding is part of the VAO state
+        state.buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+    }
+}
+
+static inline void bind_texture_to_unit(uint32_t unit, GLenum target, GLuint texture, bool allow_dsa) {
+    auto it = state.textures.find(std::make_pair(unit, target));
+    if (it != state.textures.end() && it->second == texture) {
+        state.elided++;
+        return;
+    }
+    // glBindTextureUnit(unit, 0) would unbind all targets of the unit, so unbind per target
+    if (allow_dsa && texture != 0 && has_direct_state_access()) {
+        glBindTextureUnit(unit, texture);
+    } else {
+        active_texture(unit);
+        glBindTexture(target, texture);
+    }
+    state.textures[std::make_pair(unit, target)] = texture;
+    state.issued++;
+}
+
+void GLState::bind_texture(uint32_t unit, GLenum target, GLuint texture) {
+    bind_texture_to_unit(unit, target, texture, true);
+}
+
+void GLState::bind_texture(GLenum target, GLuint texture) {
+    if (state.active_unit == UNKNOWN)
+        active_texture(0);
+    // glBindTextureUnit requires the texture object to exist, so use the classic path for freshly generated names
+    bind_texture_to_unit(state.active_unit, target, texture, false);
+}
+
+void GLState::bind_buffer(GLenum target, GLuint buffer) {
+    auto it = state.buffers.find(target);
+    if (it != state.buffers.end() && it->second == buffer) {
+        state.elided++;
+        return;
+    }
+    glBindBuffer(target, buffer);
+    state.buffers[target] = buffer;
+    state.issued++;
+}
+
+void GLState::bind_buffer_base(GLenum target, uint32_t index, GLuint buffer) {
+    auto it = state.indexed_buffers.find(std::make_pair(target, index));
+    if (it != state.indexed_buffers.end() && it->second == buffer) {
+        state.elided++;
+        return;
+    }
+    glBindBufferBase(target, index, buffer);
+    // also binds the generic binding point
+    state.indexed_buffers[std::make_pair(target, index)] = buffer;
+    state.buffers[target] = buffer;
+    state.issued++;
+}
+
+void GLState::bind_buffer_range(GLenum target, uint32_t index, GLuint buffer, size_t offset, size_t size) {
+    glBindBufferRange(target, index, buffer, offset, size);
+    // ranges are not shadowed, so a later bind_buffer_base() to this index has to be issued
+    state.indexed_buffers.erase(std::make_pair(target, index));
+    state.buffers[target] = buffer;
+    state.issued++;
+}
+
+void GLState::bind_framebuffer(GLenum target, GLuint framebuffer) {
+    const bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+    const bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+    if ((!draw || state.draw_framebuffer == framebuffer) && (!read || state.read_framebuffer == framebuffer)) {
+        state.elided++;
+        return;
+    }
+    glBindFramebuffer(target, framebuffer);
+    if (draw) state.draw_framebuffer = framebuffer;
+    if (read) state.read_framebuffer = framebuffer;
+    state.issued++;
+}
+
+void GLState::viewport(int x, int y, int w, int h) {
+    const glm::ivec4 vp(x, y, w, h);
+    if (state.viewport_known && state.viewport == vp) {
+        state.elided++;
+        return;
+    }
+    glViewport(x, y, w, h);
+    state.viewport = vp;
+    state.viewport_known = true;
+    state.issued++;
+}
+
+glm::ivec4 GLState::get_viewport() {
+    if (!state.viewport_known) {
+        glGetIntegerv(GL_VIEWPORT, &state.viewport.x);
+        state.viewport_known = true;
+    }
+    return state.viewport;
+}
+
+void GLState::unbind_program() {
+    if (state.lazy_unbind)
+        state.elided++;
+    else
+        use_program(0);
+}
+
+void GLState::unbind_vertex_array() {
+    if (state.lazy_unbind)
+        state.elided++;
+    else
+        bind_vertex_array(0);
+}
+
+void GLState::unbind_texture(GLenum target, GLuint texture) {
+    if (state.lazy_unbind) {
+        state.elided++;
+        return;
+    }
+    std::vector<uint32_t> units;
+    for (const auto& [key, id] : state.textures)
+        if (key.second == target && id == texture) units.push_back(key.first);
+    for (uint32_t unit : units)
+        bind_texture(unit, target, 0);
+    if (units.empty())
+        state.elided++;
+}
+
+void GLState::unbind_buffer(GLenum target) {
+    if (state.lazy_unbind)
+        state.elided++;
+    else
+        bind_buffer(target, 0);
+}
+
+void GLState::unbind_buffer_base(GLenum target, uint32_t index) {
+    if (state.lazy_unbind)
+        state.elided++;
+    else
+        bind_buffer_base(target, index, 0);
+}
+
+void GLState::set_lazy_unbind(bool on) { state.lazy_unbind = on; }
+
+bool GLState::lazy_unbind() { return state.lazy_unbind; }
+
+void GLState::forget_program(GLuint program) {
+    if (state.program == program) state.program = UNKNOWN;
+}
+
+void GLState::forget_vertex_array(GLuint vao) {
+    if (state.vao == vao) {
+        state.vao = UNKNOWN;
+        state.buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+    }
+}
+
+void GLState::forget_texture(GLuint texture) {
+    for (auto& [key, id] : state.textures)
+        if (id == texture) id = UNKNOWN;
+}
+
+void GLState::forget_buffer(GLuint buffer) {
+    for (auto it = state.buffers.begin(); it != state.buffers.end();)
+        it = it->second == buffer ? state.buffers.erase(it) : std::next(it);
+    for (auto it = state.indexed_buffers.begin(); it != state.indexed_buffers.end();)
+        it = it->second == buffer ? state.indexed_buffers.erase(it) : std::next(it);
+}
+
+void GLState::forget_framebuffer(GLuint framebuffer) {
+    if (state.draw_framebuffer == framebuffer) state.draw_framebuffer = UNKNOWN;
+    if (state.read_framebuffer == framebuffer) state.read_framebuffer = UNKNOWN;
+}
+
+void GLState::invalidate() {
+    state.program = UNKNOWN;
+    state.vao = UNKNOWN;
+    state.active_unit = UNKNOWN;
+    state.textures.clear();
+    state.buffers.clear();
+    state.indexed_buffers.clear();
+    state.draw_framebuffer = state.read_framebuffer = UNKNOWN;
+    state.viewport_known = false;
+}
+
+void GLState::end_frame() {
+    state.issued_last_frame = state.issued;
+    state.elided_last_frame = state.elided;
+    state.issued = state.elided = 0;
+}
+
+uint32_t GLState::issued_last_frame() { return state.issued_last_frame; }
+
+uint32_t GLState::elided_last_frame() { return state.elided_last_frame; }
+
+CPPGL_NAMESPACE_END
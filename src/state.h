@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <GL/glew.h>
+#include <GL/gl.h>
+#include <glm/glm.hpp>
+#include "platform.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// GL state tracker
+// Shadows bound program, VAO, textures, buffers, framebuffers and viewport of the context, so that redundant
+// state changes become no-ops. All cppgl wrappers route their binds through here; call invalidate() after
+// foreign code (raw GL calls, other libraries) modified any of the tracked state.
+
+class GLState {
+public:
+    // bind (elided if already bound)
+    static void use_program(GLuint program);
+    static void bind_vertex_array(GLuint vao);
+    static void bind_texture(uint32_t unit, GLenum target, GLuint texture);
+    static void bind_texture(GLenum target, GLuint texture); // to currently active unit
+    static void bind_buffer(GLenum target, GLuint buffer);
+    static void bind_buffer_base(GLenum target, uint32_t index, GLuint buffer);
+    static void bind_buffer_range(GLenum target, uint32_t index, GLuint buffer, size_t offset, size_t size); // never elided
+    static void bind_framebuffer(GLenum target, GLuint framebuffer);
+    static void viewport(int x, int y, int w, int h);
+    static glm::ivec4 get_viewport();
+
+    // "unbind to 0" calls (no-ops when lazy unbinding is enabled)
+    static void unbind_program();
+    static void unbind_vertex_array();
+    static void unbind_texture(GLenum target, GLuint texture); // from all units it is bound to
+    static void unbind_buffer(GLenum target);
+    static void unbind_buffer_base(GLenum target, uint32_t index);
+    static void set_lazy_unbind(bool on);
+    static bool lazy_unbind();
+
+    // GL implicitly unbinds deleted objects, call before deleting them
+    static void forget_program(GLuint program);
+    static void forget_vertex_array(GLuint vao);
+    static void forget_texture(GLuint texture);
+    static void forget_buffer(GLuint buffer);
+    static void forget_framebuffer(GLuint framebuffer);
+
+    // mark all shadowed state as unknown
+    static void invalidate();
+
+    // per-frame counters of issued and elided state changes
+    static void end_frame();
+    static uint32_t issued_last_frame();
+    static uint32_t elided_last_frame();
+};
+
+CPPGL_NAMESPACE_END
@@ -1,7 +1,14 @@
 #include "texture.h"
+#include <cstdio>
 #include <vector>
 #include <iostream>
 #include "image_load_store.h"
+#include "compressed_image.h"
+#include "readback.h"
+#include "buffer.h"
+#include "pixel_convert.h"
+#include "capabilities.h"
+#include "state.h"
 
 CPPGL_NAMESPACE_BEGIN
 
@@ -20,32 +27,211 @@ inline GLint channels_to_float_format(uint32_t channels) {
 inline GLint channels_to_ubyte_format(uint32_t channels) {
     return channels == 4 ? GL_RGBA8 : channels == 3 ? GL_RGB8 : channels == 2 ? GL_RG8 : GL_R8;
 }
+// GPU-native layout of decoded images (see Texture2DImpl::convert_for_upload)
+struct UploadLayout {
+    GLint internal_format;
+    GLenum format, type;
+    size_t pixel_bytes;
+};
+
+static UploadLayout upload_layout(int channels, bool is_hdr, bool mipmap) {
+    if (!is_hdr) // 3 byte pixels hit slow driver repacking paths, send RGBA and let GL drop the alpha
+        return channels == 3 ? UploadLayout{ GL_RGB8, GL_RGBA, GL_UNSIGNED_BYTE, 4 } :
+            UploadLayout{ channels_to_ubyte_format(channels), GLenum(channels_to_format(channels)), GL_UNSIGNED_BYTE, size_t(channels) };
+    switch (Texture2DImpl::hdr_storage) {
+    case TEXTURE_HDR_FLOAT:
+        return UploadLayout{ channels_to_float_format(channels), GLenum(channels_to_format(channels)), GL_FLOAT, channels * sizeof(float) };
+    case TEXTURE_HDR_RGB9E5:
+        // not color-renderable, so no glGenerateMipmap
+        if (channels == 3 && !mipmap) return UploadLayout{ GL_RGB9_E5, GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV, 4 };
+        [[fallthrough]];
+    default: {
+        const int out_channels = channels == 3 ? 4 : channels;
+        const GLint internal_format = out_channels == 4 ? GL_RGBA16F : out_channels == 2 ? GL_RG16F : GL_R16F;
+        return UploadLayout{ internal_format, GLenum(channels_to_format(out_channels)), GL_HALF_FLOAT, out_channels * sizeof(uint16_t) };
+    }
+    }
+}
+
+// FNV-1a
+inline uint64_t path_hash(const std::string& path) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const char c : path)
+        hash = (hash ^ uint8_t(c)) * 1099511628211ull;
+    return hash;
+}
+
+inline GLsizei mip_levels(uint32_t w, uint32_t h) {
+    GLsizei levels = 1;
+    while ((w | h) >> levels) ++levels;
+    return levels;
+}
+
+inline void create_texture(GLuint& id) {
+    if (has_direct_state_access())
+        glCreateTextures(GL_TEXTURE_2D, 1, &id);
+    else
+        glGenTextures(1, &id);
+}
+
+// (re-)allocate mutable storage for the given levels of the bound GL_TEXTURE_2D (contents undefined).
+// explicit per level, since glGenerateMipmap fails for depth, stencil, integer and non-filterable formats
+static void allocate_levels(GLint internal_format, GLenum format, GLenum type, uint32_t w, uint32_t h, GLsizei levels) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    const uint32_t block_bytes = compressed_block_bytes(internal_format);
+    for (GLsizei level = 0; level < levels; ++level) {
+        const uint32_t lw = std::max(w >> level, 1u), lh = std::max(h >> level, 1u);
+        if (block_bytes)
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format, lw, lh, 0, GLsizei(((lw + 3) / 4) * ((lh + 3) / 4) * block_bytes), nullptr);
+        else
+            glTexImage2D(GL_TEXTURE_2D, level, internal_format, lw, lh, 0, format, type, nullptr);
+    }
+}
 
 // ----------------------------------------------------
 // Texture2D
 
+TextureCompression Texture2DImpl::compression = TEXTURE_COMPRESSION_NONE;
+TextureHDRStorage Texture2DImpl::hdr_storage = TEXTURE_HDR_HALF;
+fs::path Texture2DImpl::compression_cache_directory = ".cppgl_cache";
+
 Texture2DImpl::Texture2DImpl(const std::string& name, const fs::path& path, bool mipmap) : name(name), loaded_from_path(path), id(0) {
-    // load image from disk
-    auto [data, w_out, h_out, channels, is_hdr] = image_load(path);
+    if (is_compressed_image_file(path))
+        init(load_compressed_image(path), mipmap);
+    else if (compression == TEXTURE_COMPRESSION_NONE)
+        load_via_pbo(mipmap);
+    else if (!load_compression_cache(mipmap))
+        init(image_load(path), mipmap);
+}
+
+Texture2DImpl::Texture2DImpl(const std::string& name, const fs::path& path, const ImageData& image, bool mipmap) : name(name), loaded_from_path(path), id(0) {
+    init(image, mipmap);
+}
+
+Texture2DImpl::Texture2DImpl(const std::string& name, const fs::path& path, const CompressedImage& image, bool mipmap) : name(name), loaded_from_path(path), id(0) {
+    init(image, mipmap);
+}
+
+fs::path Texture2DImpl::compression_cache_path(const fs::path& path) {
+    const fs::path dir = compression_cache_directory.empty() ? path.parent_path() : compression_cache_directory;
+    // the absolute path hash keeps same-named images from different directories apart in a shared cache directory
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)path_hash(fs::absolute(path).string()));
+    return dir / (path.filename().string() + "." + hash + (compression == TEXTURE_COMPRESSION_QUALITY ? ".quality.dds" : ".fast.dds"));
+}
+
+bool Texture2DImpl::load_compression_cache(bool mipmap) {
+    const fs::path cache_path = compression_cache_path(loaded_from_path);
+    std::error_code ec;
+    if (fs::exists(cache_path, ec) && fs::last_write_time(cache_path, ec) >= fs::last_write_time(loaded_from_path, ec) && !ec) {
+        try {
+            init(load_compressed_image(cache_path), mipmap);
+            return true;
+        } catch (const std::exception& e) {
+            std::cerr << "WARN: ignoring " << cache_path << ": " << e.what() << std::endl;
+        }
+    }
+    return false; // init() compresses and (re-)writes the cache
+}
+
+size_t Texture2DImpl::upload_pixel_bytes(int channels, bool is_hdr, bool mipmap) {
+    return upload_layout(channels, is_hdr, mipmap).pixel_bytes;
+}
+
+void Texture2DImpl::convert_for_upload(const uint8_t* src, uint8_t* dst, size_t pixels, int channels, bool is_hdr, bool mipmap) {
+    const UploadLayout layout = upload_layout(channels, is_hdr, mipmap);
+    if (!is_hdr) {
+        if (channels == 3)
+            rgb_to_rgba(src, dst, pixels);
+        else
+            memcpy(dst, src, pixels * channels);
+    } else if (layout.type == GL_FLOAT)
+        memcpy(dst, src, pixels * channels * sizeof(float));
+    else if (layout.type == GL_UNSIGNED_INT_5_9_9_9_REV)
+        float_to_rgb9e5((const float*)src, channels, (uint32_t*)dst, pixels);
+    else if (channels != 3)
+        float_to_half((const float*)src, (uint16_t*)dst, pixels * channels);
+    else { // expand to RGBA in cache sized chunks
+        const size_t CHUNK = 256;
+        float rgba[CHUNK * 4];
+        for (size_t i = 0; i < pixels; i += CHUNK) {
+            const size_t n = std::min(CHUNK, pixels - i);
+            float_to_rgba((const float*)src + i * 3, 3, rgba, n);
+            float_to_half(rgba, (uint16_t*)dst + i * 4, n * 4);
+        }
+    }
+}
+
+// shared by all file loads (not registered as NamedHandle), grows to the largest image seen
+static std::unique_ptr<GLBufferImpl<GL_PIXEL_UNPACK_BUFFER>> upload_pbo;
+
+void Texture2DImpl::release_upload_buffer() {
+    upload_pbo.reset();
+}
+
+void Texture2DImpl::load_via_pbo(bool mipmap) {
+    // decode straight into the mapped upload buffer (converted to the upload layout), no intermediate copy in client memory
+    if (!upload_pbo)
+        upload_pbo = std::make_unique<GLBufferImpl<GL_PIXEL_UNPACK_BUFFER>>("cppgl_image_upload");
+    GLBufferImpl<GL_PIXEL_UNPACK_BUFFER>& pbo = *upload_pbo;
+    bool mapped = false;
+    ImageInfo info;
+    try {
+        info = image_load_into(loaded_from_path, [&](const ImageInfo& info) {
+            // always respecify (orphans the store of a previous upload that may still be in flight, no stall on map)
+            pbo.resize(std::max(pbo.size_bytes, size_t(info.w) * info.h * upload_pixel_bytes(info.channels, info.is_hdr, mipmap)), GL_STREAM_DRAW);
+            mapped = true;
+            return pbo.map(GL_WRITE_ONLY);
+        }, [&](const ImageInfo& info, const uint8_t* src, uint8_t* dst) {
+            convert_for_upload(src, dst, info.w, info.channels, info.is_hdr, mipmap);
+            return info.w * upload_pixel_bytes(info.channels, info.is_hdr, mipmap);
+        });
+    } catch (...) {
+        if (mapped) pbo.unmap(); // the buffer outlives this load
+        throw;
+    }
+    pbo.unmap();
+    // allocate, then upload from offset 0 of the bound PBO
+    init(ImageData(ImageBuffer(), info.w, info.h, info.channels, info.is_hdr), mipmap);
+    pbo.bind();
+    upload_subimage(0, 0, w, h, nullptr);
+    pbo.unbind();
+    if (mipmap) generate_mipmaps();
+}
+
+void Texture2DImpl::init(const ImageData& image, bool mipmap) {
+    const auto& [data, w_out, h_out, channels, is_hdr] = image;
+    // block compress LDR images (the cache is written for images from disk)
+    if (compression != TEXTURE_COMPRESSION_NONE && !is_hdr && !data.empty() && w_out > 0 && h_out > 0) {
+        const BCFormat bc_format = channels == 1 ? BC_FORMAT_BC4 : channels == 2 ? BC_FORMAT_BC5 :
+            compression == TEXTURE_COMPRESSION_QUALITY ? BC_FORMAT_BC7 : channels == 3 ? BC_FORMAT_BC1 : BC_FORMAT_BC3;
+        const CompressedImage compressed = compress_image(data.data(), w_out, h_out, channels, bc_format, true);
+        if (!loaded_from_path.empty()) {
+            try {
+                const fs::path cache_path = compression_cache_path(loaded_from_path);
+                std::error_code ec;
+                if (cache_path.has_parent_path())
+                    fs::create_directories(cache_path.parent_path(), ec); // failure shows up when writing
+                store_compressed_image(cache_path, compressed);
+            } catch (const std::exception& e) {
+                std::cerr << "WARN: " << e.what() << std::endl;
+            }
+        }
+        init(compressed, mipmap);
+        return;
+    }
     this->w = w_out;
     this->h = h_out;
 
-    if (is_hdr) {
-        internal_format = channels_to_float_format(channels);
-        type = GL_FLOAT;
-    } else {
-        internal_format = channels_to_ubyte_format(channels);
-        type = GL_UNSIGNED_BYTE;
+    const UploadLayout layout = upload_layout(channels, is_hdr, mipmap);
+    internal_format = layout.internal_format;
+    format = layout.format;
+    type = layout.type;
+    // placeholder without GL texture, e.g. while the image is still streamed in
+    if (w <= 0 || h <= 0) {
+        this->w = this->h = 0;
+        return;
     }
-    format = channels_to_format(channels);
-
-    // init GL texture
-    glGenTextures(1, &id);
-    glBindTexture(GL_TEXTURE_2D, id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 
     //opengl by default needs 4 byte alignment after every row
     //stbi loaded data is not aligned that way -> pixelStore attributes need to be set
@@ -54,27 +240,75 @@ Texture2DImpl::Texture2DImpl(const std::string& name, const fs::path& path, bool
     glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
     glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, w, h, 0, format, type, &data[0]);
-    if (mipmap) glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // convert to the upload layout unless it matches the decoded one
+    // (inline: the global pool may be busy with image decodes, which would stall the GL thread)
+    std::vector<uint8_t> converted;
+    const uint8_t* pixels = data.data();
+    const size_t pixel_bytes = channels * (is_hdr ? sizeof(float) : 1);
+    if (!data.empty() && (layout.type != (is_hdr ? GL_FLOAT : GL_UNSIGNED_BYTE) || layout.pixel_bytes != pixel_bytes)) {
+        converted.resize(size_t(w) * h * layout.pixel_bytes);
+        convert_for_upload(data.data(), converted.data(), size_t(w) * h, channels, is_hdr, mipmap);
+        pixels = converted.data();
+    }
+
+    // init GL texture
+    create_texture(id);
+    GLState::bind_texture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    allocate_levels(internal_format, format, type, w, h, mipmap ? mip_levels(w, h) : 1);
+    if (!data.empty()) { // otherwise only allocate storage, the caller fills level 0 first (see load_via_pbo)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, format, type, pixels);
+        if (mipmap) glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    GLState::unbind_texture(GL_TEXTURE_2D, id);
+}
+
+void Texture2DImpl::init(const CompressedImage& image, bool mipmap) {
+    if (!image.bottom_up)
+        std::cerr << "WARN: " << loaded_from_path << " is uploaded top-down (rows of BC6H/BC7 or odd sized levels can not be flipped)" << std::endl;
+    w = image.w;
+    h = image.h;
+    internal_format = image.internal_format;
+    format = compressed_base_format(internal_format);
+    type = format == GL_RGB && compressed_block_bytes(internal_format) == 16 ? GL_FLOAT : GL_UNSIGNED_BYTE; // BC6H is HDR
+    const GLsizei levels = mipmap ? std::max(GLsizei(image.levels.size()), 1) : 1;
+    // init GL texture with the pre-computed mip chain, drivers can not generate mipmaps for compressed formats
+    create_texture(id);
+    GLState::bind_texture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    for (GLsizei level = 0; level < levels; ++level)
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format, image.level_width(level), image.level_height(level), 0,
+                GLsizei(image.levels[level].size()), image.levels[level].data());
+    GLState::unbind_texture(GL_TEXTURE_2D, id);
 }
 
 Texture2DImpl::Texture2DImpl(const std::string& name, uint32_t w, uint32_t h, GLint internal_format, GLenum format, GLenum type, const void* data, bool mipmap)
     : name(name), id(0), w(w), h(h), internal_format(internal_format), format(format), type(type) {
     // init GL texture
-    glGenTextures(1, &id);
-    glBindTexture(GL_TEXTURE_2D, id);
+    const bool is_depth = format == GL_DEPTH_COMPONENT || format == GL_DEPTH_STENCIL;
+    create_texture(id);
+    GLState::bind_texture(GL_TEXTURE_2D, id);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (format == GL_DEPTH_COMPONENT || format == GL_DEPTH_STENCIL) ? GL_NEAREST : GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-            mipmap ? GL_LINEAR_MIPMAP_LINEAR : (format == GL_DEPTH_COMPONENT || format == GL_DEPTH_STENCIL) ? GL_NEAREST : GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, w, h, 0, format, type, data);
-    if (mipmap && data != 0) glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, is_depth ? GL_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmap ? GL_LINEAR_MIPMAP_LINEAR : is_depth ? GL_NEAREST : GL_LINEAR);
+    allocate_levels(internal_format, format, type, w, h, mipmap ? mip_levels(w, h) : 1);
+    if (data != 0) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, format, type, data);
+        if (mipmap) glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    GLState::unbind_texture(GL_TEXTURE_2D, id);
 }
 
 Texture2DImpl::~Texture2DImpl() {
+    GLState::forget_texture(id);
     if (glIsTexture(id))
         glDeleteTextures(1, &id);
 }
@@ -82,18 +316,59 @@ Texture2DImpl::~Texture2DImpl() {
 void Texture2DImpl::resize(uint32_t w, uint32_t h) {
     this->w = w;
     this->h = h;
-    glBindTexture(GL_TEXTURE_2D, id);
-    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, w, h, 0, format, type, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // all 2D textures use mutable storage, so the id (and framebuffer attachments) stay valid
+    GLint max_level = 0;
+    GLState::bind_texture(GL_TEXTURE_2D, id);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &max_level);
+    allocate_levels(internal_format, format, type, w, h, max_level > 0 ? mip_levels(w, h) : 1);
+    GLState::unbind_texture(GL_TEXTURE_2D, id);
+}
+
+void Texture2DImpl::upload_subimage(int x, int y, int w, int h, const void* data, uint32_t level) {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (has_direct_state_access()) {
+        glTextureSubImage2D(id, level, x, y, w, h, format, type, data);
+        return;
+    }
+    GLState::bind_texture(GL_TEXTURE_2D, id);
+    glTexSubImage2D(GL_TEXTURE_2D, level, x, y, w, h, format, type, data);
+    GLState::unbind_texture(GL_TEXTURE_2D, id);
+}
+
+void Texture2DImpl::generate_mipmaps() {
+    if (has_direct_state_access()) {
+        glGenerateTextureMipmap(id);
+        return;
+    }
+    GLState::bind_texture(GL_TEXTURE_2D, id);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    GLState::unbind_texture(GL_TEXTURE_2D, id);
+}
+
+void Texture2DImpl::swap(Texture2DImpl& other) {
+    std::swap(id, other.id);
+    std::swap(w, other.w);
+    std::swap(h, other.h);
+    std::swap(internal_format, other.internal_format);
+    std::swap(format, other.format);
+    std::swap(type, other.type);
+}
+
+GLenum Texture2DImpl::pixel_format() const {
+    switch (internal_format) {
+    case GL_RGB: case GL_RGB8: case GL_SRGB8: case GL_RGB16F: case GL_RGB32F: case GL_RGB9_E5:
+        return GL_RGB;
+    default:
+        return format;
+    }
 }
 
 void Texture2DImpl::bind(uint32_t unit) const {
-    glActiveTexture(GL_TEXTURE0 + unit);
-    glBindTexture(GL_TEXTURE_2D, id);
+    GLState::bind_texture(unit, GL_TEXTURE_2D, id);
 }
 
 void Texture2DImpl::unbind() const {
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLState::unbind_texture(GL_TEXTURE_2D, id);
 }
 
 void Texture2DImpl::bind_image(uint32_t unit, GLenum access, GLenum format) const {
@@ -105,11 +380,21 @@ void Texture2DImpl::unbind_image(uint32_t unit) const {
 }
 
 void Texture2DImpl::save_ldr(const fs::path& path, bool flip, bool async) const {
-    std::vector<uint8_t> pixels(size_t(w) * h * format_to_channels(format));
-    glBindTexture(GL_TEXTURE_2D, id);
-    glGetTexImage(GL_TEXTURE_2D, 0, format, GL_UNSIGNED_BYTE, &pixels[0]);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    image_store_ldr(path, pixels.data(), w, h, format_to_channels(format), flip, async);
+    if (async) { // no stall, read via PBO and encode once arrived
+        Readback::store(std::make_unique<Readback>(*this, GL_UNSIGNED_BYTE), path, flip);
+        return;
+    }
+    const GLenum pixel_format = this->pixel_format();
+    std::vector<uint8_t> pixels(size_t(w) * h * format_to_channels(pixel_format));
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    if (has_direct_state_access())
+        glGetTextureImage(id, 0, pixel_format, GL_UNSIGNED_BYTE, GLsizei(pixels.size()), &pixels[0]);
+    else {
+        GLState::bind_texture(GL_TEXTURE_2D, id);
+        glGetTexImage(GL_TEXTURE_2D, 0, pixel_format, GL_UNSIGNED_BYTE, &pixels[0]);
+        GLState::unbind_texture(GL_TEXTURE_2D, id);
+    }
+    image_store_ldr(path, pixels.data(), w, h, format_to_channels(pixel_format), flip);
 }
 
 // ----------------------------------------------------
@@ -119,7 +404,7 @@ Texture3DImpl::Texture3DImpl(const std::string& name, uint32_t w, uint32_t h, ui
     : name(name), id(0), w(w), h(h), d(d), internal_format(internal_format), format(format), type(type) {
     // init GL texture
     glGenTextures(1, &id);
-    glBindTexture(GL_TEXTURE_3D, id);
+    GLState::bind_texture(GL_TEXTURE_3D, id);
     // default border color is (0, 0, 0, 0)
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
@@ -128,10 +413,11 @@ Texture3DImpl::Texture3DImpl(const std::string& name, uint32_t w, uint32_t h, ui
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
     glTexImage3D(GL_TEXTURE_3D, 0, internal_format, w, h, d, 0, format, type, data);
     if (mipmap && data != 0) glGenerateMipmap(GL_TEXTURE_3D);
-    glBindTexture(GL_TEXTURE_3D, 0);
+    GLState::unbind_texture(GL_TEXTURE_3D, id);
 }
 
 Texture3DImpl::~Texture3DImpl() {
+    GLState::forget_texture(id);
     if (glIsTexture(id))
         glDeleteTextures(1, &id);
 }
@@ -140,18 +426,17 @@ void Texture3DImpl::resize(uint32_t w, uint32_t h, uint32_t d) {
     this->w = w;
     this->h = h;
     this->d = d;
-    glBindTexture(GL_TEXTURE_3D, id);
+    GLState::bind_texture(GL_TEXTURE_3D, id);
     glTexImage2D(GL_TEXTURE_3D, 0, internal_format, w, h, 0, format, type, 0);
-    glBindTexture(GL_TEXTURE_3D, 0);
+    GLState::unbind_texture(GL_TEXTURE_3D, id);
 }
 
 void Texture3DImpl::bind(uint32_t unit) const {
-    glActiveTexture(GL_TEXTURE0 + unit);
-    glBindTexture(GL_TEXTURE_3D, id);
+    GLState::bind_texture(unit, GL_TEXTURE_3D, id);
 }
 
 void Texture3DImpl::unbind() const {
-    glBindTexture(GL_TEXTURE_3D, 0);
+    GLState::unbind_texture(GL_TEXTURE_3D, id);
 }
 
 void Texture3DImpl::bind_image(uint32_t unit, GLenum access, GLenum format) const {
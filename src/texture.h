@@ -6,16 +6,37 @@ namespace fs = std::filesystem;
 #include <GL/glew.h>
 #include <GL/gl.h>
 #include "named_handle.h"
+#include "image_load_store.h"
+#include "compressed_image.h"
 
 CPPGL_NAMESPACE_BEGIN
 
+// CPU block compression of LDR images on load (see Texture2DImpl::compression)
+enum TextureCompression : uint32_t {
+    TEXTURE_COMPRESSION_NONE = 0,   // upload uncompressed (default)
+    TEXTURE_COMPRESSION_FAST,       // BC1 (RGB), BC3 (RGBA)
+    TEXTURE_COMPRESSION_QUALITY,    // BC7 (RGB, RGBA)
+};                                  // 1 and 2 channel images use BC4 and BC5
+
+// GPU storage of HDR (float) images on load (see Texture2DImpl::hdr_storage)
+enum TextureHDRStorage : uint32_t {
+    TEXTURE_HDR_FLOAT = 0,  // 32 bit float, as decoded
+    TEXTURE_HDR_HALF,       // 16 bit float, RGB is stored as RGBA16F (default)
+    TEXTURE_HDR_RGB9E5,     // shared exponent, RGB without mipmaps only (not renderable), others use half floats
+};
+
 // ----------------------------------------------------
 // Texture2D
 
 class Texture2DImpl {
 public:
-    // construct from image on disk
+    // construct from image on disk (.dds and .ktx2 with BC1-BC7 data are uploaded incl. their mip chain, flipped like image_load)
     Texture2DImpl(const std::string& name, const fs::path& path, bool mipmap = true);
+    // construct from image already decoded from path (e.g. via image_load on another thread)
+    // without pixel data only storage is allocated, an image of size 0 yields a placeholder without GL texture
+    Texture2DImpl(const std::string& name, const fs::path& path, const ImageData& image, bool mipmap = true);
+    // construct from block compressed image (mip chain as given)
+    Texture2DImpl(const std::string& name, const fs::path& path, const CompressedImage& image, bool mipmap = true);
     // construct empty texture or from raw data
     Texture2DImpl(const std::string& name, uint32_t w, uint32_t h, GLint internal_format, GLenum format, GLenum type,
             const void* data = 0, bool mipmap = false);
@@ -29,7 +50,7 @@ public:
     explicit inline operator bool() const  { return w > 0 && h > 0 && glIsTexture(id); }
     inline operator GLuint() const { return id; }
 
-    // resize (discards all data!)
+    // resize (discards all data!), keeps the id: 2D textures use mutable storage on every GL version
     void resize(uint32_t w, uint32_t h);
 
     // bind/unbind to/from OpenGL
@@ -38,7 +59,13 @@ public:
     void bind_image(uint32_t unit, GLenum access, GLenum format) const;
     void unbind_image(uint32_t unit) const;
 
-    // TODO CPU <-> GPU data transfers
+    // upload a region of mip level 0 (or another level), data is an offset if a GL_PIXEL_UNPACK_BUFFER is bound
+    void upload_subimage(int x, int y, int w, int h, const void* data, uint32_t level = 0);
+    void generate_mipmaps();
+    // exchange GL texture and format with other (name and path are kept), e.g. to fill a placeholder
+    void swap(Texture2DImpl& other);
+    // client format matching the stored channels, for readbacks (format may be a padded upload layout, e.g. GL_RGBA into GL_RGB8)
+    GLenum pixel_format() const;
 
     // save to disk
     void save_ldr(const fs::path& path, bool flip = true, bool async = false) const;
@@ -50,6 +77,25 @@ public:
     int w, h;
     GLint internal_format;
     GLenum format, type;
+
+    // block compress LDR images on load, compressed copies of files are cached as <file>.<absolute path hash>.<fast|quality>.dds
+    static TextureCompression compression;
+    static fs::path compression_cache_directory; // default: ".cppgl_cache" in the working directory, empty: next to the source file
+    static fs::path compression_cache_path(const fs::path& path);
+
+    // decoded images are converted to GPU-native layouts before upload: RGB8 is sent as RGBA, float -> see hdr_storage
+    static TextureHDRStorage hdr_storage;
+    static size_t upload_pixel_bytes(int channels, bool is_hdr, bool mipmap);
+    // convert decoded pixels into the upload layout (dst holds pixels * upload_pixel_bytes())
+    static void convert_for_upload(const uint8_t* src, uint8_t* dst, size_t pixels, int channels, bool is_hdr, bool mipmap);
+    // file loads share one growable upload PBO, release it before the GL context goes away
+    static void release_upload_buffer();
+
+private:
+    void init(const ImageData& image, bool mipmap);
+    void init(const CompressedImage& image, bool mipmap);
+    void load_via_pbo(bool mipmap); // uncompressed file, decoded into a PUBO
+    bool load_compression_cache(bool mipmap); // false if missing, stale or corrupt
 };
 
 using Texture2D = NamedHandle<Texture2DImpl>;
@@ -0,0 +1,129 @@
+#include "texture_cache.h"
+#include <map>
+#include <vector>
+#include <cstring>
+#include <system_error>
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// helper funcs
+
+static uint32_t format_channels(GLenum format) {
+    switch (format) {
+    case GL_RG: return 2;
+    case GL_RGB: case GL_BGR: return 3;
+    case GL_RGBA: case GL_BGRA: return 4;
+    default: return 1;
+    }
+}
+
+static uint32_t type_bytes(GLenum type) {
+    switch (type) {
+    case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: return 2;
+    case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT: return 4;
+    default: return 1;
+    }
+}
+
+// FNV-1a
+static uint64_t hash_bytes(const uint8_t* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    return hash;
+}
+
+static std::string file_key(const fs::path& path, bool mipmap) {
+    std::error_code ec;
+    const fs::path canonical = fs::weakly_canonical(path, ec);
+    return (ec ? path : canonical).string() + (mipmap ? "#mip" : "");
+}
+
+// make shared textures findable under every name they were requested with
+static void alias(const std::string& name, const Texture2D& texture) {
+    if (name != texture->name) Texture2D::insert(name, texture);
+}
+
+struct DataEntry {
+    uint32_t w, h;
+    GLint internal_format;
+    GLenum format, type;
+    bool mipmap;
+    std::vector<uint8_t> data;
+    Texture2D texture;
+};
+
+static std::map<std::string, Texture2D> files;
+static std::multimap<uint64_t, DataEntry> data_entries;
+
+// ------------------------------------------
+// TextureCache
+
+bool TextureCache::enabled = true;
+
+Texture2D TextureCache::load(const std::string& name, const fs::path& path, bool mipmap, bool lazy) {
+    if (!enabled)
+        return lazy ? Texture2D(name, path, ImageData(), mipmap) : Texture2D(name, path, mipmap);
+    const std::string key = file_key(path, mipmap);
+    const auto it = files.find(key);
+    if (it != files.end()) {
+        Texture2D texture = it->second;
+        if (!lazy && texture->id == 0) { // fill placeholder
+            Texture2DImpl loaded(texture->name, path, mipmap);
+            texture->swap(loaded);
+        }
+        alias(name, texture);
+        return texture;
+    }
+    const Texture2D texture = lazy ? Texture2D(name, path, ImageData(), mipmap) : Texture2D(name, path, mipmap);
+    files[key] = texture;
+    return texture;
+}
+
+Texture2D TextureCache::load(const std::string& name, const fs::path& path, const ImageData& image, bool mipmap) {
+    if (!enabled)
+        return Texture2D(name, path, image, mipmap);
+    const std::string key = file_key(path, mipmap);
+    const auto it = files.find(key);
+    if (it != files.end()) {
+        Texture2D texture = it->second;
+        if (texture->id == 0 && !std::get<0>(image).empty()) { // fill placeholder
+            Texture2DImpl loaded(texture->name, path, image, mipmap);
+            texture->swap(loaded);
+        }
+        alias(name, texture);
+        return texture;
+    }
+    const Texture2D texture(name, path, image, mipmap);
+    files[key] = texture;
+    return texture;
+}
+
+Texture2D TextureCache::load(const std::string& name, uint32_t w, uint32_t h, GLint internal_format, GLenum format, GLenum type, const void* data, bool mipmap) {
+    if (!enabled || !data)
+        return Texture2D(name, w, h, internal_format, format, type, data, mipmap);
+    const size_t size = size_t(w) * h * format_channels(format) * type_bytes(type);
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t hash = hash_bytes(bytes, size);
+    const uint32_t params[6] = { w, h, uint32_t(internal_format), format, type, mipmap ? 1u : 0u };
+    hash = hash_bytes((const uint8_t*)params, sizeof(params), hash);
+    const auto range = data_entries.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        const DataEntry& entry = it->second;
+        if (entry.w == w && entry.h == h && entry.internal_format == internal_format && entry.format == format && entry.type == type &&
+                entry.mipmap == mipmap && entry.data.size() == size && std::memcmp(entry.data.data(), bytes, size) == 0) {
+            alias(name, entry.texture);
+            return entry.texture;
+        }
+    }
+    const Texture2D texture(name, w, h, internal_format, format, type, data, mipmap);
+    data_entries.emplace(hash, DataEntry{ w, h, internal_format, format, type, mipmap, std::vector<uint8_t>(bytes, bytes + size), texture });
+    return texture;
+}
+
+void TextureCache::clear() {
+    files.clear();
+    data_entries.clear();
+}
+
+CPPGL_NAMESPACE_END
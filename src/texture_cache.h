@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <filesystem>
+namespace fs = std::filesystem;
+#include <GL/glew.h>
+#include <GL/gl.h>
+#include "platform.h"
+#include "image_load_store.h"
+#include "texture.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// TextureCache (share one GL texture between all users of the same image file or raw data, GL thread only)
+// Files are keyed by canonical path and mipmap option, raw data by a content hash (verified against a copy of the data).
+// Cached textures are shared, so never modify their contents. The first name a texture was requested with is kept,
+// later names are registered as aliases, so Texture2D::find() works with any of them.
+
+class TextureCache {
+public:
+    // image file, lazy: return a placeholder without GL texture (see MaterialImpl::lazy_textures) if not loaded yet
+    static Texture2D load(const std::string& name, const fs::path& path, bool mipmap = true, bool lazy = false);
+    // image file already decoded (e.g. on a worker), an empty image yields a placeholder as above
+    static Texture2D load(const std::string& name, const fs::path& path, const ImageData& image, bool mipmap = true);
+    // raw data, e.g. 1x1 constant color fallbacks
+    static Texture2D load(const std::string& name, uint32_t w, uint32_t h, GLint internal_format, GLenum format, GLenum type,
+            const void* data, bool mipmap = false);
+
+    // drop all references held by the cache (textures still in use stay alive)
+    static void clear();
+
+    static bool enabled; // default: true, otherwise every call creates a new texture
+};
+
+CPPGL_NAMESPACE_END
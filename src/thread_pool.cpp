@@ -0,0 +1,72 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+CPPGL_NAMESPACE_BEGIN
+
+static thread_local bool worker_thread = false;
+
+// ------------------------------------------
+// ThreadPool
+
+ThreadPool::ThreadPool(uint32_t num_threads) : stop(false) {
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t i = 0; i < num_threads; ++i)
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::worker_loop() {
+    worker_thread = true;
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return stop || !queue.empty(); });
+            // finish queued work before shutting down
+            if (queue.empty()) return;
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        task();
+    }
+}
+
+bool ThreadPool::is_worker_thread() {
+    return worker_thread;
+}
+
+ThreadPool& ThreadPool::global() {
+    static ThreadPool pool;
+    return pool;
+}
+
+// ------------------------------------------
+// parallel_for
+
+void parallel_for(uint32_t count, uint32_t threshold, const std::function<void(uint32_t, uint32_t)>& func) {
+    if (count < threshold || ThreadPool::is_worker_thread() || ThreadPool::global().size() == 1) {
+        func(0, count);
+        return;
+    }
+    // the calling thread takes the first chunk itself
+    const uint32_t num_chunks = ThreadPool::global().size();
+    const uint32_t chunk = (count + num_chunks - 1) / num_chunks;
+    std::vector<std::future<void>> futures;
+    for (uint32_t begin = chunk; begin < count; begin += chunk)
+        futures.push_back(ThreadPool::global().enqueue([&func, begin, end = std::min(count, begin + chunk)]() { func(begin, end); }));
+    func(0, std::min(count, chunk));
+    for (auto& future : futures)
+        future.get();
+}
+
+CPPGL_NAMESPACE_END
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <future>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include "platform.h"
+
+CPPGL_NAMESPACE_BEGIN
+
+// ------------------------------------------
+// ThreadPool (fixed set of worker threads processing a FIFO task queue)
+
+class ThreadPool {
+public:
+    // num_threads = 0: one per hardware thread
+    ThreadPool(uint32_t num_threads = 0);
+    virtual ~ThreadPool();
+
+    // prevent copies and moves, workers reference this pool
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // queue func for execution on a worker, exceptions are rethrown by future::get()
+    template <typename F> auto enqueue(F&& func) -> std::future<decltype(func())> {
+        using R = decltype(func());
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(func));
+        std::future<R> result = task->get_future();
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            queue.emplace_back([task]() { (*task)(); });
+        }
+        cv.notify_one();
+        return result;
+    }
+
+    inline uint32_t size() const { return uint32_t(workers.size()); }
+
+    // true if called from a worker of any pool (waiting on the pool from there may deadlock)
+    static bool is_worker_thread();
+    // pool shared by all of cppgl (loaders, geometry processing)
+    static ThreadPool& global();
+
+private:
+    void worker_loop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> queue;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop;
+};
+
+// run func on the global pool, or right away if called from a worker (waiting on the pool from there could deadlock)
+template <typename F> auto run_async(F&& func) -> std::future<decltype(func())> {
+    if (!ThreadPool::is_worker_thread())
+        return ThreadPool::global().enqueue(std::forward<F>(func));
+    std::packaged_task<decltype(func())()> task(std::forward<F>(func));
+    task();
+    return task.get_future();
+}
+
+// run func(begin, end) over [0, count) in chunks on the global pool and wait for completion
+// (runs serially below threshold and when called from a worker thread)
+void parallel_for(uint32_t count, uint32_t threshold, const std::function<void(uint32_t, uint32_t)>& func);
+
+CPPGL_NAMESPACE_END